@@ -5,43 +5,35 @@
 #include <linux/fs.h>
 #include <linux/uaccess.h>
 #include <linux/cdev.h>
+#include <linux/mm.h>
+#include <linux/uio.h>
+#include <linux/vmalloc.h>
 
 MODULE_LICENSE("GPL");
 MODULE_DESCRIPTION("BSU CS 452 HW4");
 MODULE_AUTHOR("<buff@cs.boisestate.edu>");
 
+/* Payload size in bytes: "Hello world!\n" repeated to fill it. As a
+   baseline for char-device read cost, reads copy straight out of one shared
+   buffer, with no per-open state, locking or parsing. */
+static unsigned int size=13;
+module_param(size,uint,0444);
+MODULE_PARM_DESC(size,"Payload size in bytes (default 13)");
+
 typedef struct {
   dev_t devno;
   struct cdev cdev;
-  char *s;
+  char *s;			/* payload, page-aligned for mmap() */
+  size_t n;			/* payload length */
 } Device;			/* per-init() data */
 
-typedef struct {
-  char *s;
-} File;				/* per-open() data */
-
 static Device device;
 
 static int open(struct inode *inode, struct file *filp) {
-  File *file=(File *)kmalloc(sizeof(*file),GFP_KERNEL);
-  if (!file) {
-    printk(KERN_ERR "%s: kmalloc() failed\n",DEVNAME);
-    return -ENOMEM;
-  }
-  file->s=(char *)kmalloc(strlen(device.s)+1,GFP_KERNEL);
-  if (!file->s) {
-    printk(KERN_ERR "%s: kmalloc() failed\n",DEVNAME);
-    return -ENOMEM;
-  }
-  strcpy(file->s,device.s);
-  filp->private_data=file;
   return 0;
 }
 
 static int release(struct inode *inode, struct file *filp) {
-  File *file=filp->private_data;
-  kfree(file->s);
-  kfree(file);
   return 0;
 }
 
@@ -49,42 +41,77 @@ static ssize_t read(struct file *filp,
 		    char *buf,
 		    size_t count,
 		    loff_t *f_pos) { 
-  File *file=filp->private_data;
-  int n=strlen(file->s);
-  n=(n<count ? n : count);
-  if (copy_to_user(buf,file->s,n)) {
-    printk(KERN_ERR "%s: copy_to_user() failed\n",DEVNAME);
+  size_t n;
+  if (*f_pos>=device.n)
     return 0;
+  n=min_t(size_t,device.n-*f_pos,count);
+  if (copy_to_user(buf,device.s+*f_pos,n)) {
+    printk(KERN_ERR "%s: copy_to_user() failed\n",DEVNAME);
+    return -EFAULT;
   }
+  *f_pos+=n;
   return n;
 }
 
+static ssize_t read_iter(struct kiocb *iocb, struct iov_iter *to) {
+  size_t n;
+  if (iocb->ki_pos>=device.n)
+    return 0;
+  n=copy_to_iter(device.s+iocb->ki_pos,device.n-iocb->ki_pos,to);
+  if (!n && iov_iter_count(to))
+    return -EFAULT;
+  iocb->ki_pos+=n;
+  return n;
+}
+
+/* Read-only mappings of the payload, so page faults can be measured too */
+static int mmap(struct file *filp, struct vm_area_struct *vma) {
+  if (vma->vm_flags & VM_WRITE)
+    return -EACCES;
+  vm_flags_clear(vma,VM_MAYWRITE);
+  return remap_vmalloc_range(vma,device.s,vma->vm_pgoff);
+}
+
 static long ioctl(struct file *filp,
                  unsigned int cmd,
 		 unsigned long arg) {
   return 0;
 }
 
+static loff_t llseek(struct file *filp, loff_t off, int whence) {
+  return fixed_size_llseek(filp,off,whence,device.n);
+}
+
 static struct file_operations ops={
   .open=open,
   .release=release,
   .read=read,
+  .read_iter=read_iter,
+  .mmap=mmap,
+  .llseek=llseek,
   .unlocked_ioctl=ioctl,
   .owner=THIS_MODULE
 };
 
 static int __init my_init(void) {
   const char *s="Hello world!\n";
+  size_t len=strlen(s);
+  size_t i;
   int err;
-  device.s=(char *)kmalloc(strlen(s)+1,GFP_KERNEL);
+  if (!size)
+    return -EINVAL;
+  device.n=size;
+  device.s=(char *)vmalloc_user(PAGE_ALIGN(device.n));
   if (!device.s) {
-    printk(KERN_ERR "%s: kmalloc() failed\n",DEVNAME);
+    printk(KERN_ERR "%s: vmalloc_user() failed\n",DEVNAME);
     return -ENOMEM;
   }
-  strcpy(device.s,s);
+  for (i=0; i<device.n; i++)
+    device.s[i]=s[i%len];
   err=alloc_chrdev_region(&device.devno,0,1,DEVNAME);
   if (err<0) {
     printk(KERN_ERR "%s: alloc_chrdev_region() failed\n",DEVNAME);
+    vfree(device.s);
     return err;
   }
   cdev_init(&device.cdev,&ops);
@@ -92,6 +119,8 @@ static int __init my_init(void) {
   err=cdev_add(&device.cdev,device.devno,1);
   if (err) {
     printk(KERN_ERR "%s: cdev_add() failed\n",DEVNAME);
+    unregister_chrdev_region(device.devno,1);
+    vfree(device.s);
     return err;
   }
   printk(KERN_INFO "%s: init\n",DEVNAME);
@@ -101,7 +130,7 @@ static int __init my_init(void) {
 static void __exit my_exit(void) {
   cdev_del(&device.cdev);
   unregister_chrdev_region(device.devno,1);
-  kfree(device.s);
+  vfree(device.s);
   printk(KERN_INFO "%s: exit\n",DEVNAME);
 }
 
@@ -16,10 +16,11 @@ int main() {
     ERR("open() failed");
   enum { size=100 };
   char buf[size];
-  for (int len; (len=read(fd,buf,size));) {
-    buf[len]=0;
-    printf("%s",buf);
-  }
+  int len;
+  while ((len=read(fd,buf,size))>0)
+    fwrite(buf,1,len,stdout);
+  if (len<0)
+    ERR("read() failed");
   close(fd);
   return 0;
 }
@@ -5,8 +5,246 @@
 #ifndef HW5_NEWSCANNER_H
 #define HW5_NEWSCANNER_H
 
-// Header file: scanner.h
-#define SCANNER_SET_SEPARATORS _IOW('s', 0, char *)
+#include <linux/ioctl.h>
+#include <linux/types.h>
+#include <linux/filter.h>
 
+// Read modes (SCANNER_MODE_*) and their record formats live with the encoder
+#include "ScannerCore.h"
+
+// Header file: scanner.h, shared by the module and user-space clients
+#define SCANNER_MAGIC 'q'
+
+// Longest separator string accepted; one byte per distinct character
+#define SCANNER_MAX_SEPARATORS 255
+
+// arg points to a NUL-terminated string of separator characters
+#define SCANNER_SET_SEPARATORS _IOW(SCANNER_MAGIC, 1, char *)
+
+// Bitmask of what this module supports: SCANNER_FEATURE_MODE(m) for each read
+// mode, plus SCANNER_FEATURE_MMAP. Older modules fail this with ENOTTY and
+// support token mode only.
+#define SCANNER_GET_FEATURES _IOR(SCANNER_MAGIC, 2, __u32)
+#define SCANNER_FEATURE_MODE(m) (1u << (m))
+#define SCANNER_FEATURE_MMAP    (1u << 16)
+#define SCANNER_FEATURE_STREAM  (1u << 17)
+#define SCANNER_FEATURE_INPUT_RING (1u << 18)
+#define SCANNER_FEATURE_OUTPUT_RING (1u << 19)
+#define SCANNER_FEATURE_BATCH   (1u << 20)
+#define SCANNER_FEATURE_URING_CMD (1u << 21)
+#define SCANNER_FEATURE_EVENTFD (1u << 22)
+#define SCANNER_FEATURE_WINDOW  (1u << 23)
+#define SCANNER_FEATURE_FILTER  (1u << 24)
+#define SCANNER_FEATURE_RULES   (1u << 25)
+#define SCANNER_FEATURE_JSON    (1u << 26)
+#define SCANNER_FEATURE_PAIRS   (1u << 27)
+#define SCANNER_FEATURE_CDC     (1u << 28)
+#define SCANNER_FEATURE_FIXED   (1u << 29)
+
+// arg is the SCANNER_MODE_* for later reads on this file; the cursor is kept.
+// Set SCANNER_MODE_INDEX (and the separators) before writing and the index is
+// built while the data is copied in, so reads only copy it out.
+#define SCANNER_SET_MODE _IO(SCANNER_MAGIC, 3)
+
+// Documents of at least this many bytes can be mapped read-only with mmap(),
+// e.g. to resolve index mode records in place
+#define SCANNER_MMAP_MIN 4096
+
+// arg nonzero starts a stream on this file: later writes append to its own
+// document, and a token running into the end of the data is held back, with
+// reads failing with EAGAIN, until more arrives. arg 0 ends the stream and
+// releases that last token.
+#define SCANNER_SET_STREAM _IO(SCANNER_MAGIC, 4)
+
+// Zero-copy input. arg is the size of a ring of input bytes, a power of two
+// from a page up to SCANNER_RING_MAX, which the producer maps read-write at
+// SCANNER_OFF_INPUT_RING and fills directly. Setting it up starts a stream as
+// SCANNER_SET_STREAM does, and write() then fails with EBUSY. Index and digest
+// records would point into the ring, so neither mode can be set along with it
+// (EINVAL).
+#define SCANNER_SET_INPUT_RING _IO(SCANNER_MAGIC, 5)
+#define SCANNER_RING_MAX (64u << 20)
+#define SCANNER_OFF_INPUT_RING 0x10000000
+
+// Tokenize the input ring up to its tail, in place
+#define SCANNER_RING_DOORBELL _IO(SCANNER_MAGIC, 6)
+
+// First page of a ring mapping. Positions count bytes since the ring was set
+// up and wrap at 2^32; byte p is at data + p % size. The producer fills bytes
+// and then stores tail with release ordering; the consumer loads tail with
+// acquire ordering, uses the bytes and then stores head past them, so there is
+// room for size - (tail - head) more. For the input ring the producer rings
+// the doorbell and the kernel consumes as tokens are read; a token must be
+// shorter than that ring to ever be completed.
+typedef struct {
+    __u32 head;         // Written by the consumer
+    __u32 tail;         // Written by the producer
+    __u32 size;         // Bytes in the data area
+    __u32 data;         // Offset of the data area from the start of the mapping
+} ScannerRingHeader;
+
+// Zero-syscall output. arg is the size of a ring, as for the input ring, that
+// the consumer maps read-write at SCANNER_OFF_OUTPUT_RING. The kernel produces
+// records in the file's read mode, which must not be token mode, whenever
+// input arrives and whenever the file is polled; records may wrap. Poll for
+// POLLIN to wait for more. read() fails with EBUSY while it is set up.
+#define SCANNER_SET_OUTPUT_RING _IO(SCANNER_MAGIC, 7)
+#define SCANNER_OFF_OUTPUT_RING 0x20000000
+
+// Counters for one open file
+typedef struct {
+    __u64 writes;       // Successful writes, appends and doorbells
+    __u64 bytes_written;
+    __u64 reads;        // Successful reads, including those returning 0
+    __u64 tokens;       // Tokens completed by reads and the output ring
+} ScannerStats;
+
+#define SCANNER_GET_STATS _IOR(SCANNER_MAGIC, 8, ScannerStats)
+
+// One operation of a SCANNER_BATCH, with addr a user pointer
+#define SCANNER_OP_SET_SEPARATORS 0     // addr: NUL-terminated separators
+#define SCANNER_OP_WRITE          1     // addr, len: as for write()
+#define SCANNER_OP_READ           2     // addr, len: as for read(), and at most max_tokens tokens if nonzero
+#define SCANNER_OP_GET_STATS      3     // addr: a ScannerStats
+#define SCANNER_OP_SET_MODE       4     // len: the SCANNER_MODE_*
+#define SCANNER_OPS               5
+
+typedef struct {
+    __u32 op;           // SCANNER_OP_*
+    __u32 max_tokens;
+    __u64 addr;
+    __u64 len;
+    __s64 result;       // Set by the kernel: what the call would return, or -errno
+} ScannerOp;
+
+// Run count ScannerOps at ops in order, stopping after the first that fails.
+// Returns how many ran; each has its result filled in.
+typedef struct {
+    __u64 ops;
+    __u32 count;        // At most SCANNER_BATCH_MAX
+    __u32 flags;        // Must be 0
+} ScannerBatch;
+
+#define SCANNER_BATCH _IOW(SCANNER_MAGIC, 9, ScannerBatch)
+#define SCANNER_BATCH_MAX 1024
+
+// The same operations submitted through io_uring: an IORING_OP_URING_CMD SQE
+// with cmd_op a SCANNER_OP_* and this in its command area; the CQE's res is
+// the op's result. With IORING_URING_CMD_FIXED in uring_cmd_flags, addr and
+// len of a read or write lie in the registered buffer at buf_index.
+typedef struct {
+    __u64 addr;
+    __u32 len;
+    __u32 max_tokens;
+} ScannerUringCmd;
+
+// Signal the eventfd fd whenever pollers are woken, and set the tokens (1 if
+// 0) and timeout_ns of the batch window, keeping the byte limit of
+// SCANNER_SET_WINDOW. Each signal adds 1 to the eventfd's count; drain until
+// reads fail with EAGAIN. fd -1 removes the eventfd and puts the window last
+// set by SCANNER_SET_WINDOW, if any, back in force.
+typedef struct {
+    __s32 fd;
+    __u32 tokens;
+    __u64 timeout_ns;
+} ScannerEventfd;
+
+#define SCANNER_SET_EVENTFD _IOW(SCANNER_MAGIC, 10, ScannerEventfd)
+
+// Batch window for waking pollers while streaming. Without one, every
+// append, doorbell or end of stream wakes them. With one, they are woken once
+// at least tokens new tokens or bytes new bytes have arrived (0 ignores that
+// limit), when the input is complete, or timeout_ns after the first of a
+// smaller batch if that is nonzero. All zero turns the window off.
+typedef struct {
+    __u32 tokens;
+    __u32 bytes;
+    __u64 timeout_ns;
+} ScannerWindow;
+
+#define SCANNER_SET_WINDOW _IOW(SCANNER_MAGIC, 11, ScannerWindow)
+
+// What a SCANNER_SET_FILTER program sees of each token: its length and its
+// first bytes, zero padded, loaded only as aligned 32-bit words
+// (BPF_LD | BPF_W | BPF_ABS) in host byte order; BPF_LEN is the size of this
+// struct. The program returns 0 to drop the token and anything else to keep
+// it, with that value as its type in SCANNER_MODE_TYPED.
+typedef struct {
+    __u32 len;
+    __u32 head[8];
+} ScannerFilterCtx;
+
+// arg is a classic BPF program run on each token before it is read, as for
+// SO_ATTACH_FILTER; a program of length 0 detaches it. Index reads then scan
+// rather than use the index built at write time.
+#define SCANNER_SET_FILTER _IOW(SCANNER_MAGIC, 12, struct sock_fprog)
+
+// Lexer rules in place of the separators: dfa points to size bytes of a
+// ScannerDfa, as compiled from (pattern, type) rules by scanner_rules_compile
+// in libscanner. Reads from the file's position on return the longest match
+// at each point, with its type in SCANNER_MODE_TYPED. size 0 goes back to
+// the separators. Index reads then scan, as with a filter.
+// Replaces SCANNER_SET_JSON, SCANNER_SET_PAIRS, SCANNER_SET_CDC and
+// SCANNER_SET_FIXED.
+typedef struct {
+    __u64 dfa;
+    __u32 size;
+    __u32 flags;        // Must be 0
+} ScannerRules;
+
+#define SCANNER_SET_RULES _IOW(SCANNER_MAGIC, 13, ScannerRules)
+
+// arg nonzero tokenizes JSON text, e.g. JSON lines, in place of the
+// separators, typing tokens as SCANNER_JSON_TYPE(kind, depth) for
+// SCANNER_MODE_TYPED; 0 goes back to the separators. Replaces any rules,
+// pairs, chunking or fixed-width records.
+#define SCANNER_SET_JSON _IO(SCANNER_MAGIC, 14)
+
+// Key=value pairs in place of the separators, e.g. logfmt lines: each key
+// and then its value, typed for SCANNER_MODE_TYPED as described at
+// SCANNER_KV_KEY. keys points to keys_size bytes of names to intern, each
+// NUL-terminated, given IDs from 1 in order. assign empty goes back to the
+// separators. Replaces any rules, JSON, chunking or fixed-width records.
+typedef struct {
+    char pairs[SCANNER_KV_MAX_DELIMS + 1];    // NUL-terminated pair delimiters, e.g. " "
+    char assign[SCANNER_KV_MAX_DELIMS + 1];   // And between key and value, e.g. "="
+    __u64 keys;
+    __u32 keys_size;    // At most SCANNER_KV_MAX_NAMES
+    __u32 quote;        // Byte quoting values, e.g. '"', or 0
+} ScannerPairs;
+
+#define SCANNER_SET_PAIRS _IOW(SCANNER_MAGIC, 15, ScannerPairs)
+
+// Content-defined chunks in place of the separators, e.g. for deduplicating
+// backups: tokens of min to max bytes cut by a rolling hash, as described at
+// SCANNER_CDC_CUT. Read them in SCANNER_MODE_DIGEST for each chunk's offset,
+// length and SHA-256. When streaming, a chunk is held until its cut point or
+// max bytes have arrived, so an input ring must be larger than max; offsets
+// then move with each append, but chunks still follow one another, so their
+// lengths give their place in the stream. avg 0 goes back to the separators.
+// Replaces any rules, JSON, pairs or fixed-width records.
+typedef struct {
+    __u32 min;
+    __u32 avg;          // A power of two, from SCANNER_CDC_MIN_AVG to SCANNER_CDC_MAX_AVG
+    __u32 max;          // At most SCANNER_CDC_MAX_SIZE
+    __u32 flags;        // Must be 0
+} ScannerChunking;
+
+#define SCANNER_SET_CDC _IOW(SCANNER_MAGIC, 16, ScannerChunking)
+
+// Fixed-width records in place of the separators: widths points to ncolumns
+// __u32 field widths, each field a token typed with its column number for
+// SCANNER_MODE_TYPED, as described at SCANNER_FIXED_MAX_COLUMNS. ncolumns 0
+// goes back to the separators. Replaces any rules, JSON, pairs or chunking.
+typedef struct {
+    __u64 widths;
+    __u32 ncolumns;     // At most SCANNER_FIXED_MAX_COLUMNS
+    __u32 flags;        // SCANNER_FIXED_TRIM_*
+    char pad[16];       // NUL-terminated bytes to trim, e.g. " "
+} ScannerColumns;
+
+#define SCANNER_SET_FIXED _IOW(SCANNER_MAGIC, 17, ScannerColumns)
+
+#define SCANNER_IOC_MAXNR 17
 
 #endif //HW5_NEWSCANNER_H
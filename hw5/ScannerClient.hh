@@ -0,0 +1,435 @@
+//
+// Header-only C++17 client for the NewScanner device.
+//
+//   scanner::Device dev;                  // /dev/scanner_device, features probed once
+//   scanner::Session s = dev.open();
+//   s.separators(",;");
+//   s.write(text);
+//   for (std::string_view token : s.tokens()) { ... }
+//
+// A session picks the fastest read mode the module offers: index records
+// resolved against the mmap()ed document when it is large enough to map,
+// otherwise framed reads into an internal buffer, otherwise the legacy one
+// token per read(). Tokens are views into that buffer or mapping; each stays
+// valid until the iterator moves on, so copy what must outlive it. The range
+// is single-pass because tokens stream through a bounded buffer.
+//
+// scanner::split<Set>(text) tokenizes in process with the same semantics,
+// with the scan loop specialized at compile time for the separator set.
+//
+
+#ifndef HW5_SCANNERCLIENT_HH
+#define HW5_SCANNERCLIENT_HH
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "NewScanner.h"
+
+namespace scanner {
+
+inline constexpr const char *default_path = "/dev/scanner_device";
+
+// Failures carry errno and the operation that set it
+inline std::system_error error(const char *what) {
+    return std::system_error(errno, std::generic_category(), what);
+}
+
+// A separator set built at compile time: the same 256-bit table as ScannerSeps
+class SeparatorSet {
+public:
+    constexpr SeparatorSet(std::string_view chars) : chars_(chars) {
+        for (char c : chars) {
+            unsigned char u = static_cast<unsigned char>(c);
+            map_[u >> 6] |= std::uint64_t(1) << (u & 63);
+        }
+    }
+
+    constexpr bool contains(unsigned char c) const { return (map_[c >> 6] >> (c & 63)) & 1; }
+    constexpr std::string_view chars() const { return chars_; }
+
+    constexpr std::size_t size() const {
+        std::size_t n = 0;
+        for (unsigned c = 0; c < 256; c++) {
+            n += contains(static_cast<unsigned char>(c));
+        }
+        return n;
+    }
+
+    // Equal as sets, whatever the order or repeats in the strings
+    constexpr bool operator==(const SeparatorSet &other) const {
+        for (int i = 0; i < 4; i++) {
+            if (map_[i] != other.map_[i]) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    std::uint64_t map_[4] = {};
+    std::string_view chars_;
+};
+
+// The sets the core also specializes (SCANNER_BUILTIN_SETS)
+inline constexpr SeparatorSet whitespace{SCANNER_DEFAULT_SEPARATORS};
+inline constexpr SeparatorSet comma{","};
+inline constexpr SeparatorSet tab{"\t"};
+inline constexpr SeparatorSet newline{"\n"};
+
+// Membership test instantiated per set: whitespace is a range test, a
+// single byte one compare, anything else a lookup in a constant table
+template <const SeparatorSet &Set>
+constexpr bool is_separator(unsigned char c) {
+    if constexpr (Set == whitespace) {
+        return c == ' ' || static_cast<unsigned char>(c - '\t') < 5;
+    } else if constexpr (Set.size() == 1) {
+        return c == static_cast<unsigned char>(Set.chars()[0]);
+    } else {
+        return Set.contains(c);
+    }
+}
+
+// Tokens of text as views into it, as the device would produce them
+template <const SeparatorSet &Set = whitespace>
+class Split {
+public:
+    class iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = std::string_view;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const std::string_view *;
+        using reference = const std::string_view &;
+
+        iterator() = default;
+        constexpr iterator(const char *pos, const char *end) : end_(end) { advance(pos); }
+
+        constexpr reference operator*() const { return token_; }
+        constexpr pointer operator->() const { return &token_; }
+
+        constexpr iterator &operator++() {
+            advance(token_.data() + token_.size());
+            return *this;
+        }
+
+        constexpr iterator operator++(int) {
+            iterator it = *this;
+            ++*this;
+            return it;
+        }
+
+        constexpr bool operator==(const iterator &other) const {
+            return token_.data() == other.token_.data() && end_ == other.end_;
+        }
+        constexpr bool operator!=(const iterator &other) const { return !(*this == other); }
+
+    private:
+        constexpr void advance(const char *p) {
+            while (p != end_ && is_separator<Set>(static_cast<unsigned char>(*p))) {
+                p++;
+            }
+            const char *start = p;
+            while (p != end_ && !is_separator<Set>(static_cast<unsigned char>(*p))) {
+                p++;
+            }
+            // The end iterator is an empty view at end_
+            token_ = std::string_view(start == end_ ? end_ : start, p - start);
+        }
+
+        const char *end_ = nullptr;
+        std::string_view token_;
+    };
+
+    constexpr explicit Split(std::string_view text) : text_(text) {}
+
+    constexpr iterator begin() const { return iterator(text_.data(), text_.data() + text_.size()); }
+    constexpr iterator end() const { return iterator(text_.data() + text_.size(), text_.data() + text_.size()); }
+
+private:
+    std::string_view text_;
+};
+
+template <const SeparatorSet &Set = whitespace>
+constexpr Split<Set> split(std::string_view text) {
+    return Split<Set>(text);
+}
+
+class Session;
+
+// A scanner device node and what the loaded module supports
+class Device {
+public:
+    explicit Device(std::string path = default_path) : path_(std::move(path)) {
+        int fd = ::open(path_.c_str(), O_RDWR);
+        if (fd < 0) {
+            throw error("open");
+        }
+        std::uint32_t features = 0;
+        if (::ioctl(fd, SCANNER_GET_FEATURES, &features) == 0) {
+            features_ = features;
+        }
+        ::close(fd);
+    }
+
+    const std::string &path() const { return path_; }
+    std::uint32_t features() const { return features_; }
+    bool supports(int mode) const { return features_ & SCANNER_FEATURE_MODE(mode); }
+    bool can_map() const { return features_ & SCANNER_FEATURE_MMAP; }
+
+    Session open() const;
+
+private:
+    std::string path_;
+    std::uint32_t features_ = SCANNER_FEATURE_MODE(SCANNER_MODE_TOKEN);  // Pre-feature modules
+};
+
+// One open file: its own separators, read mode and document
+class Session {
+public:
+    class iterator;
+    struct sentinel {};
+
+    struct Tokens {
+        Session *session;
+        iterator begin();
+        sentinel end() { return {}; }
+    };
+
+    // bufsize is rounded down to whole index records
+    explicit Session(const Device &device, std::size_t bufsize = 64 * 1024)
+        : features_(device.features()),
+          buf_(std::max(bufsize / sizeof(ScannerSpan), std::size_t(2)) * sizeof(ScannerSpan)) {
+        fd_ = ::open(device.path().c_str(), O_RDWR);
+        if (fd_ < 0) {
+            throw error("open");
+        }
+        choose_mode();  // For whatever this minor last had written to it
+    }
+
+    Session(Session &&other) noexcept { *this = std::move(other); }
+
+    Session &operator=(Session &&other) noexcept {
+        if (this != &other) {
+            close();
+            fd_ = std::exchange(other.fd_, -1);
+            features_ = other.features_;
+            mode_ = other.mode_;
+            doclen_ = other.doclen_;
+            map_ = std::exchange(other.map_, nullptr);
+            maplen_ = std::exchange(other.maplen_, 0);
+            buf_ = std::move(other.buf_);
+            pos_ = other.pos_;
+            end_ = other.end_;
+            partial_ = std::move(other.partial_);
+        }
+        return *this;
+    }
+
+    Session(const Session &) = delete;
+    Session &operator=(const Session &) = delete;
+
+    ~Session() { close(); }
+
+    int fd() const { return fd_; }
+    int mode() const { return mode_; }
+
+    void separators(const SeparatorSet &set) { separators(set.chars()); }
+
+    void separators(std::string_view seps) {
+        std::string arg(seps);  // The ioctl takes a NUL-terminated string
+        if (::ioctl(fd_, SCANNER_SET_SEPARATORS, arg.c_str()) < 0) {
+            throw error("ioctl(SCANNER_SET_SEPARATORS)");
+        }
+    }
+
+    // Hand the module a new document and choose how to read it back
+    void write(std::string_view doc) {
+        ssize_t n = ::write(fd_, doc.data(), doc.size());
+        if (n < 0) {
+            throw error("write");
+        }
+        if (static_cast<std::size_t>(n) != doc.size()) {
+            errno = EIO;
+            throw error("write");
+        }
+        unmap();
+        doclen_ = doc.size();
+        choose_mode();
+    }
+
+    // Tokens of the current document, from wherever the cursor is
+    Tokens tokens() { return Tokens{this}; }
+
+private:
+    friend class iterator;
+
+    void close() {
+        unmap();
+        if (fd_ >= 0) {
+            ::close(fd_);
+            fd_ = -1;
+        }
+    }
+
+    void unmap() {
+        if (map_) {
+            ::munmap(const_cast<char *>(map_), maplen_);
+            map_ = nullptr;
+            maplen_ = 0;
+        }
+    }
+
+    void set_mode(int mode) {
+        if (::ioctl(fd_, SCANNER_SET_MODE, mode) < 0) {
+            throw error("ioctl(SCANNER_SET_MODE)");
+        }
+        mode_ = mode;
+    }
+
+    // Index records over a mapping avoid copying token bytes at all; framed
+    // reads copy them once but still fill a whole buffer per system call
+    void choose_mode() {
+        pos_ = end_ = 0;
+        if (doclen_ + 1 >= SCANNER_MMAP_MIN && (features_ & SCANNER_FEATURE_MMAP) &&
+            (features_ & SCANNER_FEATURE_MODE(SCANNER_MODE_INDEX))) {
+            void *p = ::mmap(nullptr, doclen_, PROT_READ, MAP_SHARED, fd_, 0);
+            if (p != MAP_FAILED) {
+                map_ = static_cast<const char *>(p);
+                maplen_ = doclen_;
+                set_mode(SCANNER_MODE_INDEX);
+                return;
+            }
+        }
+        if (features_ & SCANNER_FEATURE_MODE(SCANNER_MODE_FRAMED)) {
+            set_mode(SCANNER_MODE_FRAMED);
+        } else if (mode_ != SCANNER_MODE_TOKEN) {
+            set_mode(SCANNER_MODE_TOKEN);
+        }
+    }
+
+    // Refill the buffer; false at the end of the document
+    bool fill() {
+        ssize_t n;
+        do {
+            n = ::read(fd_, buf_.data(), buf_.size());
+        } while (n < 0 && errno == EINTR);
+        if (n < 0) {
+            throw error("read");
+        }
+        pos_ = 0;
+        end_ = static_cast<std::size_t>(n);
+        return n > 0;
+    }
+
+    // Decode the next token; false once the document is exhausted
+    bool next(std::string_view &token) {
+        switch (mode_) {
+            case SCANNER_MODE_INDEX: {
+                ScannerSpan span;
+                if (pos_ == end_ && !fill()) {
+                    return false;
+                }
+                std::memcpy(&span, buf_.data() + pos_, sizeof(span));
+                pos_ += sizeof(span);
+                token = std::string_view(map_ + span.offset, span.len);
+                return true;
+            }
+            case SCANNER_MODE_FRAMED: {
+                partial_.clear();
+                for (;;) {
+                    std::uint32_t word;
+                    if (pos_ == end_ && !fill()) {
+                        return false;
+                    }
+                    std::memcpy(&word, buf_.data() + pos_, sizeof(word));
+                    std::size_t len = word & ~SCANNER_FRAME_MORE;
+                    const char *bytes = buf_.data() + pos_ + sizeof(word);
+                    pos_ += sizeof(word) + len;
+                    if (!(word & SCANNER_FRAME_MORE)) {
+                        if (partial_.empty()) {
+                            token = std::string_view(bytes, len);
+                        } else {
+                            partial_.append(bytes, len);
+                            token = partial_;
+                        }
+                        return true;
+                    }
+                    // Larger than the buffer: reassemble across reads
+                    partial_.append(bytes, len);
+                }
+            }
+            default:
+                // Legacy token mode truncates tokens longer than the buffer
+                if (!fill()) {
+                    return false;
+                }
+                token = std::string_view(buf_.data(), end_);
+                pos_ = end_;
+                return true;
+        }
+    }
+
+    int fd_ = -1;
+    std::uint32_t features_ = 0;
+    int mode_ = SCANNER_MODE_TOKEN;
+    std::size_t doclen_ = 0;
+    const char *map_ = nullptr;
+    std::size_t maplen_ = 0;
+    std::vector<char> buf_;
+    std::size_t pos_ = 0;       // Next undecoded byte of buf_
+    std::size_t end_ = 0;       // Bytes of buf_ filled by the last read
+    std::string partial_;       // A token split across reads
+};
+
+class Session::iterator {
+public:
+    using iterator_category = std::input_iterator_tag;
+    using value_type = std::string_view;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const std::string_view *;
+    using reference = const std::string_view &;
+
+    iterator() = default;
+    explicit iterator(Session *session) : session_(session) { ++*this; }
+
+    reference operator*() const { return token_; }
+    pointer operator->() const { return &token_; }
+
+    iterator &operator++() {
+        if (session_ && !session_->next(token_)) {
+            session_ = nullptr;
+        }
+        return *this;
+    }
+
+    void operator++(int) { ++*this; }
+
+    friend bool operator==(const iterator &it, sentinel) { return !it.session_; }
+    friend bool operator!=(const iterator &it, sentinel s) { return !(it == s); }
+
+private:
+    Session *session_ = nullptr;
+    std::string_view token_;
+};
+
+inline Session::iterator Session::Tokens::begin() { return iterator(session); }
+
+inline Session Device::open() const { return Session(*this); }
+
+}  // namespace scanner
+
+#endif //HW5_SCANNERCLIENT_HH
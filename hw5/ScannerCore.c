@@ -0,0 +1,1472 @@
+#include "ScannerCore.h"
+
+#if defined(__SSE2__) && !defined(__KERNEL__)
+#include <emmintrin.h>
+#define SCANNER_SSE2 1
+#endif
+
+void scanner_seps_init(ScannerSeps *seps, const char *chars, size_t n) {
+    size_t i;
+
+    for (i = 0; i < 4; i++) {
+        seps->map[i] = 0;
+    }
+    seps->nchars = 0;
+    for (i = 0; i < n; i++) {
+        unsigned char c = chars[i];
+        if (scanner_is_sep(seps, c)) {
+            continue;
+        }
+        seps->map[c >> 6] |= (uint64_t)1 << (c & 63);
+        if (seps->nchars < SCANNER_SIMD_MAX_SEPS) {
+            seps->chars[seps->nchars] = c;
+        }
+        seps->nchars++;
+    }
+    if (seps->nchars > SCANNER_SIMD_MAX_SEPS) {
+        seps->nchars = 0;
+    }
+    seps->builtin = scanner_builtin_set(seps);
+}
+
+// Builtin strings list distinct bytes, so same size and all present means same set
+static int scanner_seps_equal(const ScannerSeps *seps, const char *chars, unsigned int n) {
+    unsigned int i;
+
+    if (seps->nchars != n) {
+        return 0;
+    }
+    for (i = 0; i < n; i++) {
+        if (!scanner_is_sep(seps, chars[i])) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int scanner_builtin_set(const ScannerSeps *seps) {
+#define X(name, chars, kind)                                        \
+    if (scanner_seps_equal(seps, chars, sizeof(chars) - 1)) {       \
+        return SCANNER_SET_##name;                                  \
+    }
+    SCANNER_BUILTIN_SETS(X)
+#undef X
+    return SCANNER_SET_CUSTOM;
+}
+
+void scanner_cursor_init(ScannerCursor *cursor, const char *data, size_t len) {
+    cursor->data = data;
+    cursor->len = data ? len : 0;
+    cursor->pos = 0;
+    cursor->open = 0;
+    cursor->block.len = 0;
+}
+
+size_t scanner_span_seps_scalar(const ScannerSeps *seps, const char *p, size_t n) {
+    const unsigned char *s = (const unsigned char *)p;
+    size_t i = 0;
+
+    while (i < n && scanner_is_sep(seps, s[i])) {
+        i++;
+    }
+    return i;
+}
+
+size_t scanner_span_token_scalar(const ScannerSeps *seps, const char *p, size_t n) {
+    const unsigned char *s = (const unsigned char *)p;
+    size_t i = 0;
+
+    while (i < n && !scanner_is_sep(seps, s[i])) {
+        i++;
+    }
+    return i;
+}
+
+#ifdef SCANNER_SSE2
+
+#define BLOCK 16
+typedef unsigned int BlockMask;         // Bit i set when byte i is a separator
+#define MASK_ALL 0xffffu
+#define MASK_FIRST(m) __builtin_ctz(m)
+
+static inline BlockMask chars_mask(const unsigned char *chars, unsigned int nchars, const char *p) {
+    __m128i block = _mm_loadu_si128((const __m128i *)p);
+    __m128i hits = _mm_setzero_si128();
+    unsigned int i;
+
+    for (i = 0; i < nchars; i++) {
+        hits = _mm_or_si128(hits, _mm_cmpeq_epi8(block, _mm_set1_epi8((char)chars[i])));
+    }
+    return (unsigned int)_mm_movemask_epi8(hits);
+}
+
+// \t \n \v \f \r are 9 through 13, so whitespace is a space or a byte
+// that lands below 5 after subtracting 9
+static inline BlockMask ws_mask(const unsigned char *chars, unsigned int nchars, const char *p) {
+    __m128i block = _mm_loadu_si128((const __m128i *)p);
+    __m128i space = _mm_cmpeq_epi8(block, _mm_set1_epi8(' '));
+    __m128i ctl = _mm_subs_epu8(_mm_sub_epi8(block, _mm_set1_epi8(9)), _mm_set1_epi8(4));
+
+    (void)chars;
+    (void)nchars;
+    return (unsigned int)_mm_movemask_epi8(_mm_or_si128(space, _mm_cmpeq_epi8(ctl, _mm_setzero_si128())));
+}
+
+// JSON whitespace, bytes that end a bare value and bytes that end a run inside
+// a string. [ and ] are { and } with bit 5 clear, so each pair is a single
+// compare; , and : keep their own, as \f and 0x1a would fold onto them.
+static inline void json_masks(const char *p, BlockMask *ws, BlockMask *stop, BlockMask *escape) {
+    __m128i block = _mm_loadu_si128((const __m128i *)p);
+    __m128i folded = _mm_or_si128(block, _mm_set1_epi8(0x20));
+    __m128i space = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8(' ')),
+                                              _mm_cmpeq_epi8(block, _mm_set1_epi8('\t'))),
+                                 _mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8('\n')),
+                                              _mm_cmpeq_epi8(block, _mm_set1_epi8('\r'))));
+    __m128i quote = _mm_cmpeq_epi8(block, _mm_set1_epi8('"'));
+    __m128i structural = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8(',')),
+                                                   _mm_cmpeq_epi8(block, _mm_set1_epi8(':'))),
+                                      _mm_or_si128(_mm_cmpeq_epi8(folded, _mm_set1_epi8('{')),
+                                                   _mm_cmpeq_epi8(folded, _mm_set1_epi8('}'))));
+
+    *ws = (unsigned int)_mm_movemask_epi8(space);
+    *stop = (unsigned int)_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(space, quote), structural));
+    *escape = (unsigned int)_mm_movemask_epi8(_mm_or_si128(quote, _mm_cmpeq_epi8(block, _mm_set1_epi8('\\'))));
+}
+
+#define SCANNER_VECTOR 1
+
+#else
+
+#define ONES  0x0101010101010101ULL
+#define LOW7  0x7f7f7f7f7f7f7f7fULL
+#define HIGHS 0x8080808080808080ULL
+
+#define BLOCK 8
+typedef uint64_t BlockMask;             // High bit of byte i set when byte i is a separator
+#define MASK_ALL HIGHS
+#define MASK_FIRST(m) (__builtin_ctzll(m) >> 3)
+
+static inline uint64_t load64(const char *p) {
+    uint64_t w;
+    __builtin_memcpy(&w, p, 8);
+    return w;
+}
+
+// Exact per-byte equality: high bit set where the byte of w equals c
+static inline uint64_t swar_eq(uint64_t w, unsigned char c) {
+    uint64_t x = w ^ (ONES * c);
+    return ~(((x & LOW7) + LOW7) | x | LOW7);
+}
+
+static inline BlockMask chars_mask(const unsigned char *chars, unsigned int nchars, const char *p) {
+    uint64_t w = load64(p);
+    uint64_t hits = 0;
+    unsigned int i;
+
+    for (i = 0; i < nchars; i++) {
+        hits |= swar_eq(w, chars[i]);
+    }
+    return hits;
+}
+
+// A space, or a 7-bit byte v with 9 <= v <= 13: v + 119 reaches the high bit
+// and v + 114 does not, and neither sum can carry into the next byte
+static inline BlockMask ws_mask(const unsigned char *chars, unsigned int nchars, const char *p) {
+    uint64_t w = load64(p);
+    uint64_t v = w & LOW7;
+
+    (void)chars;
+    (void)nchars;
+    return swar_eq(w, ' ') | ((v + ONES * 119) & ~(v + ONES * 114) & ~w & HIGHS);
+}
+
+// JSON whitespace, bytes that end a bare value and bytes that end a run
+// inside a string, folding brackets as the SSE2 version does
+static inline void json_masks(const char *p, BlockMask *ws, BlockMask *stop, BlockMask *escape) {
+    uint64_t w = load64(p);
+    uint64_t folded = w | ONES * 0x20;
+    uint64_t space = swar_eq(w, ' ') | swar_eq(w, '\t') | swar_eq(w, '\n') | swar_eq(w, '\r');
+    uint64_t quote = swar_eq(w, '"');
+
+    *ws = space;
+    *stop = space | quote | swar_eq(w, ',') | swar_eq(w, ':') | swar_eq(folded, '{') | swar_eq(folded, '}');
+    *escape = quote | swar_eq(w, '\\');
+}
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define SCANNER_VECTOR 1
+#endif
+
+#endif
+
+// Instantiate a span loop around a block mask. Builtin sets pass their
+// separators as constants, so the compare loop unrolls into immediates.
+#ifdef SCANNER_VECTOR
+#define SCANNER_DEFINE_SPAN(fn, MASK)                                             \
+    static size_t fn(const ScannerSeps *seps, const char *p, size_t n, int want_sep) { \
+        size_t i = 0;                                                             \
+                                                                                  \
+        for (; i + BLOCK <= n; i += BLOCK) {                                      \
+            BlockMask stop = MASK(seps, p + i);                                   \
+            if (want_sep) {                                                       \
+                stop = ~stop & MASK_ALL;                                          \
+            }                                                                     \
+            if (stop) {                                                           \
+                return i + MASK_FIRST(stop);                                      \
+            }                                                                     \
+        }                                                                         \
+        return i + (want_sep ? scanner_span_seps_scalar(seps, p + i, n - i)       \
+                             : scanner_span_token_scalar(seps, p + i, n - i));    \
+    }
+#else
+#define SCANNER_DEFINE_SPAN(fn, MASK)                                             \
+    static size_t fn(const ScannerSeps *seps, const char *p, size_t n, int want_sep) { \
+        return want_sep ? scanner_span_seps_scalar(seps, p, n)                    \
+                        : scanner_span_token_scalar(seps, p, n);                  \
+    }
+#endif
+
+#define custom_mask(seps, p) chars_mask((seps)->chars, (seps)->nchars, p)
+SCANNER_DEFINE_SPAN(span_custom, custom_mask)
+
+#define X(name, chars, kind)                                                      \
+    static inline BlockMask name##_mask(const ScannerSeps *seps, const char *p) { \
+        static const unsigned char set[] = chars;                                 \
+        (void)seps;                                                               \
+        return kind##_mask(set, sizeof(set) - 1, p);                              \
+    }                                                                             \
+    SCANNER_DEFINE_SPAN(span_##name, name##_mask)
+SCANNER_BUILTIN_SETS(X)
+#undef X
+
+static size_t span(const ScannerSeps *seps, const char *p, size_t n, int want_sep) {
+    switch (seps->builtin) {
+#define X(name, chars, kind) \
+        case SCANNER_SET_##name: return span_##name(seps, p, n, want_sep);
+        SCANNER_BUILTIN_SETS(X)
+#undef X
+        default: return span_custom(seps, p, n, want_sep);
+    }
+}
+
+const char *scanner_simd_name(void) {
+#ifdef SCANNER_SSE2
+    return "sse2";
+#else
+    return "swar";
+#endif
+}
+
+// Most tokens and separator runs are short, so the table settles them before
+// a vector is ever loaded; only long runs reach the vectorized loop
+#define SCANNER_SCALAR_PREFIX 8
+
+size_t scanner_span_seps(const ScannerSeps *seps, const char *p, size_t n) {
+    size_t i;
+
+    if (!seps->nchars || n <= SCANNER_SCALAR_PREFIX) {
+        return scanner_span_seps_scalar(seps, p, n);
+    }
+    i = scanner_span_seps_scalar(seps, p, SCANNER_SCALAR_PREFIX);
+    if (i < SCANNER_SCALAR_PREFIX) {
+        return i;
+    }
+    return i + span(seps, p + i, n - i, 1);
+}
+
+size_t scanner_span_token(const ScannerSeps *seps, const char *p, size_t n) {
+    size_t i;
+
+    if (!seps->nchars || n <= SCANNER_SCALAR_PREFIX) {
+        return scanner_span_token_scalar(seps, p, n);
+    }
+    i = scanner_span_token_scalar(seps, p, SCANNER_SCALAR_PREFIX);
+    if (i < SCANNER_SCALAR_PREFIX) {
+        return i;
+    }
+    return i + span(seps, p + i, n - i, 0);
+}
+
+// The table loop behind scanner_next_scalar, inlined wherever it is used
+static inline int next_table(const ScannerSeps *seps, ScannerCursor *cursor, ScannerToken *token) {
+    const unsigned char *data = (const unsigned char *)cursor->data;
+    size_t pos = cursor->pos;
+    size_t end;
+
+    // Skip leading separators
+    while (pos < cursor->len && scanner_is_sep(seps, data[pos])) {
+        pos++;
+    }
+    if (pos >= cursor->len) {
+        cursor->pos = cursor->len;
+        return 0;
+    }
+
+    // The token runs up to the next separator or the end of the document
+    end = pos + 1;
+    while (end < cursor->len && !scanner_is_sep(seps, data[end])) {
+        end++;
+    }
+    if (end == cursor->len && cursor->open) {
+        cursor->pos = pos;
+        return 0;
+    }
+
+    token->start = pos;
+    token->len = end - pos;
+    cursor->pos = end;
+    return 1;
+}
+
+#ifdef SCANNER_SSE2
+// scanner_next runs its table loops this far into a token or separator run
+// before handing the rest to the vectorized spans, which only pay for
+// themselves on longer runs than SCANNER_SCALAR_PREFIX stands for
+#define SCANNER_NEXT_PREFIX 32
+
+// The rest of scanner_next for a long run: separators from pos if end is pos,
+// else the token from pos, scanned up to end. Kept out of line so that
+// scanner_next stays a leaf function with next to no prologue.
+static __attribute__((noinline)) int scanner_next_long(const ScannerSeps *seps, ScannerCursor *cursor,
+                                                       ScannerToken *token, size_t pos, size_t end) {
+    size_t len = cursor->len;
+
+    if (end == pos) {
+        pos += span(seps, cursor->data + pos, len - pos, 1);
+        if (pos >= len) {
+            cursor->pos = len;
+            return 0;
+        }
+        end = pos;
+    }
+    end += span(seps, cursor->data + end, len - end, 0);
+    if (end == len && cursor->open) {
+        cursor->pos = pos;  // It may go on in the next append
+        return 0;
+    }
+    token->start = pos;
+    token->len = end - pos;
+    cursor->pos = end;
+    return 1;
+}
+
+// The table loops of scanner_next_scalar, each stopping after
+// SCANNER_NEXT_PREFIX bytes, settle the common short tokens and separator runs
+// without a single call
+int scanner_next(const ScannerSeps *seps, ScannerCursor *cursor, ScannerToken *token) {
+    const unsigned char *data = (const unsigned char *)cursor->data;
+    size_t pos = cursor->pos, len = cursor->len, end, stop;
+
+    // Skip leading separators
+    stop = len - pos > SCANNER_NEXT_PREFIX ? pos + SCANNER_NEXT_PREFIX : len;
+    while (pos < stop && scanner_is_sep(seps, data[pos])) {
+        pos++;
+    }
+    if (pos == stop && pos < len) {
+        if (seps->nchars) {
+            return scanner_next_long(seps, cursor, token, pos, pos);
+        }
+        while (pos < len && scanner_is_sep(seps, data[pos])) {
+            pos++;
+        }
+    }
+    if (pos >= len) {
+        cursor->pos = len;
+        return 0;
+    }
+
+    // The token runs up to the next separator or the end of the document
+    end = pos + 1;
+    stop = len - end > SCANNER_NEXT_PREFIX ? end + SCANNER_NEXT_PREFIX : len;
+    while (end < stop && !scanner_is_sep(seps, data[end])) {
+        end++;
+    }
+    if (end == stop && end < len) {
+        if (seps->nchars) {
+            return scanner_next_long(seps, cursor, token, pos, end);
+        }
+        while (end < len && !scanner_is_sep(seps, data[end])) {
+            end++;
+        }
+    }
+    if (end == len && cursor->open) {
+        cursor->pos = pos;  // It may go on in the next append
+        return 0;
+    }
+    token->start = pos;
+    token->len = end - pos;
+    cursor->pos = end;
+    return 1;
+}
+#else
+// Word-at-a-time spans only overtake the table loop on runs several words
+// long, and even bounding the table loop to hand those over costs the usual
+// short token more than it saves, so without SSE2 the table loop is all
+int scanner_next(const ScannerSeps *seps, ScannerCursor *cursor, ScannerToken *token) {
+    return next_table(seps, cursor, token);
+}
+#endif
+
+int scanner_next_scalar(const ScannerSeps *seps, ScannerCursor *cursor, ScannerToken *token) {
+    return next_table(seps, cursor, token);
+}
+
+void scanner_encoder_init(ScannerEncoder *enc, const char *data, size_t len) {
+    scanner_cursor_init(&enc->cursor, data, len);
+    enc->rest.start = 0;
+    enc->rest.len = 0;
+    enc->rest_type = 0;
+    enc->split = 0;
+    enc->filter = NULL;
+    enc->filter_arg = NULL;
+    enc->lexer = NULL;
+    enc->lexer_arg = NULL;
+    __builtin_memset(&enc->lex, 0, sizeof(enc->lex));
+}
+
+int scanner_encoder_next(ScannerEncoder *enc, const ScannerSeps *seps, ScannerToken *token, uint32_t *type) {
+    for (;;) {
+        if (enc->lexer) {
+            if (!enc->lexer(enc->lexer_arg, &enc->lex, &enc->cursor, token, type)) {
+                return 0;
+            }
+        } else if (scanner_next(seps, &enc->cursor, token)) {
+            *type = 0;
+        } else {
+            return 0;
+        }
+        if (!enc->filter) {
+            return 1;
+        }
+        *type = enc->filter(enc->filter_arg, enc->cursor.data, token);
+        if (*type) {
+            return 1;
+        }
+    }
+}
+
+static const uint32_t *scanner_dfa_accept(const ScannerDfa *dfa) {
+    return (const uint32_t *)(dfa + 1);
+}
+
+static const uint16_t *scanner_dfa_table(const ScannerDfa *dfa) {
+    return (const uint16_t *)(scanner_dfa_accept(dfa) + dfa->nstates);
+}
+
+size_t scanner_dfa_size(uint32_t nstates, uint32_t nclasses) {
+    return sizeof(ScannerDfa) + (size_t)nstates * sizeof(uint32_t) + (size_t)nstates * nclasses * sizeof(uint16_t);
+}
+
+int scanner_dfa_check(const ScannerDfa *dfa, size_t size) {
+    const uint32_t *accept;
+    const uint16_t *next;
+    size_t i;
+
+    if (size < sizeof(*dfa) || dfa->nstates <= SCANNER_DFA_START || dfa->nstates > SCANNER_DFA_MAX_STATES ||
+        dfa->nclasses == 0 || dfa->nclasses > 256 || size != scanner_dfa_size(dfa->nstates, dfa->nclasses)) {
+        return 0;
+    }
+    accept = scanner_dfa_accept(dfa);
+    next = scanner_dfa_table(dfa);
+    for (i = 0; i < 256; i++) {
+        if (dfa->classes[i] >= dfa->nclasses) {
+            return 0;
+        }
+    }
+    for (i = 0; i < (size_t)dfa->nstates * dfa->nclasses; i++) {
+        if (next[i] >= dfa->nstates) {
+            return 0;
+        }
+    }
+    // A dead state that can be left, or an empty match, would never make progress
+    for (i = 0; i < dfa->nclasses; i++) {
+        if (next[SCANNER_DFA_DEAD * dfa->nclasses + i] != SCANNER_DFA_DEAD) {
+            return 0;
+        }
+    }
+    return accept[SCANNER_DFA_DEAD] == SCANNER_DFA_REJECT && accept[SCANNER_DFA_START] == SCANNER_DFA_REJECT;
+}
+
+// Maximal munch: run the table from each position until the dead state,
+// remembering the last accepting state passed
+int scanner_dfa_next(void *arg, ScannerLexState *state, ScannerCursor *cursor, ScannerToken *token, uint32_t *type) {
+    const ScannerDfa *dfa = arg;
+    const uint32_t *accept = scanner_dfa_accept(dfa);
+    const uint16_t *next = scanner_dfa_table(dfa);
+    const unsigned char *data = (const unsigned char *)cursor->data;
+    size_t nclasses = dfa->nclasses;
+
+    (void)state;
+
+    while (cursor->pos < cursor->len) {
+        size_t start = cursor->pos, end = start + 1, i;
+        uint32_t s = SCANNER_DFA_START;
+        uint32_t found = SCANNER_DFA_REJECT;
+
+        for (i = start; i < cursor->len; i++) {
+            s = next[s * nclasses + dfa->classes[data[i]]];
+            if (s == SCANNER_DFA_DEAD) {
+                break;
+            }
+            if (accept[s] != SCANNER_DFA_REJECT) {
+                found = accept[s];
+                end = i + 1;
+            }
+        }
+        if (s != SCANNER_DFA_DEAD && cursor->open) {
+            return 0;   // The match could go on into data not written yet
+        }
+        cursor->pos = end;  // Past the match, or the one byte nothing matches
+        if (found != SCANNER_DFA_REJECT && found != 0) {
+            token->start = start;
+            token->len = end - start;
+            *type = found;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// The JSON lexer works per token, each span searching a vector at a time for
+// the bytes that end it. With SSE2, where classifying a vector takes a handful
+// of instructions, it also takes the classes of 64 bytes at a time into
+// bitmaps kept with the cursor, and finds most tokens with a couple of bit
+// counts. The bitmaps are of bytes alone, with no string or escape state
+// carried along the way simdjson does, so the lexer state stays as it was,
+// any position can resume from them, and they hold as long as the data.
+// Without SSE2, word-at-a-time classes cost more than the whole scalar
+// tokenizer, so the spans are all.
+
+// Only the four bytes RFC 8259 allows, so \v and \f stay inside literals
+static int json_is_ws(unsigned char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static int json_is_value_stop(unsigned char c) {
+    switch (c) {
+        case ',': case ':': case '[': case ']': case '{': case '}': case '"':
+            return 1;
+        default:
+            return json_is_ws(c);
+    }
+}
+
+// Up to the first of a few stop bytes
+static size_t span_stops(const unsigned char *stops, unsigned int nstops, const char *p, size_t n) {
+    size_t i = 0;
+    unsigned int j;
+
+#ifdef SCANNER_VECTOR
+    for (; i + BLOCK <= n; i += BLOCK) {
+        BlockMask stop = chars_mask(stops, nstops, p + i);
+        if (stop) {
+            return i + MASK_FIRST(stop);
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        for (j = 0; j < nstops; j++) {
+            if ((unsigned char)p[i] == stops[j]) {
+                return i;
+            }
+        }
+    }
+    return n;
+}
+
+static int json_is_string_stop(unsigned char c) {
+    return c == '"' || c == '\\';
+}
+
+// Instantiate a span up to the first byte found, as a block test on one of
+// json_masks' results, so that only the compares for it are left
+#ifdef SCANNER_VECTOR
+#define JSON_DEFINE_SPAN(fn, MASK, found)                                         \
+    static size_t fn(const char *p, size_t n) {                                   \
+        size_t i = 0;                                                             \
+                                                                                  \
+        for (; i + BLOCK <= n; i += BLOCK) {                                      \
+            BlockMask ws, stop, escape, hits;                                     \
+            json_masks(p + i, &ws, &stop, &escape);                               \
+            hits = MASK;                                                          \
+            if (hits) {                                                           \
+                return i + MASK_FIRST(hits);                                      \
+            }                                                                     \
+        }                                                                         \
+        while (i < n && !(found)((unsigned char)p[i])) {                          \
+            i++;                                                                  \
+        }                                                                         \
+        return i;                                                                 \
+    }
+#else
+#define JSON_DEFINE_SPAN(fn, MASK, found)                                         \
+    static size_t fn(const char *p, size_t n) {                                   \
+        size_t i = 0;                                                             \
+                                                                                  \
+        while (i < n && !(found)((unsigned char)p[i])) {                          \
+            i++;                                                                  \
+        }                                                                         \
+        return i;                                                                 \
+    }
+#endif
+
+static int json_is_token(unsigned char c) {
+    return !json_is_ws(c);
+}
+
+JSON_DEFINE_SPAN(json_span_ws, ~ws & MASK_ALL, json_is_token)
+JSON_DEFINE_SPAN(json_span_value, stop, json_is_value_stop)
+JSON_DEFINE_SPAN(json_span_string, escape, json_is_string_stop)
+
+// What json_find looks for: a byte that is not whitespace, one that ends a
+// bare value, or one that ends a run inside a string
+enum { JSON_FIND_TOKEN, JSON_FIND_VALUE_END, JSON_FIND_STRING_STOP };
+
+static inline size_t json_span(int what, const char *p, size_t n) {
+    switch (what) {
+        case JSON_FIND_TOKEN:
+            return json_span_ws(p, n);
+        case JSON_FIND_VALUE_END:
+            return json_span_value(p, n);
+        default:
+            return json_span_string(p, n);
+    }
+}
+
+#ifdef SCANNER_SSE2
+
+// Take the classes of the SCANNER_BLOCK_BYTES bytes of data at p, offset base
+static void json_take_block(ScannerBlock *block, const char *p, size_t base) {
+    uint64_t ws = 0, stop = 0, escape = 0;
+    unsigned int i;
+
+    for (i = 0; i < SCANNER_BLOCK_BYTES; i += BLOCK) {
+        BlockMask w, s, e;
+
+        json_masks(p + i, &w, &s, &e);
+        ws |= (uint64_t)w << i;
+        stop |= (uint64_t)s << i;
+        escape |= (uint64_t)e << i;
+    }
+    block->base = base;
+    block->len = SCANNER_BLOCK_BYTES;
+    block->ws = ws;
+    block->stop = stop;
+    block->escape = escape;
+}
+
+// The block's bits for what json_find looks for
+static inline uint64_t json_block_bits(const ScannerBlock *block, int what) {
+    switch (what) {
+        case JSON_FIND_TOKEN:
+            return ~block->ws;
+        case JSON_FIND_VALUE_END:
+            return block->stop;
+        default:
+            return block->escape;
+    }
+}
+
+// Offset of the first byte from pos on that json_find looks for: in the cursor's
+// block while it covers pos, then in blocks taken one after another while a
+// block's worth of data is left, then by json_span
+static inline size_t json_find(ScannerCursor *cursor, int what, size_t pos) {
+    ScannerBlock *block = &cursor->block;
+    size_t len = cursor->len;
+    uint64_t bits;
+
+    if (what == JSON_FIND_TOKEN && pos < len && !json_is_ws(cursor->data[pos])) {
+        return pos;     // Mostly the next token follows straight on
+    }
+    if (pos - block->base < block->len && block->base + block->len <= len) {
+        bits = json_block_bits(block, what) >> (pos - block->base);
+        if (bits) {
+            return pos + __builtin_ctzll(bits);
+        }
+        pos = block->base + block->len;
+    }
+    while (len - pos >= SCANNER_BLOCK_BYTES) {
+        json_take_block(block, cursor->data + pos, pos);
+        bits = json_block_bits(block, what);
+        if (bits) {
+            return pos + __builtin_ctzll(bits);
+        }
+        pos += SCANNER_BLOCK_BYTES;
+    }
+    return pos + json_span(what, cursor->data + pos, len - pos);
+}
+
+#else
+
+static inline size_t json_find(ScannerCursor *cursor, int what, size_t pos) {
+    const char *p = cursor->data + pos;
+    size_t n = cursor->len - pos, i = 0;
+
+    // Whitespace is mostly a newline and a little indentation
+    if (what == JSON_FIND_TOKEN) {
+        while (i < n && i < SCANNER_SCALAR_PREFIX && json_is_ws(p[i])) {
+            i++;
+        }
+        if (i < SCANNER_SCALAR_PREFIX) {
+            return pos + i;
+        }
+    }
+    return pos + i + json_span(what, p + i, n - i);
+}
+
+#endif
+
+static int json_in_object(const ScannerJson *json) {
+    uint32_t level = json->depth - 1;
+    return json->depth > 0 && level < SCANNER_JSON_MAX_DEPTH && ((json->objects[level / 64] >> (level % 64)) & 1);
+}
+
+// Type of an opening or closing bracket, entering or leaving its level
+static inline uint32_t json_bracket(ScannerJson *json, unsigned char c) {
+    uint32_t kind, type;
+
+    if (c == '{' || c == '[') {
+        kind = c == '{' ? SCANNER_JSON_OBJECT : SCANNER_JSON_ARRAY;
+        type = SCANNER_JSON_TYPE(kind, json->depth);
+        if (json->depth < SCANNER_JSON_MAX_DEPTH) {
+            uint64_t bit = (uint64_t)1 << (json->depth % 64);
+            json->objects[json->depth / 64] = kind == SCANNER_JSON_OBJECT ? json->objects[json->depth / 64] | bit
+                                                                            : json->objects[json->depth / 64] & ~bit;
+        }
+        json->depth++;
+        json->key = kind == SCANNER_JSON_OBJECT;
+        return type;
+    }
+    // Closing more than was opened stays at depth 0
+    json->depth -= json->depth > 0;
+    json->key = 0;
+    return SCANNER_JSON_TYPE(c == '}' ? SCANNER_JSON_OBJECT_END : SCANNER_JSON_ARRAY_END, json->depth);
+}
+
+static inline uint32_t json_value_type(const ScannerJson *json, unsigned char c) {
+    return SCANNER_JSON_TYPE(c == '-' || (c >= '0' && c <= '9') ? SCANNER_JSON_NUMBER : SCANNER_JSON_LITERAL,
+                             json->depth);
+}
+
+// The lexer in full, behind scanner_json_next
+static inline int json_next(ScannerJson *json, ScannerCursor *cursor, ScannerToken *token, uint32_t *type) {
+    const char *data = cursor->data;
+    size_t pos = cursor->pos, end;
+
+    for (;;) {
+        pos = json_find(cursor, JSON_FIND_TOKEN, pos);
+        if (pos >= cursor->len) {
+            cursor->pos = cursor->len;
+            return 0;
+        }
+        if (data[pos] == ',') {
+            json->key = json_in_object(json);
+            pos++;
+        } else if (data[pos] == ':') {
+            json->key = 0;
+            pos++;
+        } else {
+            break;
+        }
+    }
+
+    end = pos + 1;
+    switch (data[pos]) {
+        case '{':
+        case '[':
+        case '}':
+        case ']':
+            *type = json_bracket(json, data[pos]);
+            break;
+        case '"':
+            // Past escaped bytes to the closing quote
+            for (;;) {
+                end = json_find(cursor, JSON_FIND_STRING_STOP, end);
+                if (end >= cursor->len || data[end] == '"') {
+                    break;
+                }
+                end = end + 2 < cursor->len ? end + 2 : cursor->len;
+            }
+            if (end >= cursor->len) {
+                if (cursor->open) {
+                    cursor->pos = pos;  // It may close in the next append
+                    return 0;
+                }
+                end = cursor->len;      // Unterminated: the rest of the input
+            } else {
+                end++;
+            }
+            *type = SCANNER_JSON_TYPE(json->key ? SCANNER_JSON_KEY : SCANNER_JSON_STRING, json->depth);
+            json->key = 0;
+            break;
+        default:
+            end = json_find(cursor, JSON_FIND_VALUE_END, pos);
+            if (end == cursor->len && cursor->open) {
+                cursor->pos = pos;
+                return 0;
+            }
+            *type = json_value_type(json, data[pos]);
+            json->key = 0;
+            break;
+    }
+    token->start = pos;
+    token->len = end - pos;
+    cursor->pos = end;
+    return 1;
+}
+
+#ifdef SCANNER_SSE2
+
+// json_next out of line, so that scanner_json_next stays a leaf that only
+// tail-calls it
+static __attribute__((noinline)) int json_next_on(ScannerJson *json, ScannerCursor *cursor, ScannerToken *token,
+                                                  uint32_t *type) {
+    return json_next(json, cursor, token, type);
+}
+
+// Most tokens lie inside the cursor's block, with no more than a comma or
+// colon and whitespace before them, and take a bit count or two. Anything else
+// goes to json_next_on, which starts over from cursor->pos.
+int scanner_json_next(void *arg, ScannerLexState *state, ScannerCursor *cursor, ScannerToken *token, uint32_t *type) {
+    ScannerJson *json = &state->json;
+    const ScannerBlock *block = &cursor->block;
+    const char *data = cursor->data;
+    size_t pos = cursor->pos, skip = pos - block->base, end;
+    uint32_t key = json->key;
+    uint64_t bits;
+    unsigned char c;
+
+    (void)arg;
+    if (skip >= block->len || block->base + block->len > cursor->len) {
+        return json_next_on(json, cursor, token, type);
+    }
+    c = data[pos];
+    if (c == ',' || c == ':') {
+        key = c == ',' && json_in_object(json);
+        if (++skip == SCANNER_BLOCK_BYTES) {
+            return json_next_on(json, cursor, token, type);
+        }
+        c = data[++pos];
+    }
+    if (json_is_ws(c)) {
+        bits = ~block->ws >> skip;
+        if (!bits) {
+            return json_next_on(json, cursor, token, type);
+        }
+        skip += __builtin_ctzll(bits);
+        pos = block->base + skip;
+        c = data[pos];
+    }
+
+    switch (c) {
+        case ',':
+        case ':':
+            return json_next_on(json, cursor, token, type);
+        case '{':
+        case '[':
+        case '}':
+        case ']':
+            *type = json_bracket(json, c);
+            end = pos + 1;
+            break;
+        case '"':
+            // Past escaped bytes to the closing quote
+            end = pos + 1;
+            for (;;) {
+                skip = end - block->base;
+                bits = skip < SCANNER_BLOCK_BYTES ? block->escape >> skip : 0;
+                if (!bits) {
+                    return json_next_on(json, cursor, token, type);
+                }
+                end += __builtin_ctzll(bits);
+                if (data[end] == '"') {
+                    break;
+                }
+                end += 2;
+            }
+            end++;
+            *type = SCANNER_JSON_TYPE(key ? SCANNER_JSON_KEY : SCANNER_JSON_STRING, json->depth);
+            json->key = 0;
+            break;
+        default:
+            bits = block->stop >> skip;
+            if (!bits) {
+                return json_next_on(json, cursor, token, type);
+            }
+            end = pos + __builtin_ctzll(bits);
+            *type = json_value_type(json, c);
+            json->key = 0;
+            break;
+    }
+    token->start = pos;
+    token->len = end - pos;
+    cursor->pos = end;
+    return 1;
+}
+
+#else
+
+int scanner_json_next(void *arg, ScannerLexState *state, ScannerCursor *cursor, ScannerToken *token, uint32_t *type) {
+    (void)arg;
+    return json_next(&state->json, cursor, token, type);
+}
+
+#endif
+
+static uint32_t *kv_slots(const ScannerKv *kv) {
+    return (uint32_t *)(kv + 1);
+}
+
+static uint32_t *kv_offsets(const ScannerKv *kv) {
+    return kv_slots(kv) + kv->mask + 1;
+}
+
+static const char *kv_names(const ScannerKv *kv) {
+    return (const char *)(kv_offsets(kv) + kv->nkeys + 1);
+}
+
+// At most half full, so probes stay short
+static uint32_t kv_nslots(uint32_t nkeys) {
+    uint32_t n = 1;
+
+    while (n < 2 * nkeys) {
+        n <<= 1;
+    }
+    return n;
+}
+
+// FNV-1a
+static uint32_t kv_hash(const char *p, size_t n) {
+    uint32_t h = 2166136261u;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        h = (h ^ (unsigned char)p[i]) * 16777619u;
+    }
+    return h;
+}
+
+// ID of the n-byte key at p, or 0
+static uint32_t kv_lookup(const ScannerKv *kv, const char *p, size_t n) {
+    const uint32_t *slots = kv_slots(kv), *offsets = kv_offsets(kv);
+    uint32_t i, id;
+
+    for (i = kv_hash(p, n) & kv->mask; (id = slots[i]) != 0; i = (i + 1) & kv->mask) {
+        if (offsets[id] - offsets[id - 1] - 1 == n && !__builtin_memcmp(kv_names(kv) + offsets[id - 1], p, n)) {
+            return id;
+        }
+    }
+    return 0;
+}
+
+static size_t kv_strlen(const char *s) {
+    size_t n = 0;
+
+    while (s[n]) {
+        n++;
+    }
+    return n;
+}
+
+size_t scanner_kv_size(uint32_t nkeys, size_t names_len) {
+    return sizeof(ScannerKv) + ((size_t)kv_nslots(nkeys) + nkeys + 1) * sizeof(uint32_t) + names_len;
+}
+
+int scanner_kv_init(ScannerKv *kv, const char *pairs, const char *assign, unsigned char quote,
+                    const char *names, uint32_t nkeys, size_t names_len) {
+    char stops[2 * SCANNER_KV_MAX_DELIMS + 1];
+    size_t npairs = kv_strlen(pairs), nassign = kv_strlen(assign), i, at;
+    uint32_t *slots, *offsets, id;
+
+    if (npairs > SCANNER_KV_MAX_DELIMS || nassign == 0 || nassign > SCANNER_KV_MAX_DELIMS ||
+        nkeys > SCANNER_KV_MAX_KEYS) {
+        return 0;
+    }
+    scanner_seps_init(&kv->pairs, pairs, npairs);
+    scanner_seps_init(&kv->assign, assign, nassign);
+    for (i = 0; i < nassign; i++) {
+        if (scanner_is_sep(&kv->pairs, assign[i])) {
+            return 0;
+        }
+    }
+    if (scanner_is_sep(&kv->pairs, '\n') || scanner_is_sep(&kv->assign, '\n') ||
+        (quote && (quote == '\n' || scanner_is_sep(&kv->pairs, quote) || scanner_is_sep(&kv->assign, quote)))) {
+        return 0;
+    }
+    __builtin_memcpy(stops, pairs, npairs);
+    stops[npairs] = '\n';
+    scanner_seps_init(&kv->value_stops, stops, npairs + 1);
+    __builtin_memcpy(stops + npairs + 1, assign, nassign);
+    scanner_seps_init(&kv->key_stops, stops, npairs + 1 + nassign);
+    kv->quote = quote;
+    kv->quote_stops[0] = quote;
+    kv->quote_stops[1] = '\\';
+    kv->quote_stops[2] = '\n';
+
+    // Names go in as given, then each is hashed into a free slot
+    kv->nkeys = nkeys;
+    kv->mask = kv_nslots(nkeys) - 1;
+    slots = kv_slots(kv);
+    offsets = kv_offsets(kv);
+    for (i = 0; i <= kv->mask; i++) {
+        slots[i] = 0;
+    }
+    __builtin_memcpy((char *)kv_names(kv), names, names_len);
+    offsets[0] = 0;
+    for (id = 1, at = 0; id <= nkeys; id++) {
+        size_t n = 0;
+
+        while (at + n < names_len && names[at + n]) {
+            n++;
+        }
+        if (n == 0 || at + n >= names_len || kv_lookup(kv, names + at, n)) {
+            return 0;
+        }
+        at += n + 1;
+        offsets[id] = at;
+        i = kv_hash(names + at - n - 1, n) & kv->mask;
+        while (slots[i]) {
+            i = (i + 1) & kv->mask;
+        }
+        slots[i] = id;
+    }
+    return at == names_len;
+}
+
+int scanner_kv_next(void *arg, ScannerLexState *state, ScannerCursor *cursor, ScannerToken *token, uint32_t *type) {
+    const ScannerKv *kv = arg;
+    ScannerKvState *kvs = &state->kv;
+    const char *data = cursor->data;
+    size_t pos = cursor->pos, end;
+
+    if (kvs->value) {
+        if (pos < cursor->len && kv->quote && (unsigned char)data[pos] == kv->quote) {
+            // Past escaped bytes to the closing quote, or to the end of the line
+            end = pos + 1;
+            for (;;) {
+                end += span_stops(kv->quote_stops, 3, data + end, cursor->len - end);
+                if (end >= cursor->len || data[end] != '\\') {
+                    break;
+                }
+                end = end + 2 < cursor->len ? end + 2 : cursor->len;
+            }
+            if (end >= cursor->len && cursor->open) {
+                return 0;   // It may close in the next append
+            }
+            token->start = pos + 1;
+            token->len = end - pos - 1;
+            pos = end < cursor->len && data[end] == kv->quote ? end + 1 : end;
+        } else {
+            end = pos + scanner_span_token(&kv->value_stops, data + pos, cursor->len - pos);
+            if (end >= cursor->len && cursor->open) {
+                return 0;
+            }
+            token->start = pos;
+            token->len = end - pos;
+            pos = end;
+        }
+        kvs->value = 0;
+        cursor->pos = pos;
+        if (token->len) {
+            *type = kvs->lines + 1;
+            return 1;
+        }
+    }
+
+    // Over pair delimiters, stray assignments and line ends to the next key
+    for (;;) {
+        pos += scanner_span_seps(&kv->pairs, data + pos, cursor->len - pos);
+        if (pos >= cursor->len) {
+            cursor->pos = cursor->len;
+            return 0;
+        }
+        if (data[pos] == '\n') {
+            kvs->lines = kvs->lines + 1 < SCANNER_KV_MAX_LINE ? kvs->lines + 1 : 0;
+        } else if (!scanner_is_sep(&kv->assign, data[pos])) {
+            break;
+        }
+        pos++;
+    }
+
+    end = pos + scanner_span_token(&kv->key_stops, data + pos, cursor->len - pos);
+    if (end >= cursor->len && cursor->open) {
+        cursor->pos = pos;
+        return 0;
+    }
+    token->start = pos;
+    token->len = end - pos;
+    *type = SCANNER_KV_KEY | kv_lookup(kv, data + pos, end - pos);
+    if (end < cursor->len && scanner_is_sep(&kv->assign, data[end])) {
+        kvs->value = 1;
+        end++;
+    }
+    cursor->pos = end;
+    return 1;
+}
+
+// Gear values from a fixed splitmix64 sequence
+static uint64_t cdc_splitmix(uint64_t *x) {
+    uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+// The top bits bits of the hash
+static uint64_t cdc_mask(unsigned int bits) {
+    return ~(uint64_t)0 << (64 - bits);
+}
+
+int scanner_cdc_init(ScannerCdc *cdc, uint32_t min, uint32_t avg, uint32_t max) {
+    uint64_t seed = 0;
+    unsigned int bits = 0, i;
+
+    if (min == 0 || min > avg || avg > max || max > SCANNER_CDC_MAX_SIZE || avg < SCANNER_CDC_MIN_AVG ||
+        avg > SCANNER_CDC_MAX_AVG || (avg & (avg - 1))) {
+        return 0;
+    }
+    while ((1u << bits) < avg) {
+        bits++;
+    }
+    cdc->min = min;
+    cdc->avg = avg;
+    cdc->max = max;
+    // Normalization level 2: four times harder to cut before avg, easier after
+    cdc->mask_small = cdc_mask(bits + 2);
+    cdc->mask_large = cdc_mask(bits - 2);
+    for (i = 0; i < 256; i++) {
+        cdc->gear[i] = cdc_splitmix(&seed);
+    }
+    return 1;
+}
+
+int scanner_cdc_next(void *arg, ScannerLexState *state, ScannerCursor *cursor, ScannerToken *token, uint32_t *type) {
+    const ScannerCdc *cdc = arg;
+    ScannerCdcState *cs = &state->cdc;
+    const unsigned char *p = (const unsigned char *)cursor->data + cursor->pos;
+    size_t n = cursor->len - cursor->pos;
+    size_t end = n < cdc->max ? n : cdc->max;
+    size_t normal = end < cdc->avg ? end : cdc->avg;
+    size_t i = cs->len > cdc->min ? cs->len : cdc->min;
+    uint64_t hash = cs->hash;
+
+    if (n == 0) {
+        return 0;
+    }
+    // Bytes before min never decide a cut, so they are skipped unhashed
+    for (; i < normal; i++) {
+        hash = (hash << 1) + cdc->gear[p[i]];
+        if (!(hash & cdc->mask_small)) {
+            *type = SCANNER_CDC_CUT;
+            goto cut;
+        }
+    }
+    for (; i < end; i++) {
+        hash = (hash << 1) + cdc->gear[p[i]];
+        if (!(hash & cdc->mask_large)) {
+            *type = SCANNER_CDC_CUT;
+            goto cut;
+        }
+    }
+    if (end < cdc->max && cursor->open) {
+        if (end > cdc->min) {
+            cs->hash = hash;    // Go on from here after the next append
+            cs->len = (uint32_t)end;
+        }
+        return 0;
+    }
+    *type = SCANNER_CDC_FORCED;
+    i = end - 1;
+
+cut:
+    token->start = cursor->pos;
+    token->len = i + 1;
+    cursor->pos += i + 1;
+    cs->hash = 0;
+    cs->len = 0;
+    return 1;
+}
+
+int scanner_fixed_init(ScannerFixed *fixed, const uint32_t *widths, uint32_t ncolumns,
+                       const char *pad, size_t npad, uint32_t flags) {
+    uint64_t record = 0;
+    uint32_t i;
+
+    if (ncolumns == 0 || ncolumns > SCANNER_FIXED_MAX_COLUMNS ||
+        (flags & ~(uint32_t)(SCANNER_FIXED_TRIM_LEFT | SCANNER_FIXED_TRIM_RIGHT))) {
+        return 0;
+    }
+    for (i = 0; i < ncolumns; i++) {
+        if (widths[i] == 0) {
+            return 0;
+        }
+        record += widths[i];
+        fixed->widths[i] = widths[i];
+    }
+    if (record > SCANNER_FIXED_MAX_RECORD) {
+        return 0;
+    }
+    scanner_seps_init(&fixed->pad, pad, npad);
+    fixed->flags = flags;
+    fixed->ncolumns = ncolumns;
+    return 1;
+}
+
+// Field boundaries come from the widths; only padding is ever looked at
+int scanner_fixed_next(void *arg, ScannerLexState *state, ScannerCursor *cursor, ScannerToken *token, uint32_t *type) {
+    const ScannerFixed *fixed = arg;
+    ScannerFixedState *fs = &state->fixed;
+    const unsigned char *data = (const unsigned char *)cursor->data;
+    size_t pos = cursor->pos;
+
+    while (pos < cursor->len) {
+        uint32_t column = fs->column;
+        size_t end = pos + fixed->widths[column];
+        size_t start = pos;
+
+        if (end > cursor->len) {
+            if (cursor->open) {
+                break;  // The rest of the field may come in the next append
+            }
+            end = cursor->len;
+        }
+        pos = end;
+        fs->column = column + 1 < fixed->ncolumns ? column + 1 : 0;
+        if (fixed->flags & SCANNER_FIXED_TRIM_LEFT) {
+            while (start < end && scanner_is_sep(&fixed->pad, data[start])) {
+                start++;
+            }
+        }
+        if (fixed->flags & SCANNER_FIXED_TRIM_RIGHT) {
+            while (end > start && scanner_is_sep(&fixed->pad, data[end - 1])) {
+                end--;
+            }
+        }
+        if (end > start) {
+            token->start = start;
+            token->len = end - start;
+            *type = column + 1;
+            cursor->pos = pos;
+            return 1;
+        }
+    }
+    cursor->pos = pos;
+    return 0;
+}
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static uint32_t sha256_ror(uint32_t x, unsigned int n) {
+    return x >> n | x << (32 - n);
+}
+
+static void sha256_block(uint32_t h[8], const unsigned char *p) {
+    uint32_t w[64], a, b, c, d, e, f, g, k, t1, t2;
+    unsigned int i;
+
+    for (i = 0; i < 16; i++) {
+        w[i] = (uint32_t)p[4 * i] << 24 | (uint32_t)p[4 * i + 1] << 16 | (uint32_t)p[4 * i + 2] << 8 | p[4 * i + 3];
+    }
+    for (; i < 64; i++) {
+        uint32_t s0 = sha256_ror(w[i - 15], 7) ^ sha256_ror(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = sha256_ror(w[i - 2], 17) ^ sha256_ror(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    a = h[0]; b = h[1]; c = h[2]; d = h[3];
+    e = h[4]; f = h[5]; g = h[6]; k = h[7];
+    for (i = 0; i < 64; i++) {
+        t1 = k + (sha256_ror(e, 6) ^ sha256_ror(e, 11) ^ sha256_ror(e, 25)) + ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+        t2 = (sha256_ror(a, 2) ^ sha256_ror(a, 13) ^ sha256_ror(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        k = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+    h[0] += a; h[1] += b; h[2] += c; h[3] += d;
+    h[4] += e; h[5] += f; h[6] += g; h[7] += k;
+}
+
+void scanner_sha256(const void *data, size_t len, uint8_t out[32]) {
+    uint32_t h[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+    const unsigned char *p = data;
+    unsigned char tail[128];
+    uint64_t bits = (uint64_t)len * 8;
+    size_t full = len & ~(size_t)63, rest = len - full, pad, i;
+
+    for (i = 0; i < full; i += 64) {
+        sha256_block(h, p + i);
+    }
+    // The last bytes, a 1 bit, zeros and the length in bits fill one or two blocks
+    pad = rest < 56 ? 64 : 128;
+    __builtin_memset(tail, 0, pad);
+    __builtin_memcpy(tail, p + full, rest);
+    tail[rest] = 0x80;
+    for (i = 0; i < 8; i++) {
+        tail[pad - 1 - i] = (unsigned char)(bits >> (8 * i));
+    }
+    sha256_block(h, tail);
+    if (pad == 128) {
+        sha256_block(h, tail + 64);
+    }
+    for (i = 0; i < 8; i++) {
+        out[4 * i] = (uint8_t)(h[i] >> 24);
+        out[4 * i + 1] = (uint8_t)(h[i] >> 16);
+        out[4 * i + 2] = (uint8_t)(h[i] >> 8);
+        out[4 * i + 3] = (uint8_t)h[i];
+    }
+}
+
+size_t scanner_encoder_keep(const ScannerEncoder *enc) {
+    return enc->split ? enc->rest.start : enc->cursor.pos;
+}
+
+void scanner_encoder_rebase(ScannerEncoder *enc, const char *data, size_t len) {
+    size_t keep = scanner_encoder_keep(enc);
+
+    enc->cursor.data = data;
+    enc->cursor.len = len;
+    enc->cursor.pos -= keep;
+    enc->cursor.block.len = 0;
+    if (enc->split) {
+        enc->rest.start -= keep;
+    }
+}
+
+size_t scanner_min_read(int mode) {
+    switch (mode) {
+        case SCANNER_MODE_FRAMED: return sizeof(uint32_t) + 1;
+        case SCANNER_MODE_TYPED:  return 2 * sizeof(uint32_t) + 1;
+        case SCANNER_MODE_INDEX:  return sizeof(ScannerSpan);
+        case SCANNER_MODE_DIGEST: return sizeof(ScannerDigest);
+        default:                  return 1;
+    }
+}
+
+size_t scanner_plan(ScannerEncoder *enc, const ScannerSeps *seps, int mode, size_t cap,
+                    ScannerPiece *pieces, size_t max, size_t *npieces, size_t *ntokens) {
+    size_t head = mode == SCANNER_MODE_TYPED ? 2 * sizeof(uint32_t) :
+                  mode == SCANNER_MODE_FRAMED ? sizeof(uint32_t) : 0;
+    size_t used = 0;
+
+    *npieces = 0;
+    while (*npieces < max) {
+        ScannerPiece *piece = &pieces[*npieces];
+        ScannerToken token;
+        uint32_t type;
+        size_t room = cap - used;
+        size_t fit;
+
+        if (enc->split) {
+            token = enc->rest;
+            type = enc->rest_type;
+        } else if (!scanner_encoder_next(enc, seps, &token, &type)) {
+            break;
+        }
+
+        // A frame needs its words and a byte; a bulk piece needs one byte
+        if (room < head + 1) {
+            enc->rest = token;  // Keep it for the next read
+            enc->rest_type = type;
+            enc->split = 1;
+            break;
+        }
+        fit = room - head < token.len ? room - head : token.len;
+        piece->start = (uint32_t)token.start;
+        piece->len = (uint32_t)fit;
+        piece->word = (uint32_t)fit | (fit < token.len ? SCANNER_FRAME_MORE : 0);
+        piece->nul = !head && fit == token.len && head + fit < room;
+        piece->type = type;
+        used += head + fit + piece->nul;
+        (*npieces)++;
+
+        if (fit < token.len || (!head && !piece->nul)) {
+            // Out of room: the rest of the token, or just its NUL, goes next time
+            enc->rest.start = token.start + fit;
+            enc->rest.len = token.len - fit;
+            enc->rest_type = type;
+            enc->split = 1;
+            break;
+        }
+        enc->split = 0;
+        (*ntokens)++;
+    }
+    return used;
+}
+
+size_t scanner_place(const ScannerPiece *pieces, size_t npieces, const char *data, int mode, char *out) {
+    size_t used = 0, i;
+
+    for (i = 0; i < npieces; i++) {
+        if (mode == SCANNER_MODE_TYPED) {
+            __builtin_memcpy(out + used, &pieces[i].type, sizeof(pieces[i].type));
+            used += sizeof(pieces[i].type);
+        }
+        if (mode == SCANNER_MODE_FRAMED || mode == SCANNER_MODE_TYPED) {
+            __builtin_memcpy(out + used, &pieces[i].word, sizeof(pieces[i].word));
+            used += sizeof(pieces[i].word);
+        }
+        __builtin_memcpy(out + used, data + pieces[i].start, pieces[i].len);
+        used += pieces[i].len;
+        if (pieces[i].nul) {
+            out[used++] = '\0';
+        }
+    }
+    return used;
+}
+
+size_t scanner_encode(ScannerEncoder *enc, const ScannerSeps *seps, int mode,
+                      char *out, size_t cap, size_t *ntokens) {
+    const char *data = enc->cursor.data;
+    ScannerPiece pieces[SCANNER_PLAN_BATCH];
+    size_t used = 0;
+
+    if (mode != SCANNER_MODE_INDEX && mode != SCANNER_MODE_DIGEST) {
+        for (;;) {
+            size_t npieces;
+
+            scanner_plan(enc, seps, mode, cap - used, pieces, SCANNER_PLAN_BATCH, &npieces, ntokens);
+            used += scanner_place(pieces, npieces, data, mode, out + used);
+            if (npieces < SCANNER_PLAN_BATCH) {
+                return used;
+            }
+        }
+    }
+
+    for (;;) {
+        ScannerToken token;
+        ScannerDigest record;
+        size_t size = scanner_min_read(mode);
+        uint32_t type;
+
+        if (enc->split) {
+            token = enc->rest;
+        } else if (!scanner_encoder_next(enc, seps, &token, &type)) {
+            break;
+        }
+        if (cap - used < size) {
+            enc->rest = token;  // Keep it for the next read
+            enc->split = 1;
+            break;
+        }
+        record.span.offset = (uint32_t)token.start;
+        record.span.len = (uint32_t)token.len;
+        if (mode == SCANNER_MODE_DIGEST) {
+            scanner_sha256(data + token.start, token.len, record.sha256);
+        }
+        __builtin_memcpy(out + used, &record, size);
+        used += size;
+        enc->split = 0;
+        (*ntokens)++;
+    }
+    return used;
+}
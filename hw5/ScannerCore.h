@@ -0,0 +1,406 @@
+//
+// Freestanding tokenizer core shared by the NewScanner module and libscanner.
+//
+// Nothing in here may depend on kernel or libc APIs beyond the fixed-width
+// types and size_t, so the same object can be linked into the module and into
+// user-space tools and benchmarks.
+//
+
+#ifndef HW5_SCANNERCORE_H
+#define HW5_SCANNERCORE_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#else
+#include <stddef.h>
+#include <stdint.h>
+#endif
+
+// Default separators: space, tab, newline, carriage return, form feed, vertical tab
+#define SCANNER_DEFAULT_SEPARATORS " \t\n\r\f\v"
+
+// Sets up to this size also get a vectorized scan; larger ones use the table
+#define SCANNER_SIMD_MAX_SEPS 8
+
+// Separator sets common enough to get scan loops specialized at compile time,
+// as X(name, chars, kind). kind picks the block test: "chars" compares against
+// each separator as a constant, "ws" is a range test for the default set.
+// Any other set, in any order, runs the generic loop over ScannerSeps.chars.
+#define SCANNER_BUILTIN_SETS(X)                         \
+    X(WHITESPACE, SCANNER_DEFAULT_SEPARATORS, ws)       \
+    X(COMMA, ",", chars)                                \
+    X(TAB, "\t", chars)                                 \
+    X(NEWLINE, "\n", chars)
+
+enum {
+    SCANNER_SET_CUSTOM,
+#define X(name, chars, kind) SCANNER_SET_##name,
+    SCANNER_BUILTIN_SETS(X)
+#undef X
+};
+
+// Separator set as a 256-bit membership table, one bit per byte value, plus
+// the distinct separator bytes themselves for the vectorized scan
+typedef struct {
+    uint64_t map[4];
+    unsigned char chars[SCANNER_SIMD_MAX_SEPS];
+    unsigned int nchars;    // Distinct separators, or 0 if there are too many
+    unsigned int builtin;   // SCANNER_SET_* this set matches, or SCANNER_SET_CUSTOM
+} ScannerSeps;
+
+// Byte classes of the SCANNER_BLOCK_BYTES bytes of a cursor's data from base,
+// bit i for byte base + i, as the JSON lexer took them
+#define SCANNER_BLOCK_BYTES 64
+typedef struct {
+    size_t base;
+    size_t len;             // SCANNER_BLOCK_BYTES once taken, 0 before
+    uint64_t ws;            // JSON whitespace
+    uint64_t stop;          // Ends a bare JSON value
+    uint64_t escape;        // Ends a run inside a JSON string
+} ScannerBlock;
+
+// Read position within a document; the core never owns the bytes. While
+// open is set more data may be appended, so a token running into the end of
+// data is held back rather than returned. The bytes up to len never change
+// under a cursor, so what block records of them holds until
+// scanner_cursor_init or scanner_encoder_rebase points it elsewhere.
+typedef struct {
+    const char *data;
+    size_t len;
+    size_t pos;
+    int open;
+    ScannerBlock block;
+} ScannerCursor;
+
+// A token as an offset/length pair relative to the start of the document
+typedef struct {
+    size_t start;
+    size_t len;
+} ScannerToken;
+
+// Read modes, i.e. how scanner_encode lays tokens out in a read buffer
+#define SCANNER_MODE_TOKEN  0   // One token per read(), truncated to the buffer
+#define SCANNER_MODE_BULK   1   // Tokens back to back, each followed by a NUL
+#define SCANNER_MODE_FRAMED 2   // Tokens back to back, each after a 32-bit length
+#define SCANNER_MODE_INDEX  3   // ScannerSpan records locating tokens in the document
+#define SCANNER_MODE_TYPED  4   // Framed, with each frame after the token's 32-bit type
+#define SCANNER_MODE_DIGEST 5   // ScannerDigest records: index records with each token's SHA-256
+#define SCANNER_MODES       6
+
+// Framed and typed modes: set in a length word when the token continues in
+// the next frame
+#define SCANNER_FRAME_MORE 0x80000000u
+
+// Index mode record; documents are limited to 4 GB, well above MAX_RW_COUNT
+typedef struct {
+    uint32_t offset;
+    uint32_t len;
+} ScannerSpan;
+
+// Digest mode record, e.g. for deduplicating content-defined chunks
+typedef struct {
+    ScannerSpan span;
+    uint8_t sha256[32];     // Of the token's bytes
+} ScannerDigest;
+
+// Per-token hook run by the encoder on each token of data it finds: returns
+// 0 to drop the token, or else keeps it with that value as its type
+typedef uint32_t (*ScannerFilter)(void *arg, const char *data, const ScannerToken *token);
+
+// JSON tokens: the raw text of each scalar, string (quotes and escapes
+// included) and bracket, typed SCANNER_JSON_TYPE(kind, depth). Brackets are
+// at the depth of the container they open or close, its members one deeper.
+// Commas, colons and whitespace are skipped, so JSON lines are a sequence of
+// depth 0 values. Bytes that are not JSON make up literals.
+#define SCANNER_JSON_OBJECT     1   // {
+#define SCANNER_JSON_OBJECT_END 2   // }
+#define SCANNER_JSON_ARRAY      3   // [
+#define SCANNER_JSON_ARRAY_END  4   // ]
+#define SCANNER_JSON_KEY        5   // A string naming an object member
+#define SCANNER_JSON_STRING     6   // Any other string
+#define SCANNER_JSON_NUMBER     7
+#define SCANNER_JSON_LITERAL    8   // true, false, null or any other bare word
+#define SCANNER_JSON_TYPE(kind, depth) ((uint32_t)(depth) << 8 | (kind))
+#define SCANNER_JSON_KIND(type) ((type) & 0xff)
+#define SCANNER_JSON_DEPTH(type) ((type) >> 8)
+
+// Deepest nesting whose objects and arrays are told apart; strings deeper
+// than that are all taken as values
+#define SCANNER_JSON_MAX_DEPTH 1024
+
+// JSON structure enclosing the lexer's position
+typedef struct {
+    uint32_t depth;
+    uint32_t key;           // The next string names a member
+    uint64_t objects[SCANNER_JSON_MAX_DEPTH / 64];  // Bit d set when level d is an object
+} ScannerJson;
+
+// Key=value pairs, as in logfmt lines: a key runs up to an assignment
+// delimiter, a pair delimiter or the end of the line, and its value from
+// there up to a pair delimiter or the end of the line, or is quoted. Each
+// pair is a key token typed SCANNER_KV_KEY | its interned ID, then a value
+// token typed with its line number; quoted values are sent without their
+// quotes, escapes left as they are. A key without a value, or with an empty
+// one, is sent alone. '\n' always ends a line, and stray delimiters are
+// skipped.
+#define SCANNER_KV_KEY 0x80000000u
+
+// Line numbers count from 1 and wrap back to 1 after this
+#define SCANNER_KV_MAX_LINE 0x7fffffffu
+
+// Keys interned per ScannerKv; IDs count from 1 in the order given, and 0
+// is any other key
+#define SCANNER_KV_MAX_KEYS 4096
+#define SCANNER_KV_MAX_DELIMS 15
+#define SCANNER_KV_MAX_NAMES (64u << 10)
+
+// Delimiters and interned keys for scanner_kv_next, as scanner_kv_init sets
+// them up: this header, then uint32_t slots[mask + 1] hashing key names to
+// their IDs (0 for an empty slot), uint32_t offsets[nkeys + 1] locating each
+// name, and the names themselves.
+typedef struct {
+    ScannerSeps pairs;          // Skipped before a key
+    ScannerSeps key_stops;      // Pairs, assignments and '\n'
+    ScannerSeps value_stops;    // Pairs and '\n'
+    ScannerSeps assign;
+    unsigned char quote_stops[3];   // The quote, '\\' and '\n'
+    unsigned char quote;        // Opens and closes a value, or 0 for none
+    uint32_t nkeys;
+    uint32_t mask;              // Hash slots - 1
+} ScannerKv;
+
+// Position among pairs
+typedef struct {
+    uint32_t lines;         // Ended so far
+    uint32_t value;         // A key was sent, and the cursor is at its value
+} ScannerKvState;
+
+// Content-defined chunks, as in FastCDC: a rolling gear hash of the bytes
+// since min into each chunk cuts it where its top bits are clear, testing
+// more bits before avg and fewer after so sizes cluster around avg, and at
+// max regardless. Chunks cover the input back to back, typed
+// SCANNER_CDC_CUT, or SCANNER_CDC_FORCED when cut at max or the end of the
+// input. The gear table is fixed, so the same bytes are cut the same way
+// everywhere.
+#define SCANNER_CDC_CUT         1
+#define SCANNER_CDC_FORCED      2
+
+// avg is a power of two in this range, and max at most SCANNER_CDC_MAX_SIZE
+#define SCANNER_CDC_MIN_AVG     64u
+#define SCANNER_CDC_MAX_AVG     (1u << 22)
+#define SCANNER_CDC_MAX_SIZE    (16u << 20)
+
+typedef struct {
+    uint32_t min;
+    uint32_t avg;
+    uint32_t max;
+    uint64_t mask_small;    // Cut test before avg
+    uint64_t mask_large;    // And from avg on
+    uint64_t gear[256];
+} ScannerCdc;
+
+// Progress through a chunk held back at the end of an open cursor
+typedef struct {
+    uint64_t hash;
+    uint32_t len;           // Bytes hashed into it, from the start of the chunk
+} ScannerCdcState;
+
+// Fixed-width records, e.g. mainframe exports: each record is ncolumns
+// fields of the given widths back to back, with no separators, so fields are
+// found by arithmetic alone. Each is a token typed with its column number
+// from 1, so a column no greater than the one before starts a new record.
+// Pad bytes are trimmed from the ends the flags ask for, and fields left
+// empty are skipped. A short last record ends with what there is.
+#define SCANNER_FIXED_MAX_COLUMNS   64
+#define SCANNER_FIXED_MAX_RECORD    (1u << 20)
+#define SCANNER_FIXED_TRIM_LEFT     1
+#define SCANNER_FIXED_TRIM_RIGHT    2
+
+typedef struct {
+    ScannerSeps pad;
+    uint32_t flags;         // SCANNER_FIXED_TRIM_*
+    uint32_t ncolumns;
+    uint32_t widths[SCANNER_FIXED_MAX_COLUMNS];
+} ScannerFixed;
+
+// Column of the field at the cursor, from 0
+typedef struct {
+    uint32_t column;
+} ScannerFixedState;
+
+// Where a lexer is in its input. The encoder carries it, so that a copy of
+// the encoder probing ahead leaves the original's alone; all zero is the
+// start of the input.
+typedef union {
+    ScannerJson json;
+    ScannerKvState kv;
+    ScannerCdcState cdc;
+    ScannerFixedState fixed;
+} ScannerLexState;
+
+// Finds the next token and its nonzero type in place of the separators, and
+// like scanner_next holds back one that may continue past the end of an open
+// cursor; returns 0 when there is none
+typedef int (*ScannerLexer)(void *arg, ScannerLexState *state, ScannerCursor *cursor,
+                            ScannerToken *token, uint32_t *type);
+
+// Lexer rules compiled to a minimized DFA, as scanner_rules_compile makes
+// them: this header, then uint32_t accept[nstates], the token type each
+// state accepts or SCANNER_DFA_REJECT, then uint16_t next[nstates][nclasses].
+// State 0 is dead and never left; matching starts in state 1, which must not
+// accept. Tokens are the longest match from each position, typed by the
+// state the match ends in; type 0 matches are skipped, as are bytes no rule
+// matches.
+typedef struct {
+    uint32_t nstates;
+    uint32_t nclasses;
+    uint8_t classes[256];   // Class of each byte value
+} ScannerDfa;
+
+#define SCANNER_DFA_DEAD        0
+#define SCANNER_DFA_START       1
+#define SCANNER_DFA_REJECT      0xffffffffu
+#define SCANNER_DFA_MAX_STATES  4096
+
+// Multi-token read state. Bulk and framed reads always fill the buffer, so the
+// last token of one read may be split and finish at the start of the next:
+// in bulk mode a read that does not end in NUL ends inside a token, and in
+// framed mode every frame but a token's last carries SCANNER_FRAME_MORE.
+// Index records are never split.
+typedef struct {
+    ScannerCursor cursor;
+    ScannerToken rest;      // Bytes of a split token still to be sent
+    uint32_t rest_type;     // And its type
+    int split;              // rest is pending; in bulk mode it may be just the NUL
+    ScannerFilter filter;   // Hook deciding which tokens are sent, or NULL for all
+    void *filter_arg;
+    ScannerLexer lexer;     // Hook finding tokens, or NULL to split on the separators with type 0
+    void *lexer_arg;
+    ScannerLexState lex;
+} ScannerEncoder;
+
+// One piece of bulk, framed or typed output: len bytes of the document from
+// start, after the 32-bit type in typed mode and the 32-bit length word in
+// framed and typed modes, and followed by a NUL in bulk mode when nul is
+// set. A piece of a split bulk token may be just its NUL.
+typedef struct {
+    uint32_t start;
+    uint32_t len;
+    uint32_t word;          // Framed length word, SCANNER_FRAME_MORE included
+    uint32_t nul;
+    uint32_t type;
+} ScannerPiece;
+
+void scanner_seps_init(ScannerSeps *seps, const char *chars, size_t n);
+
+// The SCANNER_SET_* that seps is equal to as a set, or SCANNER_SET_CUSTOM
+int scanner_builtin_set(const ScannerSeps *seps);
+
+static inline int scanner_is_sep(const ScannerSeps *seps, unsigned char c) {
+    return (seps->map[c >> 6] >> (c & 63)) & 1;
+}
+
+void scanner_cursor_init(ScannerCursor *cursor, const char *data, size_t len);
+
+// Length of the run of separators, or of non-separators, at the start of p.
+// The _scalar versions are the byte-at-a-time table loop; the others use
+// SSE2 in user space on x86 and 64-bit SWAR words everywhere else,
+// including the kernel, where vector registers are off limits.
+size_t scanner_span_seps(const ScannerSeps *seps, const char *p, size_t n);
+size_t scanner_span_token(const ScannerSeps *seps, const char *p, size_t n);
+size_t scanner_span_seps_scalar(const ScannerSeps *seps, const char *p, size_t n);
+size_t scanner_span_token_scalar(const ScannerSeps *seps, const char *p, size_t n);
+
+// Name of the vectorized implementation compiled in, "sse2" or "swar"
+const char *scanner_simd_name(void);
+
+// Skip leading separators and find the next token. Returns 1 and fills token,
+// leaving the cursor just past it, or returns 0 once only separators remain.
+// scanner_next_scalar is the table-driven reference with identical results.
+int scanner_next(const ScannerSeps *seps, ScannerCursor *cursor, ScannerToken *token);
+int scanner_next_scalar(const ScannerSeps *seps, ScannerCursor *cursor, ScannerToken *token);
+
+// Starts with no filter or lexer
+void scanner_encoder_init(ScannerEncoder *enc, const char *data, size_t len);
+
+// The next token from the encoder's lexer or the separators that its filter
+// keeps, and its type, the filter's if it has one; otherwise as scanner_next
+int scanner_encoder_next(ScannerEncoder *enc, const ScannerSeps *seps, ScannerToken *token, uint32_t *type);
+
+// Bytes a ScannerDfa of this shape takes
+size_t scanner_dfa_size(uint32_t nstates, uint32_t nclasses);
+
+// Whether size bytes at dfa are a well-formed ScannerDfa, safe to run
+int scanner_dfa_check(const ScannerDfa *dfa, size_t size);
+
+// ScannerLexer running the ScannerDfa at arg
+int scanner_dfa_next(void *arg, ScannerLexState *state, ScannerCursor *cursor, ScannerToken *token, uint32_t *type);
+
+// ScannerLexer for JSON text; arg is unused
+int scanner_json_next(void *arg, ScannerLexState *state, ScannerCursor *cursor, ScannerToken *token, uint32_t *type);
+
+// Bytes of a ScannerKv interning nkeys names of names_len bytes in all
+size_t scanner_kv_size(uint32_t nkeys, size_t names_len);
+
+// Set up kv, of scanner_kv_size bytes, to split pairs on the NUL-terminated
+// delimiter strings pairs and assign, with quote 0 or a byte that may open
+// a value, and intern the nkeys NUL-terminated names back to back at names.
+// Returns 1, or 0 if a string has more than SCANNER_KV_MAX_DELIMS bytes or
+// a '\n', assign is empty, a byte is in both or is the quote, or a name is
+// empty or repeated.
+int scanner_kv_init(ScannerKv *kv, const char *pairs, const char *assign, unsigned char quote,
+                    const char *names, uint32_t nkeys, size_t names_len);
+
+// ScannerLexer splitting the key=value pairs of the ScannerKv at arg
+int scanner_kv_next(void *arg, ScannerLexState *state, ScannerCursor *cursor, ScannerToken *token, uint32_t *type);
+
+// Set up cdc for chunks of min to max bytes around avg. Returns 1, or 0 if
+// min is 0, the sizes are out of order or avg or max is out of range.
+int scanner_cdc_init(ScannerCdc *cdc, uint32_t min, uint32_t avg, uint32_t max);
+
+// ScannerLexer cutting the input into the content-defined chunks of the
+// ScannerCdc at arg
+int scanner_cdc_next(void *arg, ScannerLexState *state, ScannerCursor *cursor, ScannerToken *token, uint32_t *type);
+
+// Set up fixed for records of ncolumns fields of the given widths, trimming
+// the npad bytes at pad as flags asks. Returns 1, or 0 if there are no
+// columns or too many, a width is 0, the record is longer than
+// SCANNER_FIXED_MAX_RECORD, or flags has unknown bits.
+int scanner_fixed_init(ScannerFixed *fixed, const uint32_t *widths, uint32_t ncolumns,
+                       const char *pad, size_t npad, uint32_t flags);
+
+// ScannerLexer splitting the fixed-width records of the ScannerFixed at arg
+int scanner_fixed_next(void *arg, ScannerLexState *state, ScannerCursor *cursor, ScannerToken *token, uint32_t *type);
+
+// SHA-256 of len bytes at data
+void scanner_sha256(const void *data, size_t len, uint8_t out[32]);
+
+// Streaming append: the encoder needs only the data from scanner_encoder_keep
+// on. scanner_encoder_rebase points it at a new buffer that starts with those
+// bytes and continues with the appended ones; offsets move down accordingly.
+size_t scanner_encoder_keep(const ScannerEncoder *enc);
+void scanner_encoder_rebase(ScannerEncoder *enc, const char *data, size_t len);
+
+// Smallest buffer that can make progress in each multi-token mode
+size_t scanner_min_read(int mode);
+
+// Plan the bulk, framed or typed output of up to max pieces filling at most cap bytes,
+// advancing the encoder as scanner_encode would. Returns the bytes the pieces
+// take, sets *npieces, and adds the tokens completed to *ntokens. Fewer than
+// max pieces means the read is full or out of tokens. Lets a caller place the
+// bytes itself, e.g. straight into user memory.
+#define SCANNER_PLAN_BATCH 32    // Pieces per plan, small enough for a kernel stack
+size_t scanner_plan(ScannerEncoder *enc, const ScannerSeps *seps, int mode, size_t cap,
+                    ScannerPiece *pieces, size_t max, size_t *npieces, size_t *ntokens);
+
+// Lay planned pieces of data out in out, as scanner_encode would; returns the
+// bytes written
+size_t scanner_place(const ScannerPiece *pieces, size_t npieces, const char *data, int mode, char *out);
+
+// Encode as many tokens as fit in out, in bulk, framed, index, typed or digest mode.
+// Returns the bytes written, 0 once every token has been sent, and adds the
+// number of tokens completed to *ntokens.
+size_t scanner_encode(ScannerEncoder *enc, const ScannerSeps *seps, int mode,
+                      char *out, size_t cap, size_t *ntokens);
+
+#endif //HW5_SCANNERCORE_H
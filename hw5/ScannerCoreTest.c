@@ -0,0 +1,976 @@
+//
+// KUnit suite for the tokenizer core. Every case runs both scanner_next and
+// the table-driven scanner_next_scalar and insists they agree, and checks the
+// vectorized spans against each run they find, so the SWAR spans the module's
+// lexers use are checked against the reference on each input.
+//
+// Run under User-Mode Linux with ./kunit KERNEL_SOURCE.
+//
+#include <kunit/test.h>
+#include <linux/ktime.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/vmalloc.h>
+
+// The core itself, so the test module does not share ScannerCore.o with
+// the driver
+#include "ScannerCore.c"
+
+#define MAX_TOKENS 256
+
+KUNIT_DEFINE_ACTION_WRAPPER(vfree_action, vfree, const void *);
+
+// vmalloc() for buffers too large for kunit_kzalloc(), freed when the test
+// ends, even by a failed assertion
+static void *test_vmalloc(struct kunit *test, size_t size) {
+    void *p = vmalloc(size);
+
+    if (p && kunit_add_action_or_reset(test, vfree_action, p)) {
+        return NULL;
+    }
+    return p;
+}
+
+typedef struct {
+    ScannerToken tokens[MAX_TOKENS];
+    int n;
+} TokenList;
+
+// Tokenize data with both implementations, expecting identical results, and
+// with the spans measuring the same runs
+static void scan(struct kunit *test, const char *seps, size_t nseps, const char *data, size_t len,
+                 TokenList *list) {
+    ScannerSeps table;
+    ScannerCursor fast, scalar;
+    ScannerToken a, b;
+    size_t prev;
+    int more;
+
+    scanner_seps_init(&table, seps, nseps);
+    scanner_cursor_init(&fast, data, len);
+    scanner_cursor_init(&scalar, data, len);
+    list->n = 0;
+    do {
+        prev = scalar.pos;
+        more = scanner_next(&table, &fast, &a);
+        KUNIT_ASSERT_EQ(test, more, scanner_next_scalar(&table, &scalar, &b));
+        KUNIT_EXPECT_EQ(test, scanner_span_seps(&table, data + prev, len - prev), (more ? b.start : len) - prev);
+        if (more) {
+            KUNIT_EXPECT_EQ(test, scanner_span_token(&table, data + b.start, len - b.start), b.len);
+            KUNIT_EXPECT_EQ(test, a.start, b.start);
+            KUNIT_EXPECT_EQ(test, a.len, b.len);
+            KUNIT_ASSERT_LT(test, list->n, MAX_TOKENS);
+            list->tokens[list->n++] = a;
+        }
+        KUNIT_EXPECT_EQ(test, fast.pos, scalar.pos);
+    } while (more);
+    KUNIT_EXPECT_EQ(test, fast.pos, fast.len);
+}
+
+static void expect_token(struct kunit *test, const char *data, const TokenList *list, int i,
+                         const char *expect, size_t len) {
+    KUNIT_ASSERT_LT(test, i, list->n);
+    KUNIT_EXPECT_EQ(test, list->tokens[i].len, len);
+    KUNIT_EXPECT_EQ(test, memcmp(data + list->tokens[i].start, expect, len), 0);
+}
+
+static void scanner_test_default_separators(struct kunit *test) {
+    static const char data[] = "  This\tis \n\r a\f\vtest.\n";
+    TokenList list;
+
+    scan(test, SCANNER_DEFAULT_SEPARATORS, strlen(SCANNER_DEFAULT_SEPARATORS), data, strlen(data), &list);
+    KUNIT_EXPECT_EQ(test, list.n, 4);
+    expect_token(test, data, &list, 0, "This", 4);
+    expect_token(test, data, &list, 1, "is", 2);
+    expect_token(test, data, &list, 2, "a", 1);
+    expect_token(test, data, &list, 3, "test.", 5);
+}
+
+static void scanner_test_custom_separators(struct kunit *test) {
+    static const char data[] = "a b,,c;d e;";
+    TokenList list;
+
+    // Whitespace is ordinary data once it is not in the set
+    scan(test, ",;", 2, data, strlen(data), &list);
+    KUNIT_EXPECT_EQ(test, list.n, 3);
+    expect_token(test, data, &list, 0, "a b", 3);
+    expect_token(test, data, &list, 1, "c", 1);
+    expect_token(test, data, &list, 2, "d e", 3);
+}
+
+static void scanner_test_empty_input(struct kunit *test) {
+    TokenList list;
+
+    scan(test, " ", 1, "", 0, &list);
+    KUNIT_EXPECT_EQ(test, list.n, 0);
+    scan(test, " ", 1, NULL, 0, &list);
+    KUNIT_EXPECT_EQ(test, list.n, 0);
+}
+
+static void scanner_test_separator_only(struct kunit *test) {
+    char data[100];
+    TokenList list;
+    size_t i;
+
+    for (i = 0; i < sizeof(data); i++) {
+        data[i] = SCANNER_DEFAULT_SEPARATORS[i % 6];
+    }
+    scan(test, SCANNER_DEFAULT_SEPARATORS, 6, data, sizeof(data), &list);
+    KUNIT_EXPECT_EQ(test, list.n, 0);
+}
+
+// Tokens and separator runs straddling every offset of the 8- and 16-byte blocks
+static void scanner_test_block_boundaries(struct kunit *test) {
+    char data[80];
+    TokenList list;
+    size_t start, len;
+
+    for (start = 0; start < 40; start++) {
+        for (len = 1; start + len < sizeof(data); len += 3) {
+            memset(data, ' ', sizeof(data));
+            memset(data + start, 'x', len);
+            scan(test, " \t", 2, data, sizeof(data), &list);
+            KUNIT_ASSERT_EQ(test, list.n, 1);
+            KUNIT_EXPECT_EQ(test, list.tokens[0].start, start);
+            KUNIT_EXPECT_EQ(test, list.tokens[0].len, len);
+        }
+    }
+}
+
+// Token mode hands out min(token.len, count) bytes per read and moves on, so a
+// token larger than the reader's buffer must still leave the cursor past all of it
+static void scanner_test_token_larger_than_buffer(struct kunit *test) {
+    const size_t count = 16;
+    char *data = kunit_kzalloc(test, 4098, GFP_KERNEL);
+    ScannerSeps seps;
+    ScannerCursor cursor;
+    ScannerToken token;
+
+    KUNIT_ASSERT_NOT_NULL(test, data);
+    memset(data, 'y', 4096);
+    data[4096] = ' ';
+    data[4097] = 'z';
+    scanner_seps_init(&seps, " ", 1);
+    scanner_cursor_init(&cursor, data, 4098);
+
+    KUNIT_ASSERT_TRUE(test, scanner_next(&seps, &cursor, &token));
+    KUNIT_EXPECT_EQ(test, token.len, (size_t)4096);
+    KUNIT_EXPECT_EQ(test, min(token.len, count), count);
+    KUNIT_EXPECT_EQ(test, cursor.pos, (size_t)4096);
+    KUNIT_ASSERT_TRUE(test, scanner_next(&seps, &cursor, &token));
+    KUNIT_EXPECT_EQ(test, token.start, (size_t)4097);
+    KUNIT_EXPECT_FALSE(test, scanner_next(&seps, &cursor, &token));
+}
+
+static void scanner_test_embedded_nul(struct kunit *test) {
+    static const char data[] = "a\0b c\0";
+    TokenList list;
+
+    // NUL is data by default...
+    scan(test, " ", 1, data, sizeof(data) - 1, &list);
+    KUNIT_EXPECT_EQ(test, list.n, 2);
+    expect_token(test, data, &list, 0, "a\0b", 3);
+    expect_token(test, data, &list, 1, "c\0", 2);
+
+    // ...and a separator only when the set says so
+    scan(test, " \0", 2, data, sizeof(data) - 1, &list);
+    KUNIT_EXPECT_EQ(test, list.n, 3);
+    expect_token(test, data, &list, 1, "b", 1);
+}
+
+static void scanner_test_high_bytes_and_large_sets(struct kunit *test) {
+    static const char data[] = "\x80x\xffy\x80\x80z";
+    static const char many[] = "0123456789\x80\xff";
+    TokenList list;
+    ScannerSeps seps;
+
+    scan(test, "\x80\xff", 2, data, sizeof(data) - 1, &list);
+    KUNIT_EXPECT_EQ(test, list.n, 3);
+
+    // More than SCANNER_SIMD_MAX_SEPS separators falls back to the table
+    scanner_seps_init(&seps, many, sizeof(many) - 1);
+    KUNIT_EXPECT_EQ(test, seps.nchars, 0u);
+    scan(test, many, sizeof(many) - 1, data, sizeof(data) - 1, &list);
+    KUNIT_EXPECT_EQ(test, list.n, 3);
+}
+
+static u32 lcg(u32 *state) {
+    *state = *state * 1664525 + 1013904223;
+    return *state >> 8;
+}
+
+static void scanner_test_randomized(struct kunit *test) {
+    static const char *sets[] = { " ", SCANNER_DEFAULT_SEPARATORS, ",;", "\x80\xff" };
+    char data[200];
+    TokenList list;
+    u32 state = 1;
+    size_t i, j;
+
+    for (i = 0; i < 2000; i++) {
+        const char *set = sets[i % ARRAY_SIZE(sets)];
+        size_t len = lcg(&state) % sizeof(data);
+        for (j = 0; j < len; j++) {
+            data[j] = lcg(&state) % 3 ? 'a' + lcg(&state) % 26 : set[lcg(&state) % strlen(set)];
+        }
+        scan(test, set, strlen(set), data, len, &list);
+    }
+}
+
+static void scanner_test_builtin_sets(struct kunit *test) {
+    // Neighbours of the whitespace range and their high-bit twins must not match
+    static const char tricky[] = { 8, 14, 31, 33, (char)0x89, (char)0x8d, (char)0xa0, 'x' };
+    char data[300];
+    ScannerSeps seps;
+    TokenList list;
+    u32 state = 7;
+    size_t i, j;
+
+    scanner_seps_init(&seps, "\v\f\r\n\t  ", 7);
+    KUNIT_EXPECT_EQ(test, seps.builtin, (unsigned int)SCANNER_SET_WHITESPACE);
+    scanner_seps_init(&seps, ",,", 2);
+    KUNIT_EXPECT_EQ(test, seps.builtin, (unsigned int)SCANNER_SET_COMMA);
+    scanner_seps_init(&seps, "\n", 1);
+    KUNIT_EXPECT_EQ(test, seps.builtin, (unsigned int)SCANNER_SET_NEWLINE);
+    scanner_seps_init(&seps, " \t", 2);
+    KUNIT_EXPECT_EQ(test, seps.builtin, (unsigned int)SCANNER_SET_CUSTOM);
+    scanner_seps_init(&seps, " \t\n\r\f\v,", 7);
+    KUNIT_EXPECT_EQ(test, seps.builtin, (unsigned int)SCANNER_SET_CUSTOM);
+
+    // Long tokens so the specialized block loops do the work
+    for (i = 0; i < 500; i++) {
+        for (j = 0; j < sizeof(data); j++) {
+            u32 r = lcg(&state) % 64;
+            data[j] = r == 0 ? SCANNER_DEFAULT_SEPARATORS[lcg(&state) % 6]
+                    : r == 1 ? ','
+                    : r < 6 ? tricky[lcg(&state) % sizeof(tricky)]
+                    : 'a' + r % 26;
+        }
+        scan(test, SCANNER_DEFAULT_SEPARATORS, 6, data, sizeof(data), &list);
+        scan(test, ",", 1, data, sizeof(data), &list);
+        scan(test, "\t", 1, data, sizeof(data), &list);
+    }
+}
+
+// Decode everything scanner_encode produces through reads of at most cap bytes
+// and check it reassembles into the tokens scan() finds
+static void expect_encoded(struct kunit *test, int mode, const char *data, size_t len, size_t cap) {
+    ScannerSeps seps;
+    ScannerEncoder enc;
+    TokenList list;
+    char out[64];
+    size_t n, i, tokens = 0;
+    int t = 0;
+    size_t got = 0;     // Bytes of token t decoded so far
+    int ended = 1;      // Bulk: last byte seen was a NUL
+
+    scan(test, " ,", 2, data, len, &list);
+    scanner_seps_init(&seps, " ,", 2);
+    scanner_encoder_init(&enc, data, len);
+    KUNIT_ASSERT_LE(test, cap, sizeof(out));
+
+    while ((n = scanner_encode(&enc, &seps, mode, out, cap, &tokens)) > 0) {
+        KUNIT_ASSERT_LE(test, n, cap);
+        for (i = 0; i < n;) {
+            KUNIT_ASSERT_LT(test, t, list.n);
+            if (mode == SCANNER_MODE_INDEX || mode == SCANNER_MODE_DIGEST) {
+                ScannerDigest record;
+                uint8_t sha256[32];
+                memcpy(&record, out + i, scanner_min_read(mode));
+                KUNIT_EXPECT_EQ(test, (size_t)record.span.offset, list.tokens[t].start);
+                KUNIT_EXPECT_EQ(test, (size_t)record.span.len, list.tokens[t].len);
+                if (mode == SCANNER_MODE_DIGEST) {
+                    scanner_sha256(data + list.tokens[t].start, list.tokens[t].len, sha256);
+                    KUNIT_EXPECT_EQ(test, memcmp(record.sha256, sha256, sizeof(sha256)), 0);
+                }
+                i += scanner_min_read(mode);
+                t++;
+            } else if (mode == SCANNER_MODE_FRAMED || mode == SCANNER_MODE_TYPED) {
+                u32 word, flen, type = 0;
+                if (mode == SCANNER_MODE_TYPED) {
+                    KUNIT_ASSERT_LE(test, i + sizeof(type), n);
+                    memcpy(&type, out + i, sizeof(type));
+                    i += sizeof(type);
+                }
+                KUNIT_EXPECT_EQ(test, type, 0u);    // No filter: every token is kept as type 0
+                KUNIT_ASSERT_LE(test, i + sizeof(word), n);
+                memcpy(&word, out + i, sizeof(word));
+                flen = word & ~SCANNER_FRAME_MORE;
+                KUNIT_ASSERT_LE(test, i + sizeof(word) + flen, n);
+                KUNIT_ASSERT_LE(test, got + flen, list.tokens[t].len);
+                KUNIT_EXPECT_EQ(test, memcmp(out + i + sizeof(word), data + list.tokens[t].start + got, flen), 0);
+                got += flen;
+                i += sizeof(word) + flen;
+                if (!(word & SCANNER_FRAME_MORE)) {
+                    KUNIT_EXPECT_EQ(test, got, list.tokens[t].len);
+                    got = 0;
+                    t++;
+                }
+            } else if (out[i] == '\0') {
+                KUNIT_EXPECT_EQ(test, got, list.tokens[t].len);
+                got = 0;
+                t++;
+                i++;
+            } else {
+                KUNIT_ASSERT_LT(test, got, list.tokens[t].len);
+                KUNIT_EXPECT_EQ(test, out[i], data[list.tokens[t].start + got]);
+                got++;
+                i++;
+            }
+        }
+        ended = out[n - 1] == '\0';
+        // Only the last token of a read may be split, and only to fill the buffer
+        if (mode != SCANNER_MODE_INDEX && mode != SCANNER_MODE_DIGEST && (got || (mode == SCANNER_MODE_BULK && !ended))) {
+            KUNIT_EXPECT_GE(test, n + scanner_min_read(mode), cap);
+        }
+    }
+    KUNIT_EXPECT_EQ(test, t, list.n);
+    KUNIT_EXPECT_EQ(test, tokens, (size_t)list.n);
+}
+
+static void scanner_test_encode_modes(struct kunit *test) {
+    static const char data[] = "alpha beta,,gamma  a bb ccc,ddddddddddddddddddddddddddddddddddddddd e";
+    int mode;
+    size_t cap;
+
+    for (mode = SCANNER_MODE_BULK; mode < SCANNER_MODES; mode++) {
+        for (cap = scanner_min_read(mode); cap <= 64; cap++) {
+            expect_encoded(test, mode, data, sizeof(data) - 1, cap);
+        }
+        expect_encoded(test, mode, "", 0, 64);
+        expect_encoded(test, mode, " ,, ", 4, 64);
+    }
+}
+
+static void scanner_test_encode_layout(struct kunit *test) {
+    static const char data[] = " ab  c ";
+    ScannerSeps seps;
+    ScannerEncoder enc;
+    ScannerSpan spans[2];
+    char out[32];
+    size_t tokens = 0;
+    u32 word;
+
+    scanner_seps_init(&seps, " ", 1);
+    scanner_encoder_init(&enc, data, sizeof(data) - 1);
+    KUNIT_ASSERT_EQ(test, scanner_encode(&enc, &seps, SCANNER_MODE_BULK, out, sizeof(out), &tokens), (size_t)5);
+    KUNIT_EXPECT_EQ(test, memcmp(out, "ab\0c\0", 5), 0);
+    KUNIT_EXPECT_EQ(test, scanner_encode(&enc, &seps, SCANNER_MODE_BULK, out, sizeof(out), &tokens), (size_t)0);
+
+    // Native-endian length words, each directly followed by the token
+    scanner_encoder_init(&enc, data, sizeof(data) - 1);
+    KUNIT_ASSERT_EQ(test, scanner_encode(&enc, &seps, SCANNER_MODE_FRAMED, out, sizeof(out), &tokens), (size_t)11);
+    memcpy(&word, out, sizeof(word));
+    KUNIT_EXPECT_EQ(test, word, 2u);
+    KUNIT_EXPECT_EQ(test, memcmp(out + 4, "ab", 2), 0);
+    memcpy(&word, out + 6, sizeof(word));
+    KUNIT_EXPECT_EQ(test, word, 1u);
+    KUNIT_EXPECT_EQ(test, out[10], 'c');
+
+    // A split token: two bytes, then the rest with no MORE flag
+    scanner_encoder_init(&enc, data, sizeof(data) - 1);
+    KUNIT_ASSERT_EQ(test, scanner_encode(&enc, &seps, SCANNER_MODE_FRAMED, out, 5, &tokens), (size_t)5);
+    memcpy(&word, out, sizeof(word));
+    KUNIT_EXPECT_EQ(test, word, 1u | SCANNER_FRAME_MORE);
+
+    scanner_encoder_init(&enc, data, sizeof(data) - 1);
+    KUNIT_ASSERT_EQ(test, scanner_encode(&enc, &seps, SCANNER_MODE_INDEX, (char *)spans, sizeof(spans), &tokens),
+                    sizeof(spans));
+    KUNIT_EXPECT_EQ(test, spans[0].offset, 1u);
+    KUNIT_EXPECT_EQ(test, spans[0].len, 2u);
+    KUNIT_EXPECT_EQ(test, spans[1].offset, 5u);
+    KUNIT_EXPECT_EQ(test, spans[1].len, 1u);
+}
+
+static void scanner_test_plan(struct kunit *test) {
+    static const char data[] = "ab cde";
+    ScannerSeps seps;
+    ScannerEncoder enc;
+    ScannerPiece pieces[4];
+    size_t npieces, tokens = 0;
+
+    // Bulk into 5 bytes: "ab\0", then "cd" with neither the rest nor the NUL
+    scanner_seps_init(&seps, " ", 1);
+    scanner_encoder_init(&enc, data, sizeof(data) - 1);
+    KUNIT_EXPECT_EQ(test, scanner_plan(&enc, &seps, SCANNER_MODE_BULK, 5, pieces, 4, &npieces, &tokens), (size_t)5);
+    KUNIT_ASSERT_EQ(test, npieces, (size_t)2);
+    KUNIT_EXPECT_EQ(test, pieces[0].start, 0u);
+    KUNIT_EXPECT_EQ(test, pieces[0].len, 2u);
+    KUNIT_EXPECT_EQ(test, pieces[0].nul, 1u);
+    KUNIT_EXPECT_EQ(test, pieces[1].start, 3u);
+    KUNIT_EXPECT_EQ(test, pieces[1].len, 2u);
+    KUNIT_EXPECT_EQ(test, pieces[1].nul, 0u);
+    KUNIT_EXPECT_EQ(test, tokens, (size_t)1);
+
+    // Stopping at max pieces leaves the next token to the next plan
+    scanner_encoder_init(&enc, data, sizeof(data) - 1);
+    KUNIT_EXPECT_EQ(test, scanner_plan(&enc, &seps, SCANNER_MODE_FRAMED, 64, pieces, 1, &npieces, &tokens),
+                    (size_t)6);
+    KUNIT_EXPECT_EQ(test, pieces[0].word, 2u);
+    KUNIT_EXPECT_EQ(test, scanner_plan(&enc, &seps, SCANNER_MODE_FRAMED, 64, pieces, 4, &npieces, &tokens),
+                    (size_t)7);
+    KUNIT_ASSERT_EQ(test, npieces, (size_t)1);
+    KUNIT_EXPECT_EQ(test, pieces[0].start, 3u);
+    KUNIT_EXPECT_EQ(test, pieces[0].word, 3u);
+}
+
+// Keeps tokens of odd length, typed by their length
+static uint32_t odd_tokens(void *arg, const char *data, const ScannerToken *token) {
+    (*(int *)arg)++;
+    return token->len % 2 ? (uint32_t)token->len : 0;
+}
+
+static void scanner_test_filter(struct kunit *test) {
+    static const char data[] = "a bb ccc dddd eeeee";
+    ScannerSeps seps;
+    ScannerEncoder enc;
+    ScannerToken token;
+    ScannerSpan spans[4];
+    char out[32];
+    size_t tokens = 0;
+    uint32_t type;
+    u32 word;
+    int calls = 0;
+
+    scanner_seps_init(&seps, " ", 1);
+    scanner_encoder_init(&enc, data, sizeof(data) - 1);
+    enc.filter = odd_tokens;
+    enc.filter_arg = &calls;
+    KUNIT_ASSERT_TRUE(test, scanner_encoder_next(&enc, &seps, &token, &type));
+    KUNIT_EXPECT_EQ(test, token.start, (size_t)0);
+    KUNIT_EXPECT_EQ(test, type, 1u);
+    KUNIT_ASSERT_TRUE(test, scanner_encoder_next(&enc, &seps, &token, &type));
+    KUNIT_EXPECT_EQ(test, token.start, (size_t)5);
+    KUNIT_EXPECT_EQ(test, type, 3u);
+    KUNIT_EXPECT_EQ(test, calls, 3);
+
+    // Typed records: type, length word, bytes; a split token keeps its type
+    scanner_encoder_init(&enc, data, sizeof(data) - 1);
+    enc.filter = odd_tokens;
+    enc.filter_arg = &calls;
+    KUNIT_ASSERT_EQ(test, scanner_encode(&enc, &seps, SCANNER_MODE_TYPED, out, 24, &tokens), (size_t)20);
+    memcpy(&type, out, sizeof(type));
+    memcpy(&word, out + 4, sizeof(word));
+    KUNIT_EXPECT_EQ(test, type, 1u);
+    KUNIT_EXPECT_EQ(test, word, 1u);
+    KUNIT_EXPECT_EQ(test, out[8], 'a');
+    memcpy(&type, out + 9, sizeof(type));
+    memcpy(&word, out + 13, sizeof(word));
+    KUNIT_EXPECT_EQ(test, type, 3u);
+    KUNIT_EXPECT_EQ(test, word, 3u);
+    KUNIT_EXPECT_EQ(test, memcmp(out + 17, "ccc", 3), 0);
+    KUNIT_ASSERT_EQ(test, scanner_encode(&enc, &seps, SCANNER_MODE_TYPED, out, 11, &tokens), (size_t)11);
+    memcpy(&word, out + 4, sizeof(word));
+    KUNIT_EXPECT_EQ(test, word, 3u | SCANNER_FRAME_MORE);
+    KUNIT_ASSERT_EQ(test, scanner_encode(&enc, &seps, SCANNER_MODE_TYPED, out, sizeof(out), &tokens), (size_t)10);
+    memcpy(&type, out, sizeof(type));
+    memcpy(&word, out + 4, sizeof(word));
+    KUNIT_EXPECT_EQ(test, type, 5u);
+    KUNIT_EXPECT_EQ(test, word, 2u);
+    KUNIT_EXPECT_EQ(test, tokens, (size_t)3);
+
+    // Index records skip dropped tokens too
+    scanner_encoder_init(&enc, data, sizeof(data) - 1);
+    enc.filter = odd_tokens;
+    enc.filter_arg = &calls;
+    KUNIT_ASSERT_EQ(test, scanner_encode(&enc, &seps, SCANNER_MODE_INDEX, (char *)spans, sizeof(spans), &tokens),
+                    3 * sizeof(ScannerSpan));
+    KUNIT_EXPECT_EQ(test, spans[1].offset, 5u);
+    KUNIT_EXPECT_EQ(test, spans[2].offset, 14u);
+}
+
+// Rules a+ (type 1), ab (type 2) and runs of spaces (skipped), by hand.
+// Classes: 1 'a', 2 'b', 3 ' ', 0 anything else.
+static void rules_table(struct kunit *test, ScannerDfa *dfa) {
+    static const uint32_t accept[] = { SCANNER_DFA_REJECT, SCANNER_DFA_REJECT, 1, 2, 1, 0 };
+    static const uint16_t next[][4] = {
+        { 0, 0, 0, 0 },     // Dead
+        { 0, 2, 0, 5 },     // Start
+        { 0, 4, 3, 0 },     // a
+        { 0, 0, 0, 0 },     // ab
+        { 0, 4, 0, 0 },     // aa+
+        { 0, 0, 0, 5 },     // Spaces
+    };
+
+    memset(dfa->classes, 0, sizeof(dfa->classes));
+    dfa->classes['a'] = 1;
+    dfa->classes['b'] = 2;
+    dfa->classes[' '] = 3;
+    dfa->nstates = 6;
+    dfa->nclasses = 4;
+    memcpy(dfa + 1, accept, sizeof(accept));
+    memcpy((char *)(dfa + 1) + sizeof(accept), next, sizeof(next));
+    KUNIT_ASSERT_TRUE(test, scanner_dfa_check(dfa, scanner_dfa_size(6, 4)));
+}
+
+static void scanner_test_rules(struct kunit *test) {
+    static const char data[] = "ab aab a";
+    u32 buf[(sizeof(ScannerDfa) + 6 * sizeof(uint32_t) + 6 * 4 * sizeof(uint16_t)) / sizeof(u32)];
+    ScannerDfa *dfa = (ScannerDfa *)buf;
+    uint16_t *next = (uint16_t *)((uint32_t *)(dfa + 1) + 6);
+    ScannerCursor cursor;
+    ScannerToken token;
+    uint32_t type;
+
+    KUNIT_ASSERT_EQ(test, sizeof(buf), scanner_dfa_size(6, 4));
+    rules_table(test, dfa);
+
+    // Longest match wins, and bytes no rule matches are skipped
+    scanner_cursor_init(&cursor, data, sizeof(data) - 1);
+    KUNIT_ASSERT_TRUE(test, scanner_dfa_next(dfa, NULL, &cursor, &token, &type));
+    KUNIT_EXPECT_EQ(test, token.start, (size_t)0);
+    KUNIT_EXPECT_EQ(test, token.len, (size_t)2);
+    KUNIT_EXPECT_EQ(test, type, 2u);
+    KUNIT_ASSERT_TRUE(test, scanner_dfa_next(dfa, NULL, &cursor, &token, &type));
+    KUNIT_EXPECT_EQ(test, token.start, (size_t)3);
+    KUNIT_EXPECT_EQ(test, token.len, (size_t)2);
+    KUNIT_EXPECT_EQ(test, type, 1u);
+    KUNIT_ASSERT_TRUE(test, scanner_dfa_next(dfa, NULL, &cursor, &token, &type));
+    KUNIT_EXPECT_EQ(test, token.start, (size_t)7);
+    KUNIT_EXPECT_EQ(test, type, 1u);
+    KUNIT_EXPECT_FALSE(test, scanner_dfa_next(dfa, NULL, &cursor, &token, &type));
+
+    // A match that could go on is held back while the stream is open
+    scanner_cursor_init(&cursor, "b aa", 4);
+    cursor.open = 1;
+    KUNIT_EXPECT_FALSE(test, scanner_dfa_next(dfa, NULL, &cursor, &token, &type));
+    KUNIT_EXPECT_EQ(test, cursor.pos, (size_t)2);
+
+    // Tables that could leave the dead state, match nothing or point outside
+    next[5 * 4] = 6;
+    KUNIT_EXPECT_FALSE(test, scanner_dfa_check(dfa, scanner_dfa_size(6, 4)));
+    rules_table(test, dfa);
+    next[1] = 2;
+    KUNIT_EXPECT_FALSE(test, scanner_dfa_check(dfa, scanner_dfa_size(6, 4)));
+    rules_table(test, dfa);
+    ((uint32_t *)(dfa + 1))[SCANNER_DFA_START] = 1;
+    KUNIT_EXPECT_FALSE(test, scanner_dfa_check(dfa, scanner_dfa_size(6, 4)));
+    rules_table(test, dfa);
+    KUNIT_EXPECT_FALSE(test, scanner_dfa_check(dfa, scanner_dfa_size(6, 4) - 1));
+}
+
+// Expect the lexer's next token to be text, of type
+static void expect_lexed(struct kunit *test, ScannerEncoder *enc, const char *text, uint32_t want) {
+    ScannerSeps seps;
+    ScannerToken token;
+    uint32_t type;
+
+    scanner_seps_init(&seps, "", 0);
+    KUNIT_ASSERT_TRUE(test, scanner_encoder_next(enc, &seps, &token, &type));
+    KUNIT_EXPECT_EQ(test, token.len, strlen(text));
+    KUNIT_EXPECT_EQ(test, memcmp(enc->cursor.data + token.start, text, token.len), 0);
+    KUNIT_EXPECT_EQ(test, type, want);
+}
+
+static void expect_json(struct kunit *test, ScannerEncoder *enc, const char *text, uint32_t kind, uint32_t depth) {
+    expect_lexed(test, enc, text, SCANNER_JSON_TYPE(kind, depth));
+}
+
+static void scanner_test_json(struct kunit *test) {
+    static const char data[] = "{\"a\": [1, -2.5e3, \"x\\\"y\"], \"b\" :{\"c\":null}}\n"
+                               "[\"long string that spans more than one vector block \\\\\", true]";
+    static const char part[] = "{\"key\": \"val";
+    static const char odd[] = "[a\vb,\r\nc\fd\ve_literal_longer_than_a_block\t]";
+    ScannerEncoder enc;
+    ScannerSeps seps;
+    ScannerToken token;
+    uint32_t type;
+
+    scanner_encoder_init(&enc, data, sizeof(data) - 1);
+    enc.lexer = scanner_json_next;
+    expect_json(test, &enc, "{", SCANNER_JSON_OBJECT, 0);
+    expect_json(test, &enc, "\"a\"", SCANNER_JSON_KEY, 1);
+    expect_json(test, &enc, "[", SCANNER_JSON_ARRAY, 1);
+    expect_json(test, &enc, "1", SCANNER_JSON_NUMBER, 2);
+    expect_json(test, &enc, "-2.5e3", SCANNER_JSON_NUMBER, 2);
+    expect_json(test, &enc, "\"x\\\"y\"", SCANNER_JSON_STRING, 2);
+    expect_json(test, &enc, "]", SCANNER_JSON_ARRAY_END, 1);
+    expect_json(test, &enc, "\"b\"", SCANNER_JSON_KEY, 1);
+    expect_json(test, &enc, "{", SCANNER_JSON_OBJECT, 1);
+    expect_json(test, &enc, "\"c\"", SCANNER_JSON_KEY, 2);
+    expect_json(test, &enc, "null", SCANNER_JSON_LITERAL, 2);
+    expect_json(test, &enc, "}", SCANNER_JSON_OBJECT_END, 1);
+    expect_json(test, &enc, "}", SCANNER_JSON_OBJECT_END, 0);
+    expect_json(test, &enc, "[", SCANNER_JSON_ARRAY, 0);
+    expect_json(test, &enc, "\"long string that spans more than one vector block \\\\\"",
+                SCANNER_JSON_STRING, 1);
+    expect_json(test, &enc, "true", SCANNER_JSON_LITERAL, 1);
+    expect_json(test, &enc, "]", SCANNER_JSON_ARRAY_END, 0);
+    scanner_seps_init(&seps, "", 0);
+    KUNIT_EXPECT_FALSE(test, scanner_encoder_next(&enc, &seps, &token, &type));
+
+    // An open string is held back, and a probing copy leaves the depth alone
+    scanner_encoder_init(&enc, part, sizeof(part) - 1);
+    enc.lexer = scanner_json_next;
+    enc.cursor.open = 1;
+    expect_json(test, &enc, "{", SCANNER_JSON_OBJECT, 0);
+    expect_json(test, &enc, "\"key\"", SCANNER_JSON_KEY, 1);
+    KUNIT_EXPECT_FALSE(test, scanner_encoder_next(&enc, &seps, &token, &type));
+    KUNIT_EXPECT_EQ(test, enc.cursor.pos, (size_t)8);
+    enc.cursor.open = 0;
+    {
+        ScannerEncoder probe = enc;
+        expect_json(test, &probe, "\"val", SCANNER_JSON_STRING, 1);
+    }
+    KUNIT_EXPECT_EQ(test, enc.lex.json.depth, 1u);
+
+    // \v and \f are not JSON whitespace, in a short literal or a long one
+    scanner_encoder_init(&enc, odd, sizeof(odd) - 1);
+    enc.lexer = scanner_json_next;
+    expect_json(test, &enc, "[", SCANNER_JSON_ARRAY, 0);
+    expect_json(test, &enc, "a\vb", SCANNER_JSON_LITERAL, 1);
+    expect_json(test, &enc, "c\fd\ve_literal_longer_than_a_block", SCANNER_JSON_LITERAL, 1);
+    expect_json(test, &enc, "]", SCANNER_JSON_ARRAY_END, 0);
+}
+
+static void scanner_test_kv(struct kunit *test) {
+    static const char data[] = "ts=1 level=info msg=\"a \\\"quoted\\\" value longer than a block\" flag\n"
+                               "\tlevel:warn =x empty= q=\"\" user=bob\n\nlevel=\"unterminated\nuser=";
+    static const char names[] = "level\0msg\0user";
+    ScannerKv *kv = kunit_kzalloc(test, scanner_kv_size(3, sizeof(names)), GFP_KERNEL);
+    ScannerEncoder enc;
+    ScannerSeps seps;
+    ScannerToken token;
+    uint32_t type;
+
+    KUNIT_ASSERT_NOT_NULL(test, kv);
+    KUNIT_EXPECT_FALSE(test, scanner_kv_init(kv, " ", " =", '"', "", 0, 0));
+    KUNIT_EXPECT_FALSE(test, scanner_kv_init(kv, " ", "=", '"', "a\0a", 2, 4));
+    KUNIT_ASSERT_TRUE(test, scanner_kv_init(kv, " \t", "=:", '"', names, 3, sizeof(names)));
+
+    scanner_encoder_init(&enc, data, sizeof(data) - 1);
+    enc.lexer = scanner_kv_next;
+    enc.lexer_arg = kv;
+    expect_lexed(test, &enc, "ts", SCANNER_KV_KEY);
+    expect_lexed(test, &enc, "1", 1);
+    expect_lexed(test, &enc, "level", SCANNER_KV_KEY | 1);
+    expect_lexed(test, &enc, "info", 1);
+    expect_lexed(test, &enc, "msg", SCANNER_KV_KEY | 2);
+    expect_lexed(test, &enc, "a \\\"quoted\\\" value longer than a block", 1);
+    expect_lexed(test, &enc, "flag", SCANNER_KV_KEY);
+    expect_lexed(test, &enc, "level", SCANNER_KV_KEY | 1);
+    expect_lexed(test, &enc, "warn", 2);
+    expect_lexed(test, &enc, "x", SCANNER_KV_KEY);
+    expect_lexed(test, &enc, "empty", SCANNER_KV_KEY);
+    expect_lexed(test, &enc, "q", SCANNER_KV_KEY);
+    expect_lexed(test, &enc, "user", SCANNER_KV_KEY | 3);
+    expect_lexed(test, &enc, "bob", 2);
+    expect_lexed(test, &enc, "level", SCANNER_KV_KEY | 1);
+    expect_lexed(test, &enc, "unterminated", 4);
+    expect_lexed(test, &enc, "user", SCANNER_KV_KEY | 3);
+    scanner_seps_init(&seps, "", 0);
+    KUNIT_EXPECT_FALSE(test, scanner_encoder_next(&enc, &seps, &token, &type));
+
+    // A value running into the end of an open stream waits for the rest
+    scanner_encoder_init(&enc, data, 11);
+    enc.lexer = scanner_kv_next;
+    enc.lexer_arg = kv;
+    enc.cursor.open = 1;
+    expect_lexed(test, &enc, "ts", SCANNER_KV_KEY);
+    expect_lexed(test, &enc, "1", 1);
+    expect_lexed(test, &enc, "level", SCANNER_KV_KEY | 1);
+    KUNIT_EXPECT_FALSE(test, scanner_encoder_next(&enc, &seps, &token, &type));
+    KUNIT_EXPECT_EQ(test, enc.cursor.pos, (size_t)11);
+    enc.cursor.len = 16;
+    expect_lexed(test, &enc, "info", 1);
+}
+
+static void expect_sha256(struct kunit *test, const char *data, size_t len, const char *hex) {
+    static const char digits[] = "0123456789abcdef";
+    uint8_t sha256[32];
+    char got[65];
+    int i;
+
+    scanner_sha256(data, len, sha256);
+    for (i = 0; i < 32; i++) {
+        got[2 * i] = digits[sha256[i] >> 4];
+        got[2 * i + 1] = digits[sha256[i] & 15];
+    }
+    got[64] = '\0';
+    KUNIT_EXPECT_STREQ(test, got, hex);
+}
+
+// FIPS 180-2 examples, plus lengths either side of the padding's block split
+static void scanner_test_sha256(struct kunit *test) {
+    static const char two[] = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+    char *a = test_vmalloc(test, 1000000);
+
+    KUNIT_ASSERT_NOT_NULL(test, a);
+    memset(a, 'a', 1000000);
+    expect_sha256(test, "", 0, "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+    expect_sha256(test, "abc", 3, "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+    expect_sha256(test, two, sizeof(two) - 1, "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1");
+    expect_sha256(test, a, 1000000, "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0");
+    expect_sha256(test, a, 55, "9f4390f8d30c2dd92ec9f095b65e2b9ae9b0a925a5258e241c9f1e910f734318");
+    expect_sha256(test, a, 56, "b35439a4ac6f0948b6d6f9e3c6af0f5f590ce20f1bde7090ef7970686ec6738a");
+    expect_sha256(test, a, 64, "ffe054fe7ae0cb6dc65c3af9b61d5209f439851db43d0ba5997337df154668eb");
+}
+
+// Chunks from one pass over the whole input, for comparison
+#define CDC_TEST_LEN (1 << 20)
+#define CDC_TEST_MAX_CHUNKS (CDC_TEST_LEN / 256)
+
+static size_t cdc_cuts(const ScannerCdc *cdc, const char *data, size_t len, int open, size_t *cuts) {
+    ScannerEncoder enc;
+    ScannerSeps seps;
+    ScannerToken token;
+    uint32_t type;
+    size_t n = 0;
+
+    scanner_seps_init(&seps, "", 0);
+    scanner_encoder_init(&enc, data, len);
+    enc.lexer = scanner_cdc_next;
+    enc.lexer_arg = (void *)cdc;
+    enc.cursor.open = open;
+    while (n < CDC_TEST_MAX_CHUNKS && scanner_encoder_next(&enc, &seps, &token, &type)) {
+        cuts[n++] = token.start + token.len;
+    }
+    return n;
+}
+
+static void scanner_test_cdc(struct kunit *test) {
+    ScannerCdc *cdc = kunit_kzalloc(test, sizeof(*cdc), GFP_KERNEL);
+    char *data;
+    size_t *cuts = kunit_kzalloc(test, CDC_TEST_MAX_CHUNKS * sizeof(*cuts), GFP_KERNEL);
+    ScannerEncoder enc;
+    ScannerSeps seps;
+    ScannerToken token;
+    uint32_t type;
+    uint64_t x = 88172645463325252ULL;
+    size_t n, i, k, len, shared;
+
+    KUNIT_ASSERT_NOT_NULL(test, cdc);
+    KUNIT_ASSERT_NOT_NULL(test, cuts);
+    KUNIT_EXPECT_FALSE(test, scanner_cdc_init(cdc, 0, 4096, 16384));
+    KUNIT_EXPECT_FALSE(test, scanner_cdc_init(cdc, 1024, 3000, 16384));
+    KUNIT_EXPECT_FALSE(test, scanner_cdc_init(cdc, 8192, 4096, 16384));
+    KUNIT_EXPECT_FALSE(test, scanner_cdc_init(cdc, 1024, 4096, SCANNER_CDC_MAX_SIZE + 1));
+    KUNIT_ASSERT_TRUE(test, scanner_cdc_init(cdc, 1024, 4096, 16384));
+    data = test_vmalloc(test, CDC_TEST_LEN);
+    KUNIT_ASSERT_NOT_NULL(test, data);
+    for (i = 0; i < CDC_TEST_LEN; i++) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        data[i] = (char)x;
+    }
+
+    // Back to back, within the sizes, and averaging near avg plus min
+    n = cdc_cuts(cdc, data, CDC_TEST_LEN, 0, cuts);
+    KUNIT_ASSERT_GT(test, n, (size_t)0);
+    KUNIT_EXPECT_EQ(test, cuts[n - 1], (size_t)CDC_TEST_LEN);
+    for (i = 0; i < n; i++) {
+        size_t size = cuts[i] - (i ? cuts[i - 1] : 0);
+        KUNIT_EXPECT_LE(test, size, (size_t)16384);
+        if (i < n - 1) {
+            KUNIT_EXPECT_GE(test, size, (size_t)1024);
+        }
+    }
+    KUNIT_EXPECT_GT(test, CDC_TEST_LEN / n, (size_t)3000);
+    KUNIT_EXPECT_LT(test, CDC_TEST_LEN / n, (size_t)8000);
+
+    // Streamed in odd pieces, the same chunks come out
+    scanner_seps_init(&seps, "", 0);
+    scanner_encoder_init(&enc, data, 0);
+    enc.lexer = scanner_cdc_next;
+    enc.lexer_arg = cdc;
+    enc.cursor.open = 1;
+    for (len = 0, k = 0; len < CDC_TEST_LEN;) {
+        len = len + 777 < CDC_TEST_LEN ? len + 777 : CDC_TEST_LEN;
+        enc.cursor.len = len;
+        enc.cursor.open = len < CDC_TEST_LEN;
+        while (scanner_encoder_next(&enc, &seps, &token, &type)) {
+            KUNIT_ASSERT_LT(test, k, n);
+            KUNIT_EXPECT_EQ(test, token.start + token.len, cuts[k]);
+            if (k < n - 1 && token.len < 16384) {
+                KUNIT_EXPECT_EQ(test, type, (u32)SCANNER_CDC_CUT);
+            }
+            k++;
+        }
+    }
+    KUNIT_EXPECT_EQ(test, k, n);
+
+    // Cut points depend on content, not position: dropping a prefix moves
+    // the first cut, and nearly all later ones stay
+    {
+        size_t *moved = kunit_kzalloc(test, CDC_TEST_MAX_CHUNKS * sizeof(*moved), GFP_KERNEL);
+        size_t m;
+
+        KUNIT_ASSERT_NOT_NULL(test, moved);
+        m = cdc_cuts(cdc, data + 100, CDC_TEST_LEN - 100, 0, moved);
+        for (i = 0, k = 0, shared = 0; i < m; i++) {
+            while (k < n && cuts[k] < moved[i] + 100) {
+                k++;
+            }
+            shared += k < n && cuts[k] == moved[i] + 100;
+        }
+        KUNIT_EXPECT_GT(test, shared * 10, n * 9);
+    }
+}
+
+static void scanner_test_fixed(struct kunit *test) {
+    // Name, zero-padded amount and code; the last record is cut short
+    static const char data[] = "ALICE   000042X"
+                               "BOB     001700 "
+                               "        000000Y"
+                               "CAROL   0";
+    static const u32 widths[] = { 8, 6, 1 };
+    ScannerFixed fixed;
+    ScannerEncoder enc;
+    ScannerSeps seps;
+    ScannerToken token;
+    uint32_t type;
+
+    KUNIT_EXPECT_FALSE(test, scanner_fixed_init(&fixed, widths, 0, " ", 1, 0));
+    KUNIT_EXPECT_FALSE(test, scanner_fixed_init(&fixed, (const u32[]){ 4, 0 }, 2, " ", 1, 0));
+    KUNIT_EXPECT_FALSE(test, scanner_fixed_init(&fixed, widths, 3, " ", 1, 4));
+
+    // Untrimmed, every field comes out whole
+    KUNIT_ASSERT_TRUE(test, scanner_fixed_init(&fixed, widths, 3, "", 0, 0));
+    scanner_seps_init(&seps, "", 0);
+    scanner_encoder_init(&enc, data, sizeof(data) - 1);
+    enc.lexer = scanner_fixed_next;
+    enc.lexer_arg = &fixed;
+    expect_lexed(test, &enc, "ALICE   ", 1);
+    expect_lexed(test, &enc, "000042", 2);
+    expect_lexed(test, &enc, "X", 3);
+    expect_lexed(test, &enc, "BOB     ", 1);
+    expect_lexed(test, &enc, "001700", 2);
+    expect_lexed(test, &enc, " ", 3);
+
+    // Trimmed, with empty fields skipped
+    KUNIT_ASSERT_TRUE(test, scanner_fixed_init(&fixed, widths, 3, " 0", 2,
+                                               SCANNER_FIXED_TRIM_LEFT | SCANNER_FIXED_TRIM_RIGHT));
+    scanner_encoder_init(&enc, data, sizeof(data) - 1);
+    enc.lexer = scanner_fixed_next;
+    enc.lexer_arg = &fixed;
+    expect_lexed(test, &enc, "ALICE", 1);
+    expect_lexed(test, &enc, "42", 2);
+    expect_lexed(test, &enc, "X", 3);
+    expect_lexed(test, &enc, "BOB", 1);
+    expect_lexed(test, &enc, "17", 2);
+    expect_lexed(test, &enc, "Y", 3);
+    expect_lexed(test, &enc, "CAROL", 1);
+    KUNIT_EXPECT_FALSE(test, scanner_encoder_next(&enc, &seps, &token, &type));
+
+    // While open, a field waits until all of its bytes are in
+    KUNIT_ASSERT_TRUE(test, scanner_fixed_init(&fixed, widths, 3, " ", 1, SCANNER_FIXED_TRIM_RIGHT));
+    scanner_encoder_init(&enc, data, 12);
+    enc.lexer = scanner_fixed_next;
+    enc.lexer_arg = &fixed;
+    enc.cursor.open = 1;
+    expect_lexed(test, &enc, "ALICE", 1);
+    KUNIT_EXPECT_FALSE(test, scanner_encoder_next(&enc, &seps, &token, &type));
+    KUNIT_EXPECT_EQ(test, enc.cursor.pos, (size_t)8);
+    enc.cursor.len = 15;
+    expect_lexed(test, &enc, "000042", 2);
+    expect_lexed(test, &enc, "X", 3);
+}
+
+// A token that reaches the end of an open stream is held until more data or
+// the close shows where it ends
+static void scanner_test_stream_append(struct kunit *test) {
+    ScannerSeps seps;
+    ScannerEncoder enc;
+    char first[] = "ab cd";
+    char second[8];
+    char out[32];
+    size_t keep, tokens = 0;
+
+    scanner_seps_init(&seps, " ", 1);
+    scanner_encoder_init(&enc, first, sizeof(first) - 1);
+    enc.cursor.open = 1;
+    KUNIT_ASSERT_EQ(test, scanner_encode(&enc, &seps, SCANNER_MODE_BULK, out, sizeof(out), &tokens), (size_t)3);
+    KUNIT_EXPECT_EQ(test, memcmp(out, "ab\0", 3), 0);
+    KUNIT_EXPECT_EQ(test, scanner_encode(&enc, &seps, SCANNER_MODE_BULK, out, sizeof(out), &tokens), (size_t)0);
+
+    // The held-back "cd" is carried into the next document and joined up
+    keep = scanner_encoder_keep(&enc);
+    KUNIT_EXPECT_EQ(test, keep, (size_t)3);
+    memcpy(second, first + keep, 2);
+    memcpy(second + 2, "e f", 3);
+    scanner_encoder_rebase(&enc, second, 5);
+    KUNIT_ASSERT_EQ(test, scanner_encode(&enc, &seps, SCANNER_MODE_BULK, out, sizeof(out), &tokens), (size_t)4);
+    KUNIT_EXPECT_EQ(test, memcmp(out, "cde\0", 4), 0);
+
+    enc.cursor.open = 0;
+    KUNIT_ASSERT_EQ(test, scanner_encode(&enc, &seps, SCANNER_MODE_BULK, out, sizeof(out), &tokens), (size_t)2);
+    KUNIT_EXPECT_EQ(test, memcmp(out, "f\0", 2), 0);
+    KUNIT_EXPECT_EQ(test, tokens, (size_t)3);
+}
+
+// Micro-benchmark: ns/byte over 1 MB of tokens of each length for both
+// implementations, the best of a few alternating runs
+static void scanner_bench(struct kunit *test) {
+    static const size_t lengths[] = { 4, 6, 8, 12, 64 };
+    const size_t size = 1 << 20;
+    char *data = test_vmalloc(test, size);
+    int (*next[2])(const ScannerSeps *, ScannerCursor *, ScannerToken *) = { scanner_next, scanner_next_scalar };
+    const char *names[2] = { scanner_simd_name(), "table" };
+    ScannerSeps seps;
+    size_t i, l;
+    int impl, run;
+
+    KUNIT_ASSERT_NOT_NULL(test, data);
+    scanner_seps_init(&seps, SCANNER_DEFAULT_SEPARATORS, 6);
+    for (l = 0; l < ARRAY_SIZE(lengths); l++) {
+        u64 best[2] = { U64_MAX, U64_MAX }, tokens = 0;
+
+        for (i = 0; i < size; i++) {
+            data[i] = i % (lengths[l] + 1) == lengths[l] ? ' ' : 'a' + i % 26;
+        }
+        for (run = 0; run < 6; run++) {
+            ScannerCursor cursor;
+            ScannerToken token;
+            u64 start, ns;
+
+            impl = run % 2;
+            tokens = 0;
+            scanner_cursor_init(&cursor, data, size);
+            start = ktime_get_ns();
+            while (next[impl](&seps, &cursor, &token)) {
+                tokens++;
+            }
+            ns = ktime_get_ns() - start;
+            best[impl] = min(best[impl], ns);
+        }
+        for (impl = 0; impl < 2; impl++) {
+            kunit_info(test, "%s, %zu-byte tokens: %llu tokens, %llu.%03llu ns/byte\n", names[impl], lengths[l],
+                       tokens, best[impl] / size, best[impl] * 1000 / size % 1000);
+        }
+    }
+}
+
+static struct kunit_case scanner_core_cases[] = {
+    KUNIT_CASE(scanner_test_default_separators),
+    KUNIT_CASE(scanner_test_custom_separators),
+    KUNIT_CASE(scanner_test_empty_input),
+    KUNIT_CASE(scanner_test_separator_only),
+    KUNIT_CASE(scanner_test_block_boundaries),
+    KUNIT_CASE(scanner_test_token_larger_than_buffer),
+    KUNIT_CASE(scanner_test_embedded_nul),
+    KUNIT_CASE(scanner_test_high_bytes_and_large_sets),
+    KUNIT_CASE(scanner_test_randomized),
+    KUNIT_CASE(scanner_test_builtin_sets),
+    KUNIT_CASE(scanner_test_encode_modes),
+    KUNIT_CASE(scanner_test_encode_layout),
+    KUNIT_CASE(scanner_test_plan),
+    KUNIT_CASE(scanner_test_filter),
+    KUNIT_CASE(scanner_test_rules),
+    KUNIT_CASE(scanner_test_json),
+    KUNIT_CASE(scanner_test_kv),
+    KUNIT_CASE(scanner_test_sha256),
+    KUNIT_CASE(scanner_test_cdc),
+    KUNIT_CASE(scanner_test_fixed),
+    KUNIT_CASE(scanner_test_stream_append),
+    KUNIT_CASE(scanner_bench),
+    {}
+};
+
+static struct kunit_suite scanner_core_suite = {
+    .name = "scanner_core",
+    .test_cases = scanner_core_cases,
+};
+kunit_test_suite(scanner_core_suite);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("KUnit tests for the scanner tokenizer core");
@@ -0,0 +1,806 @@
+//
+// Differential correctness harness for every way of getting tokens out.
+//
+// Randomized inputs go through the table-driven reference, the vectorized
+// scan, the bulk, framed and index encoders with random read sizes, and a
+// streaming append split at random points. With -d they also go through the
+// device in each read mode, through index records resolved against an
+// mmap()ed document, through a stream of writes, through the input and output
+// rings, through batched ioctls, through a filter program in typed mode and
+// through lexer rules matching runs of non-separators, in the core and the
+// device. Every path must produce the reference
+// token stream byte for byte; on the first divergence the input is minimized
+// and printed, and the exit status is 1.
+//
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "NewScanner.h"
+#include "ScannerCore.h"
+#include "ScannerRules.h"
+
+// Inputs never contain NUL, which ends a token in bulk and token-mode reads.
+
+// Tokens as a sequence of 32-bit lengths each followed by the token's bytes
+typedef struct {
+    char *data;
+    size_t len, cap;
+} Stream;
+
+typedef struct {
+    const char *seps;       // NUL-terminated, so it can be handed to the device
+    const char *device;
+    uint64_t seed;          // Drives a path's read sizes and split points
+} Case;
+
+typedef int (*PathFn)(const Case *c, const char *input, size_t len, Stream *out);
+
+static void stream_put(Stream *s, const char *bytes, size_t n) {
+    if (s->len + n > s->cap) {
+        s->cap = (s->len + n) * 2;
+        s->data = realloc(s->data, s->cap);
+        if (!s->data) {
+            perror("Failed to allocate stream");
+            exit(EXIT_FAILURE);
+        }
+    }
+    memcpy(s->data + s->len, bytes, n);
+    s->len += n;
+}
+
+static void stream_token(Stream *s, const char *bytes, size_t n) {
+    uint32_t len = n;
+    stream_put(s, (const char *)&len, sizeof(len));
+    stream_put(s, bytes, n);
+}
+
+static uint64_t rng_next(uint64_t *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+// Reassembles bulk, framed or typed output across reads into whole tokens
+typedef struct {
+    Stream token;           // Bytes of the token in progress
+    uint32_t type;          // Type typed tokens must have, or 0 for their length
+    size_t mismatched;      // Typed tokens of any other type, and wrong digests
+} Joiner;
+
+static void join_bytes(Joiner *j, Stream *out, const char *bytes, size_t n, int last) {
+    stream_put(&j->token, bytes, n);
+    if (last) {
+        stream_token(out, j->token.data, j->token.len);
+        j->token.len = 0;
+    }
+}
+
+// Decode one read of mode-encoded output; index and digest records resolve
+// against doc
+static void decode(Joiner *j, Stream *out, int mode, const char *buf, size_t n, const char *doc) {
+    size_t i = 0;
+
+    while (i < n) {
+        if (mode == SCANNER_MODE_INDEX) {
+            ScannerSpan span;
+            memcpy(&span, buf + i, sizeof(span));
+            stream_token(out, doc + span.offset, span.len);
+            i += sizeof(span);
+        } else if (mode == SCANNER_MODE_DIGEST) {
+            ScannerDigest record;
+            uint8_t sha256[32];
+            memcpy(&record, buf + i, sizeof(record));
+            stream_token(out, doc + record.span.offset, record.span.len);
+            scanner_sha256(doc + record.span.offset, record.span.len, sha256);
+            j->mismatched += memcmp(sha256, record.sha256, sizeof(sha256)) != 0;
+            i += sizeof(record);
+        } else if (mode == SCANNER_MODE_FRAMED || mode == SCANNER_MODE_TYPED) {
+            uint32_t type = 0, word, len;
+            if (mode == SCANNER_MODE_TYPED) {
+                memcpy(&type, buf + i, sizeof(type));
+                i += sizeof(type);
+            }
+            memcpy(&word, buf + i, sizeof(word));
+            len = word & ~SCANNER_FRAME_MORE;
+            if (mode == SCANNER_MODE_TYPED && !(word & SCANNER_FRAME_MORE) &&
+                type != (j->type ? j->type : j->token.len + len)) {
+                j->mismatched++;
+            }
+            join_bytes(j, out, buf + i + sizeof(word), len, !(word & SCANNER_FRAME_MORE));
+            i += sizeof(word) + len;
+        } else {
+            const char *nul = memchr(buf + i, '\0', n - i);
+            size_t len = (nul ? (size_t)(nul - buf) : n) - i;
+            join_bytes(j, out, buf + i, len, nul != NULL);
+            i += len + (nul != NULL);
+        }
+    }
+}
+
+static size_t read_size(uint64_t *rng, int mode) {
+    return scanner_min_read(mode) + rng_next(rng) % 64;
+}
+
+// ---------------------------------------------------------------- core paths
+
+static int path_next(const Case *c, const char *input, size_t len, Stream *out,
+                     int (*next)(const ScannerSeps *, ScannerCursor *, ScannerToken *)) {
+    ScannerSeps seps;
+    ScannerCursor cursor;
+    ScannerToken token;
+
+    scanner_seps_init(&seps, c->seps, strlen(c->seps));
+    scanner_cursor_init(&cursor, input, len);
+    while (next(&seps, &cursor, &token)) {
+        stream_token(out, input + token.start, token.len);
+    }
+    return 0;
+}
+
+static int path_scalar(const Case *c, const char *input, size_t len, Stream *out) {
+    return path_next(c, input, len, out, scanner_next_scalar);
+}
+
+static int path_simd(const Case *c, const char *input, size_t len, Stream *out) {
+    return path_next(c, input, len, out, scanner_next);
+}
+
+static int path_encode(const Case *c, const char *input, size_t len, Stream *out, int mode) {
+    ScannerSeps seps;
+    ScannerEncoder enc;
+    Joiner j = { { 0 } };
+    char buf[128];
+    uint64_t rng = c->seed;
+    size_t n, tokens = 0;
+
+    scanner_seps_init(&seps, c->seps, strlen(c->seps));
+    scanner_encoder_init(&enc, input, len);
+    while ((n = scanner_encode(&enc, &seps, mode, buf, read_size(&rng, mode), &tokens)) > 0) {
+        decode(&j, out, mode, buf, n, input);
+    }
+    free(j.token.data);
+    return j.token.len || j.mismatched ? -1 : 0;
+}
+
+// Rules making the same tokens as the separators: runs of anything else, type 1
+static ScannerDfa *seps_rules(const Case *c, size_t *size) {
+    char pattern[4 * 256 + 8], err[128];
+    ScannerRule rule = { pattern, 1 };
+    size_t n = 0;
+
+    n += sprintf(pattern + n, *c->seps ? "[^" : "(.");
+    for (const char *p = c->seps; *p; p++) {
+        n += sprintf(pattern + n, "\\x%02x", (unsigned char)*p);
+    }
+    sprintf(pattern + n, *c->seps ? "]+" : ")+");
+    return scanner_rules_compile(&rule, 1, size, err, sizeof(err));
+}
+
+static int path_rules(const Case *c, const char *input, size_t len, Stream *out) {
+    ScannerSeps seps;
+    ScannerEncoder enc;
+    Joiner j = { .type = 1 };
+    char buf[128];
+    uint64_t rng = c->seed;
+    size_t n, size, tokens = 0;
+    ScannerDfa *dfa = seps_rules(c, &size);
+
+    if (!dfa) {
+        return -1;
+    }
+    scanner_seps_init(&seps, "", 0);
+    scanner_encoder_init(&enc, input, len);
+    enc.lexer = scanner_dfa_next;
+    enc.lexer_arg = dfa;
+    while ((n = scanner_encode(&enc, &seps, SCANNER_MODE_TYPED, buf, read_size(&rng, SCANNER_MODE_TYPED),
+                               &tokens)) > 0) {
+        decode(&j, out, SCANNER_MODE_TYPED, buf, n, input);
+    }
+    free(dfa);
+    free(j.token.data);
+    return j.token.len || j.mismatched ? -1 : 0;
+}
+
+static int path_bulk(const Case *c, const char *input, size_t len, Stream *out) {
+    return path_encode(c, input, len, out, SCANNER_MODE_BULK);
+}
+
+static int path_framed(const Case *c, const char *input, size_t len, Stream *out) {
+    return path_encode(c, input, len, out, SCANNER_MODE_FRAMED);
+}
+
+static int path_index(const Case *c, const char *input, size_t len, Stream *out) {
+    return path_encode(c, input, len, out, SCANNER_MODE_INDEX);
+}
+
+static int path_digest(const Case *c, const char *input, size_t len, Stream *out) {
+    return path_encode(c, input, len, out, SCANNER_MODE_DIGEST);
+}
+
+// Append the input in random pieces, draining framed output after each
+static int path_stream(const Case *c, const char *input, size_t len, Stream *out) {
+    ScannerSeps seps;
+    ScannerEncoder enc;
+    Joiner j = { { 0 } };
+    char *window = NULL;
+    char buf[128];
+    uint64_t rng = c->seed;
+    size_t pos = 0, n, tokens = 0;
+
+    scanner_seps_init(&seps, c->seps, strlen(c->seps));
+    scanner_encoder_init(&enc, NULL, 0);
+    enc.cursor.open = 1;
+    for (;;) {
+        size_t piece = pos < len ? 1 + rng_next(&rng) % (len - pos < 40 ? len - pos : 40) : 0;
+        size_t keep = scanner_encoder_keep(&enc);
+        size_t tail = enc.cursor.len - keep;
+        char *next = malloc(tail + piece + 1);
+
+        memcpy(next, enc.cursor.data + keep, tail);
+        memcpy(next + tail, input + pos, piece);
+        scanner_encoder_rebase(&enc, next, tail + piece);
+        free(window);
+        window = next;
+        pos += piece;
+        if (pos == len) {
+            enc.cursor.open = 0;
+        }
+        while ((n = scanner_encode(&enc, &seps, SCANNER_MODE_FRAMED, buf, read_size(&rng, SCANNER_MODE_FRAMED),
+                                   &tokens)) > 0) {
+            decode(&j, out, SCANNER_MODE_FRAMED, buf, n, window);
+        }
+        if (!enc.cursor.open) {
+            break;
+        }
+    }
+    free(window);
+    free(j.token.data);
+    return j.token.len ? -1 : 0;
+}
+
+// ---------------------------------------------------------------- device paths
+
+static int dev_open(const Case *c, int mode) {
+    int fd = open(c->device, O_RDWR);
+
+    if (fd < 0) {
+        return -1;
+    }
+    if (ioctl(fd, SCANNER_SET_SEPARATORS, c->seps) != 0 ||
+        (mode != SCANNER_MODE_TOKEN && ioctl(fd, SCANNER_SET_MODE, mode) != 0)) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Read until the end, or until EAGAIN when streaming
+static int dev_drain(int fd, int mode, Joiner *j, Stream *out, const char *doc, uint64_t *rng, size_t len) {
+    char buf[128];
+    char *big = NULL;
+    ssize_t n;
+
+    if (mode == SCANNER_MODE_TOKEN) {
+        // A buffer as large as the input so no token is truncated
+        big = malloc(len + 1);
+        while ((n = read(fd, big, len + 1)) > 0) {
+            stream_token(out, big, n);
+        }
+        free(big);
+    } else {
+        while ((n = read(fd, buf, read_size(rng, mode))) > 0) {
+            decode(j, out, mode, buf, n, doc);
+        }
+    }
+    return n < 0 && errno != EAGAIN ? -1 : 0;
+}
+
+static int path_device(const Case *c, const char *input, size_t len, Stream *out, int mode, int map) {
+    Joiner j = { { 0 } };
+    uint64_t rng = c->seed;
+    const char *doc = input;
+    void *mapped = MAP_FAILED;
+    int fd = dev_open(c, mode);
+    int err;
+
+    if (fd < 0 || write(fd, input, len) != (ssize_t)len) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    if (map && len + 1 >= SCANNER_MMAP_MIN) {
+        mapped = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+        if (mapped == MAP_FAILED) {
+            close(fd);
+            return -1;
+        }
+        doc = mapped;
+    }
+    err = dev_drain(fd, mode, &j, out, doc, &rng, len);
+    if (mapped != MAP_FAILED) {
+        munmap(mapped, len);
+    }
+    close(fd);
+    free(j.token.data);
+    return err || j.token.len || j.mismatched ? -1 : 0;
+}
+
+static int path_dev_token(const Case *c, const char *input, size_t len, Stream *out) {
+    return path_device(c, input, len, out, SCANNER_MODE_TOKEN, 0);
+}
+
+static int path_dev_bulk(const Case *c, const char *input, size_t len, Stream *out) {
+    return path_device(c, input, len, out, SCANNER_MODE_BULK, 0);
+}
+
+static int path_dev_framed(const Case *c, const char *input, size_t len, Stream *out) {
+    return path_device(c, input, len, out, SCANNER_MODE_FRAMED, 0);
+}
+
+static int path_dev_index(const Case *c, const char *input, size_t len, Stream *out) {
+    return path_device(c, input, len, out, SCANNER_MODE_INDEX, 0);
+}
+
+static int path_dev_digest(const Case *c, const char *input, size_t len, Stream *out) {
+    return path_device(c, input, len, out, SCANNER_MODE_DIGEST, 0);
+}
+
+static int path_dev_mmap(const Case *c, const char *input, size_t len, Stream *out) {
+    return path_device(c, input, len, out, SCANNER_MODE_INDEX, 1);
+}
+
+// Write the input in random pieces to a stream, draining framed reads after each
+static int path_dev_stream(const Case *c, const char *input, size_t len, Stream *out) {
+    Joiner j = { { 0 } };
+    uint64_t rng = c->seed;
+    size_t pos = 0;
+    int fd = dev_open(c, SCANNER_MODE_FRAMED);
+    // A stream continues the file's document, so start from an empty one
+    int err = fd < 0 || write(fd, input, 0) != 0 || ioctl(fd, SCANNER_SET_STREAM, 1) != 0;
+
+    while (!err && pos < len) {
+        size_t piece = 1 + rng_next(&rng) % (len - pos < 40 ? len - pos : 40);
+        err = write(fd, input + pos, piece) != (ssize_t)piece ||
+              dev_drain(fd, SCANNER_MODE_FRAMED, &j, out, NULL, &rng, len) != 0;
+        pos += piece;
+    }
+    if (!err) {
+        err = ioctl(fd, SCANNER_SET_STREAM, 0) != 0 || dev_drain(fd, SCANNER_MODE_FRAMED, &j, out, NULL, &rng, len);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    free(j.token.data);
+    return err || j.token.len ? -1 : 0;
+}
+
+// Produce the input into a mapped input ring in random pieces, sometimes
+// filling it, with a ring just big enough for the longest token so it wraps
+static int path_dev_ring(const Case *c, const char *input, size_t len, Stream *out) {
+    Joiner j = { { 0 } };
+    Stream tokens = { 0 };
+    uint64_t rng = c->seed;
+    size_t page = sysconf(_SC_PAGESIZE), size = page, longest = 0, pos = 0;
+    ScannerRingHeader *ring = MAP_FAILED;
+    int fd = dev_open(c, SCANNER_MODE_FRAMED);
+    int err;
+
+    path_scalar(c, input, len, &tokens);
+    for (size_t i = 0; i < tokens.len;) {
+        uint32_t n;
+        memcpy(&n, tokens.data + i, sizeof(n));
+        longest = n > longest ? n : longest;
+        i += sizeof(n) + n;
+    }
+    free(tokens.data);
+    while (size <= longest) {
+        size *= 2;
+    }
+
+    // Index records would point into the ring, so that mode is refused
+    err = fd < 0 || ioctl(fd, SCANNER_SET_INPUT_RING, size) != 0 ||
+          ioctl(fd, SCANNER_SET_MODE, SCANNER_MODE_INDEX) == 0 || errno != EINVAL;
+    if (!err) {
+        ring = mmap(NULL, page + size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, SCANNER_OFF_INPUT_RING);
+        err = ring == MAP_FAILED;
+    }
+    while (!err && pos < len) {
+        char *data = (char *)ring + ring->data;
+        uint32_t tail = ring->tail;
+        size_t room = size - (tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE));
+        size_t piece = 1 + rng_next(&rng) % (rng_next(&rng) % 4 ? 40 : room);
+        size_t at = tail % size, first;
+
+        piece = piece < room ? piece : room;
+        piece = piece < len - pos ? piece : len - pos;
+        if (piece == 0) {
+            err = 1;    // No room although every complete token has been read
+            break;
+        }
+        first = piece < size - at ? piece : size - at;
+        memcpy(data + at, input + pos, first);
+        memcpy(data, input + pos + first, piece - first);
+        __atomic_store_n(&ring->tail, tail + piece, __ATOMIC_RELEASE);
+        err = ioctl(fd, SCANNER_RING_DOORBELL) != 0 ||
+              dev_drain(fd, SCANNER_MODE_FRAMED, &j, out, NULL, &rng, len) != 0;
+        pos += piece;
+    }
+    if (!err) {
+        err = ioctl(fd, SCANNER_SET_STREAM, 0) != 0 || dev_drain(fd, SCANNER_MODE_FRAMED, &j, out, NULL, &rng, len);
+    }
+    if (ring != MAP_FAILED) {
+        munmap(ring, page + size);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    free(j.token.data);
+    return err || j.token.len ? -1 : 0;
+}
+
+// Consume records from a mapped output ring, polling whenever it runs dry
+static int path_output_ring(const Case *c, const char *input, size_t len, Stream *out, int mode) {
+    Joiner j = { { 0 } };
+    size_t page = sysconf(_SC_PAGESIZE), size = page;
+    ScannerRingHeader *ring = MAP_FAILED;
+    char *records = malloc(size);
+    int fd = dev_open(c, mode);
+    // Setting up the ring fills it from the document, so write that first
+    int err = fd < 0 || write(fd, input, len) != (ssize_t)len || ioctl(fd, SCANNER_SET_OUTPUT_RING, size) != 0;
+
+    if (!err) {
+        ring = mmap(NULL, page + size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, SCANNER_OFF_OUTPUT_RING);
+        err = ring == MAP_FAILED;
+    }
+    while (!err) {
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        uint32_t head = ring->head;
+        uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        size_t n = tail - head, at = head % size;
+        size_t first = n < size - at ? n : size - at;
+
+        if (n == 0) {
+            err = poll(&pfd, 1, 0) < 0;
+            if (!(pfd.revents & POLLIN)) {
+                break;  // Polling produced nothing more: every token is out
+            }
+            continue;
+        }
+        memcpy(records, (char *)ring + ring->data + at, first);
+        memcpy(records + first, (char *)ring + ring->data, n - first);
+        decode(&j, out, mode, records, n, input);
+        __atomic_store_n(&ring->head, tail, __ATOMIC_RELEASE);
+    }
+    if (ring != MAP_FAILED) {
+        munmap(ring, page + size);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    free(records);
+    free(j.token.data);
+    return err || j.token.len || j.mismatched ? -1 : 0;
+}
+
+static int path_dev_outring_bulk(const Case *c, const char *input, size_t len, Stream *out) {
+    return path_output_ring(c, input, len, out, SCANNER_MODE_BULK);
+}
+
+static int path_dev_outring_framed(const Case *c, const char *input, size_t len, Stream *out) {
+    return path_output_ring(c, input, len, out, SCANNER_MODE_FRAMED);
+}
+
+static int path_dev_outring_index(const Case *c, const char *input, size_t len, Stream *out) {
+    return path_output_ring(c, input, len, out, SCANNER_MODE_INDEX);
+}
+
+static int path_dev_outring_digest(const Case *c, const char *input, size_t len, Stream *out) {
+    return path_output_ring(c, input, len, out, SCANNER_MODE_DIGEST);
+}
+
+// Frames in a framed read, none of which may be beyond the op's token limit
+static size_t count_frames(const char *buf, size_t n) {
+    size_t frames = 0, i = 0;
+    uint32_t word;
+
+    while (i + sizeof(word) <= n) {
+        memcpy(&word, buf + i, sizeof(word));
+        i += sizeof(word) + (word & ~SCANNER_FRAME_MORE);
+        frames++;
+    }
+    return frames;
+}
+
+// Separators, the document and framed reads of a few tokens at a time, all
+// through SCANNER_BATCH
+static int path_dev_batch(const Case *c, const char *input, size_t len, Stream *out) {
+    enum { OPS = 16, BUF = 128 };
+    Joiner j = { { 0 } };
+    uint64_t rng = c->seed;
+    ScannerOp ops[OPS];
+    char bufs[OPS][BUF];
+    int fd = dev_open(c, SCANNER_MODE_FRAMED);
+    int first = 1, done = 0, err = fd < 0;
+
+    while (!err && !done) {
+        ScannerBatch batch = { .ops = (uintptr_t)ops, .count = OPS };
+        unsigned int i, n = 0;
+        long ran;
+
+        memset(ops, 0, sizeof(ops));
+        if (first) {
+            ops[n++] = (ScannerOp){ .op = SCANNER_OP_SET_SEPARATORS, .addr = (uintptr_t)c->seps };
+            ops[n++] = (ScannerOp){ .op = SCANNER_OP_WRITE, .addr = (uintptr_t)input, .len = len };
+            first = 0;
+        }
+        for (; n < OPS; n++) {
+            ops[n] = (ScannerOp){ .op = SCANNER_OP_READ, .max_tokens = rng_next(&rng) % 4,
+                                  .addr = (uintptr_t)bufs[n], .len = read_size(&rng, SCANNER_MODE_FRAMED) };
+        }
+        ran = ioctl(fd, SCANNER_BATCH, &batch);
+        err = ran != OPS;
+        for (i = 0; !err && i < OPS; i++) {
+            if (ops[i].op != SCANNER_OP_READ) {
+                err = ops[i].result != (ops[i].op == SCANNER_OP_WRITE ? (int64_t)len : 0);
+            } else if (ops[i].max_tokens && count_frames(bufs[i], ops[i].result) > ops[i].max_tokens) {
+                err = 1;
+            } else {
+                decode(&j, out, SCANNER_MODE_FRAMED, bufs[i], ops[i].result, input);
+                done |= ops[i].result == 0;
+            }
+        }
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    free(j.token.data);
+    return err || j.token.len ? -1 : 0;
+}
+
+// Typed reads through a filter program typing each token by its length,
+// which keeps them all
+static int path_dev_filter(const Case *c, const char *input, size_t len, Stream *out) {
+    struct sock_filter insns[] = {
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(ScannerFilterCtx, len)),
+        BPF_STMT(BPF_RET | BPF_A, 0),
+    };
+    struct sock_fprog prog = { .len = sizeof(insns) / sizeof(insns[0]), .filter = insns };
+    Joiner j = { { 0 } };
+    uint64_t rng = c->seed;
+    int fd = dev_open(c, SCANNER_MODE_TYPED);
+    int err = fd < 0 || ioctl(fd, SCANNER_SET_FILTER, &prog) != 0 || write(fd, input, len) != (ssize_t)len ||
+              dev_drain(fd, SCANNER_MODE_TYPED, &j, out, input, &rng, len) != 0;
+
+    if (fd >= 0) {
+        close(fd);
+    }
+    free(j.token.data);
+    return err || j.token.len || j.mismatched ? -1 : 0;
+}
+
+// Typed reads of tokens matched by seps_rules() in the device
+static int path_dev_rules(const Case *c, const char *input, size_t len, Stream *out) {
+    Joiner j = { .type = 1 };
+    uint64_t rng = c->seed;
+    size_t size;
+    ScannerDfa *dfa = seps_rules(c, &size);
+    ScannerRules rules = { .dfa = (uintptr_t)dfa, .size = size };
+    int fd = dfa ? dev_open(c, SCANNER_MODE_TYPED) : -1;
+    int err = fd < 0 || ioctl(fd, SCANNER_SET_RULES, &rules) != 0 || write(fd, input, len) != (ssize_t)len ||
+              dev_drain(fd, SCANNER_MODE_TYPED, &j, out, input, &rng, len) != 0;
+
+    if (fd >= 0) {
+        close(fd);
+    }
+    free(dfa);
+    free(j.token.data);
+    return err || j.token.len || j.mismatched ? -1 : 0;
+}
+
+static const struct {
+    const char *name;
+    PathFn run;
+    int device;
+} paths[] = {
+    { "scalar", path_scalar, 0 },   // The reference
+    { "simd", path_simd, 0 },
+    { "bulk", path_bulk, 0 },
+    { "framed", path_framed, 0 },
+    { "index", path_index, 0 },
+    { "digest", path_digest, 0 },
+    { "stream", path_stream, 0 },
+    { "rules", path_rules, 0 },
+    { "device:token", path_dev_token, 1 },
+    { "device:bulk", path_dev_bulk, 1 },
+    { "device:framed", path_dev_framed, 1 },
+    { "device:index", path_dev_index, 1 },
+    { "device:digest", path_dev_digest, 1 },
+    { "device:mmap", path_dev_mmap, 1 },
+    { "device:stream", path_dev_stream, 1 },
+    { "device:ring", path_dev_ring, 1 },
+    { "device:outring:bulk", path_dev_outring_bulk, 1 },
+    { "device:outring:framed", path_dev_outring_framed, 1 },
+    { "device:outring:index", path_dev_outring_index, 1 },
+    { "device:outring:digest", path_dev_outring_digest, 1 },
+    { "device:batch", path_dev_batch, 1 },
+    { "device:filter", path_dev_filter, 1 },
+    { "device:rules", path_dev_rules, 1 },
+};
+
+#define NPATHS (sizeof(paths) / sizeof(paths[0]))
+
+// ---------------------------------------------------------------- driver
+
+// Whether path p disagrees with the reference on input
+static int diverges(const Case *c, size_t p, const char *input, size_t len) {
+    Stream want = { 0 }, got = { 0 };
+    int bad;
+
+    path_scalar(c, input, len, &want);
+    bad = paths[p].run(c, input, len, &got) != 0 || got.len != want.len || memcmp(got.data, want.data, got.len);
+    free(want.data);
+    free(got.data);
+    return bad;
+}
+
+// Delta debugging: drop ever smaller chunks while the divergence persists
+static size_t minimize(const Case *c, size_t p, char *input, size_t len) {
+    char *trial = malloc(len + 1);
+
+    for (size_t chunk = len / 2; chunk >= 1; chunk /= 2) {
+        for (size_t i = 0; i + chunk <= len;) {
+            memcpy(trial, input, i);
+            memcpy(trial + i, input + i + chunk, len - i - chunk);
+            if (diverges(c, p, trial, len - chunk)) {
+                len -= chunk;
+                memcpy(input, trial, len);
+            } else {
+                i += chunk;
+            }
+        }
+    }
+    free(trial);
+    return len;
+}
+
+static void print_escaped(FILE *out, const char *s, size_t n) {
+    fputc('"', out);
+    for (size_t i = 0; i < n; i++) {
+        unsigned char ch = s[i];
+        if (ch == '"' || ch == '\\') {
+            fprintf(out, "\\%c", ch);
+        } else if (ch >= 32 && ch < 127) {
+            fputc(ch, out);
+        } else {
+            fprintf(out, "\\x%02x", ch);
+        }
+    }
+    fputc('"', out);
+}
+
+static void print_stream(FILE *out, const char *label, const Stream *s) {
+    size_t i = 0;
+
+    fprintf(out, "  %-9s", label);
+    while (i + 4 <= s->len) {
+        uint32_t len;
+        memcpy(&len, s->data + i, sizeof(len));
+        fputc(' ', out);
+        print_escaped(out, s->data + i + 4, len);
+        i += 4 + len;
+    }
+    fputc('\n', out);
+}
+
+static void report(const Case *c, size_t p, char *input, size_t len) {
+    Stream want = { 0 }, got = { 0 };
+    int err;
+
+    len = minimize(c, p, input, len);
+    path_scalar(c, input, len, &want);
+    err = paths[p].run(c, input, len, &got);
+
+    fprintf(stderr, "%s diverges from scalar (seed %llu)\n  separators ", paths[p].name,
+            (unsigned long long)c->seed);
+    print_escaped(stderr, c->seps, strlen(c->seps));
+    fprintf(stderr, "\n  input     ");
+    print_escaped(stderr, input, len);
+    fputc('\n', stderr);
+    print_stream(stderr, "expected", &want);
+    print_stream(stderr, err ? "failed" : "got", &got);
+    free(want.data);
+    free(got.data);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -n N           random inputs (default 20000)\n"
+            "  -x SEED        random seed (default 1)\n"
+            "  -m BYTES       longest input (default 300; one in 16 is up to 4 pages)\n"
+            "  -d DEVICE      also check the device paths, e.g. /dev/scanner_device\n",
+            prog);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+    // Builtin sets, custom ones and one too large for the vector paths
+    static const char *sets[] = {
+        SCANNER_DEFAULT_SEPARATORS, ",", "\t", "\n", " ", ",;", "\n\t ", "\x80\xff",
+        "0123456789abcdef",
+    };
+    uint64_t rng = 1;
+    size_t iterations = 20000, maxlen = 300;
+    size_t counts[NPATHS] = { 0 };
+    const char *device = NULL;
+    char *input, err[128] = "";
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:x:m:d:")) != -1) {
+        switch (opt) {
+            case 'n': iterations = strtoull(optarg, NULL, 0); break;
+            case 'x': rng = strtoull(optarg, NULL, 0); break;
+            case 'm': maxlen = strtoull(optarg, NULL, 0); break;
+            case 'd': device = optarg; break;
+            default: usage(argv[0]);
+        }
+    }
+    if (!rng || !maxlen) {
+        usage(argv[0]);
+    }
+    input = malloc(4 * SCANNER_MMAP_MIN > maxlen ? 4 * SCANNER_MMAP_MIN : maxlen);
+
+    // An empty rule set has no start state to match from, so it is refused
+    if (scanner_rules_compile(NULL, 0, &(size_t){ 0 }, err, sizeof(err)) || strcmp(err, "no rules") != 0) {
+        fprintf(stderr, "zero rules were not refused with \"no rules\"\n");
+        return EXIT_FAILURE;
+    }
+
+    for (size_t it = 0; it < iterations; it++) {
+        Case c = { .seps = sets[rng_next(&rng) % (sizeof(sets) / sizeof(sets[0]))], .device = device };
+        size_t nseps = strlen(c.seps);
+        size_t len = rng_next(&rng) % 16 ? rng_next(&rng) % (maxlen + 1) : rng_next(&rng) % (4 * SCANNER_MMAP_MIN);
+        uint64_t mean = 1 + rng_next(&rng) % 40;    // Token length scale for this input
+
+        c.seed = rng_next(&rng) | 1;
+        for (size_t i = 0; i < len; i++) {
+            uint64_t r = rng_next(&rng) % (mean + 1);
+            input[i] = r == 0 ? c.seps[rng_next(&rng) % nseps]
+                     : r == 1 ? (char)(1 + rng_next(&rng) % 255)    // High bytes, maybe separators
+                     : 'a' + rng_next(&rng) % 26;
+        }
+
+        for (size_t p = 1; p < NPATHS; p++) {
+            if (paths[p].device && !device) {
+                continue;
+            }
+            counts[p]++;
+            if (diverges(&c, p, input, len)) {
+                report(&c, p, input, len);
+                return EXIT_FAILURE;
+            }
+        }
+    }
+
+    printf("%zu inputs, every path matches scalar:", iterations);
+    for (size_t p = 1; p < NPATHS; p++) {
+        if (counts[p]) {
+            printf(" %s", paths[p].name);
+        }
+    }
+    printf("\n");
+    free(input);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,1672 @@
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/slab.h>
+#include <linux/fs.h>
+#include <linux/uaccess.h>
+#include <linux/cdev.h>
+#include <linux/kref.h>
+#include <linux/mutex.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/poll.h>
+#include <linux/wait.h>
+#include <linux/uio.h>
+#include <linux/io_uring/cmd.h>
+#include <linux/eventfd.h>
+#include <linux/hrtimer.h>
+#include <linux/filter.h>
+#include "NewScanner.h"
+#include "ScannerCore.h"
+
+#include <linux/ioctl.h>
+
+#ifndef DEVNAME
+#define DEVNAME "scanner_device"
+#endif
+#define CLASS_NAME "scanner_class"
+
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Scanner Driver");
+MODULE_AUTHOR("<abbiesarmento@u.boisestate.edu>");
+
+static unsigned int minors = 1;
+module_param(minors, uint, 0444);
+MODULE_PARM_DESC(minors, "Number of independent scanner minors (default 1)");
+
+// Writes of at least this many bytes are copied in with non-temporal stores
+// where the architecture has them, so a huge one-shot document does not evict
+// the cache of everything else on the host. Adjustable at run time through
+// /sys/module/NewScanner/parameters/nocache_min; 0 turns it off.
+static unsigned long nocache_min = 4UL << 20;
+module_param(nocache_min, ulong, 0644);
+MODULE_PARM_DESC(nocache_min, "Copy writes of at least this many bytes around the cache, 0 never (default 4 MB)");
+
+// Bytes copied in from user space per step while indexing a write, small
+// enough that the scan finds them still in L1
+#define SCANNER_FUSE_CHUNK (16 * 1024)
+
+// A written document. Readers hold a reference for as long as they scan it,
+// so a new write never frees data out from under another open file.
+typedef struct {
+    struct kref ref;
+    char *data;             // Data to be tokenized
+    size_t len;             // Length of data, which may contain NULs
+    bool mappable;          // data came from vmalloc_user and can be mmap()ed
+    ScannerSpan *index;     // Every token, built during the write in index mode, or NULL
+    size_t ntokens;         // Entries in index
+    ScannerSeps index_seps; // Separators the index was built with
+} ScannerDoc;
+
+// Per-minor state
+typedef struct {
+    struct mutex lock;      // Protects doc
+    ScannerDoc *doc;        // Most recently written document, or NULL
+} ScannerSlot;
+
+typedef struct {
+    dev_t devno;
+    struct cdev cdev;
+    ScannerSeps separators; // Default separators for new instances
+    ScannerSlot *slots;     // One per minor
+} ScannerDevice;
+
+static ScannerDevice scanner_device;
+
+// Shared-memory input or output ring. The vmalloc_user area holds the header
+// page and then the data, which the kernel also maps twice in a row at view,
+// so every window of up to size bytes is contiguous however it wraps.
+typedef struct {
+    struct kref ref;        // The file's, plus one per mapping
+    ScannerRingHeader *shared;
+    char *view;             // Data area, twice over
+    size_t size;
+    u32 head;               // Input: position of out.cursor.data[0]
+    u32 tail;               // Input: tail as of the last doorbell; output: the kernel's tail
+} ScannerRing;
+
+typedef struct {
+    struct mutex lock;      // Serializes threads sharing this open file
+    ScannerSlot *slot;      // Minor this file was opened on
+    ScannerDoc *doc;        // Document being read, or NULL
+    ScannerEncoder out;     // Position of the next token in the data
+    ScannerSeps separators; // Separators for this instance
+    int mode;               // SCANNER_MODE_* for reads
+    char *chunk;            // Staging page for index reads that scan, allocated on first use
+    ScannerRing *in_ring;   // Input ring, or NULL
+    ScannerRing *out_ring;  // Output ring, or NULL
+    wait_queue_head_t wait; // Pollers waiting for tokens
+    ScannerStats stats;
+    struct eventfd_ctx *event;  // Signalled along with pollers, or NULL
+    u32 batch_tokens;       // New tokens per notification, or 0
+    u32 batch_bytes;        // New bytes per notification, or 0
+    u64 batch_timeout;      // Nanoseconds a smaller batch may wait, or 0 to wait for more
+    ScannerWindow window;   // As last set by SCANNER_SET_WINDOW, back in force without an eventfd
+    size_t batch_pos;       // Where counting new tokens resumes, as an encoder offset
+    ScannerLexState batch_lex;  // The lexer's state at batch_pos
+    size_t batch_count;     // New tokens counted since the last notification
+    size_t batch_seen;      // New bytes since the last notification
+    bool batch_flushed;     // The timer notified readers of the batch so far
+    struct hrtimer batch_timer;
+    struct bpf_prog *filter;    // Run on each token before it is sent, or NULL
+    ScannerLexer lexer;     // Finds tokens in place of the separators, or NULL
+    void *lexer_arg;        // Its rules or settings, freed with the file
+} ScannerFile;
+
+// Take the file's lock, or with nowait fail with -EAGAIN instead of waiting
+static int scanner_lock(ScannerFile *scanner_file, bool nowait) {
+    if (nowait) {
+        return mutex_trylock(&scanner_file->lock) ? 0 : -EAGAIN;
+    }
+    return mutex_lock_interruptible(&scanner_file->lock) ? -ERESTARTSYS : 0;
+}
+
+#define SCANNER_FEATURES (SCANNER_FEATURE_MODE(SCANNER_MODE_TOKEN) | \
+                          SCANNER_FEATURE_MODE(SCANNER_MODE_BULK) | \
+                          SCANNER_FEATURE_MODE(SCANNER_MODE_FRAMED) | \
+                          SCANNER_FEATURE_MODE(SCANNER_MODE_INDEX) | \
+                          SCANNER_FEATURE_MODE(SCANNER_MODE_TYPED) | \
+                          SCANNER_FEATURE_MODE(SCANNER_MODE_DIGEST) | \
+                          SCANNER_FEATURE_MMAP | SCANNER_FEATURE_STREAM | \
+                          SCANNER_FEATURE_INPUT_RING | SCANNER_FEATURE_OUTPUT_RING | \
+                          SCANNER_FEATURE_BATCH | SCANNER_FEATURE_URING_CMD | SCANNER_FEATURE_EVENTFD | \
+                          SCANNER_FEATURE_WINDOW | SCANNER_FEATURE_FILTER | SCANNER_FEATURE_RULES | \
+                          SCANNER_FEATURE_JSON | SCANNER_FEATURE_PAIRS | SCANNER_FEATURE_CDC | \
+                          SCANNER_FEATURE_FIXED)
+
+static void scanner_doc_free(struct kref *ref) {
+    ScannerDoc *doc = container_of(ref, ScannerDoc, ref);
+    kvfree(doc->index);
+    kvfree(doc->data);
+    kfree(doc);
+}
+
+static void scanner_doc_put(ScannerDoc *doc) {
+    if (doc) {
+        kref_put(&doc->ref, scanner_doc_free);
+    }
+}
+
+// A document of len bytes plus a NUL, which the caller fills in
+static ScannerDoc *scanner_doc_alloc(size_t len) {
+    ScannerDoc *doc = kmalloc(sizeof(*doc), GFP_KERNEL);
+
+    if (!doc) {
+        printk(KERN_ERR "%s: kmalloc() failed for ScannerDoc\n", DEVNAME);
+        return NULL;
+    }
+    kref_init(&doc->ref);
+    doc->index = NULL;
+    doc->ntokens = 0;
+
+    // Allocate memory for the new data, plus one extra byte for the null terminator.
+    // Documents of a page or more come from vmalloc_user so they can be mapped.
+    doc->mappable = len + 1 >= SCANNER_MMAP_MIN;
+    doc->data = doc->mappable ? vmalloc_user(len + 1) : kmalloc(len + 1, GFP_KERNEL);
+    if (!doc->data) {
+        printk(KERN_ERR "%s: Unable to allocate memory for the data buffer\n", DEVNAME);
+        kfree(doc);
+        return NULL;
+    }
+
+    // Null-terminate the string; the length is kept so embedded NULs are data
+    doc->data[len] = '\0';
+    doc->len = len;
+    return doc;
+}
+
+// copy_from_iter, going around the cache for copies of nocache_min or more.
+// Returns the bytes that could not be copied.
+static size_t scanner_copy_in(char *dst, struct iov_iter *from, size_t n) {
+    unsigned long threshold = READ_ONCE(nocache_min);
+    size_t done = 0;
+
+    if (threshold && n >= threshold) {
+        // The uncached copy stops at a fault; an ordinary one finishes the job
+        done = copy_from_iter_nocache(dst, n, from);
+    }
+    return n - done - copy_from_iter(dst + done, n - done, from);
+}
+
+// Take a reference to the slot's current document
+static ScannerDoc *scanner_slot_get(ScannerSlot *slot) {
+    ScannerDoc *doc;
+
+    mutex_lock(&slot->lock);
+    doc = slot->doc;
+    if (doc) {
+        kref_get(&doc->ref);
+    }
+    mutex_unlock(&slot->lock);
+    return doc;
+}
+
+// Make doc the slot's current document, dropping the slot's old reference
+static void scanner_slot_publish(ScannerSlot *slot, ScannerDoc *doc) {
+    ScannerDoc *old;
+
+    kref_get(&doc->ref);
+    mutex_lock(&slot->lock);
+    old = slot->doc;
+    slot->doc = doc;
+    mutex_unlock(&slot->lock);
+    scanner_doc_put(old);
+}
+
+static void scanner_ring_free(struct kref *ref) {
+    ScannerRing *ring = container_of(ref, ScannerRing, ref);
+    vunmap(ring->view);
+    vfree(ring->shared);
+    kfree(ring);
+}
+
+static void scanner_ring_put(ScannerRing *ring) {
+    if (ring) {
+        kref_put(&ring->ref, scanner_ring_free);
+    }
+}
+
+// Index and digest records hold offsets into the document, while an input ring
+// moves the window they would point into on every read, so a file in either
+// mode cannot have one
+static bool scanner_mode_offsets(int mode) {
+    return mode == SCANNER_MODE_INDEX || mode == SCANNER_MODE_DIGEST;
+}
+
+static ScannerRing *scanner_ring_alloc(size_t size, bool output) {
+    size_t npages = size >> PAGE_SHIFT, i;
+    ScannerRing *ring = kzalloc(sizeof(*ring), GFP_KERNEL);
+    struct page **pages;
+
+    if (!ring) {
+        return NULL;
+    }
+    kref_init(&ring->ref);
+    ring->size = size;
+    ring->shared = vmalloc_user(PAGE_SIZE + size);
+    pages = kmalloc_array(2 * npages, sizeof(*pages), GFP_KERNEL);
+    if (!ring->shared || !pages) {
+        goto fail;
+    }
+    for (i = 0; i < npages; i++) {
+        pages[i] = pages[npages + i] = vmalloc_to_page((char *)ring->shared + PAGE_SIZE + (i << PAGE_SHIFT));
+    }
+    ring->view = vmap(pages, 2 * npages, VM_MAP, PAGE_KERNEL);
+    if (!ring->view) {
+        goto fail;
+    }
+    kfree(pages);
+    ring->shared->size = size;
+    ring->shared->data = PAGE_SIZE;
+    return ring;
+
+fail:
+    printk(KERN_ERR "%s: Unable to allocate a %zu byte %s ring\n", DEVNAME, size, output ? "output" : "input");
+    kfree(pages);
+    vfree(ring->shared);
+    kfree(ring);
+    return NULL;
+}
+
+// Encoder hook running the file's filter program on a token
+static uint32_t scanner_filter_run(void *arg, const char *data, const ScannerToken *token) {
+    ScannerFilterCtx ctx = { .len = min_t(size_t, token->len, U32_MAX) };
+
+    memcpy(ctx.head, data + token->start, min(token->len, sizeof(ctx.head)));
+    return bpf_prog_run_pin_on_cpu(arg, &ctx);
+}
+
+// Point the encoder at len bytes of data from their first token, keeping the
+// file's filter and lexer
+static void scanner_start(ScannerFile *scanner_file, const char *data, size_t len) {
+    scanner_encoder_init(&scanner_file->out, data, len);
+    if (scanner_file->filter) {
+        scanner_file->out.filter = scanner_filter_run;
+        scanner_file->out.filter_arg = scanner_file->filter;
+    }
+    scanner_file->out.lexer = scanner_file->lexer;
+    scanner_file->out.lexer_arg = scanner_file->lexer_arg;
+    scanner_file->batch_pos = 0;
+    scanner_file->batch_lex = scanner_file->out.lex;
+}
+
+// scanner_encoder_rebase, moving the event counting position along with the
+// encoder's offsets
+static void scanner_rebase(ScannerFile *scanner_file, const char *data, size_t len) {
+    size_t keep = scanner_encoder_keep(&scanner_file->out);
+
+    scanner_file->batch_pos = scanner_file->batch_pos > keep ? scanner_file->batch_pos - keep : 0;
+    scanner_encoder_rebase(&scanner_file->out, data, len);
+}
+
+// Let the producer reuse what the encoder no longer needs, and point the
+// encoder at the ring from there up to the tail
+static void scanner_ring_sync(ScannerFile *scanner_file) {
+    ScannerRing *ring = scanner_file->in_ring;
+
+    ring->head += scanner_encoder_keep(&scanner_file->out);
+    scanner_rebase(scanner_file, ring->view + (ring->head & (ring->size - 1)), ring->tail - ring->head);
+    smp_store_release(&ring->shared->head, ring->head);
+}
+
+// Encode as many records as the output ring has room for, then let the
+// producer of an input ring reuse what that consumed
+static void scanner_out_fill(ScannerFile *scanner_file) {
+    ScannerRing *ring = scanner_file->out_ring;
+    size_t n, tokens = 0;
+    u32 used;
+
+    if (!ring) {
+        return;
+    }
+    used = ring->tail - smp_load_acquire(&ring->shared->head);
+    if (used > ring->size) {
+        return;  // The consumer wrote a head ahead of the tail; overwrite nothing
+    }
+    n = scanner_encode(&scanner_file->out, &scanner_file->separators, scanner_file->mode,
+                       ring->view + (ring->tail & (ring->size - 1)), ring->size - used, &tokens);
+    if (n) {
+        ring->tail += n;
+        smp_store_release(&ring->shared->tail, ring->tail);
+        scanner_file->stats.tokens += tokens;
+    }
+    if (scanner_file->in_ring) {
+        scanner_ring_sync(scanner_file);
+    }
+}
+
+// Tell readers tokens are waiting: wake pollers and signal the eventfd
+static void scanner_notify(ScannerFile *scanner_file) {
+    wake_up_interruptible(&scanner_file->wait);
+    if (scanner_file->event) {
+        eventfd_signal(scanner_file->event);
+    }
+}
+
+// A batch smaller than the window has waited batch_timeout: notify now. The
+// counters belong to the file lock, so the next update resets them.
+static enum hrtimer_restart scanner_batch_expired(struct hrtimer *timer) {
+    ScannerFile *scanner_file = container_of(timer, ScannerFile, batch_timer);
+
+    WRITE_ONCE(scanner_file->batch_flushed, true);
+    scanner_notify(scanner_file);
+    return HRTIMER_NORESTART;
+}
+
+static void scanner_batch_reset(ScannerFile *scanner_file) {
+    scanner_file->batch_count = 0;
+    scanner_file->batch_seen = 0;
+    scanner_file->batch_flushed = false;
+}
+
+// Account for bytes of new input and decide whether readers hear about it
+// now: always without a window, and with one once it holds batch_tokens new
+// tokens or batch_bytes new bytes, or the input is complete. A smaller batch
+// waits for the timer instead. Tokens are only counted up to the threshold,
+// so a huge document is not scanned twice. Called with the file lock held.
+static bool scanner_batch_update(ScannerFile *scanner_file, size_t bytes) {
+    ScannerEncoder probe = scanner_file->out;
+    ScannerToken token;
+    u32 type;
+
+    if (!scanner_file->batch_tokens && !scanner_file->batch_bytes) {
+        return true;
+    }
+    if (READ_ONCE(scanner_file->batch_flushed)) {
+        scanner_batch_reset(scanner_file);
+    }
+    scanner_file->batch_seen += bytes;
+    if (scanner_file->batch_tokens) {
+        // Resume past the tokens already counted, in the lexer state they left
+        if (scanner_file->batch_pos > probe.cursor.pos) {
+            probe.cursor.pos = scanner_file->batch_pos;
+            probe.lex = scanner_file->batch_lex;
+        }
+        while (scanner_file->batch_count < scanner_file->batch_tokens &&
+               scanner_encoder_next(&probe, &scanner_file->separators, &token, &type)) {
+            scanner_file->batch_count++;
+        }
+        scanner_file->batch_pos = probe.cursor.pos;
+        scanner_file->batch_lex = probe.lex;
+    }
+
+    if ((scanner_file->batch_tokens && scanner_file->batch_count >= scanner_file->batch_tokens) ||
+        (scanner_file->batch_bytes && scanner_file->batch_seen >= scanner_file->batch_bytes) ||
+        !scanner_file->out.cursor.open) {
+        hrtimer_cancel(&scanner_file->batch_timer);
+        scanner_batch_reset(scanner_file);
+        return true;
+    }
+    // Start the clock once there is something to read
+    if ((scanner_file->batch_count || (!scanner_file->batch_tokens && scanner_file->batch_seen)) &&
+        scanner_file->batch_timeout && !hrtimer_active(&scanner_file->batch_timer)) {
+        hrtimer_start(&scanner_file->batch_timer, ns_to_ktime(scanner_file->batch_timeout), HRTIMER_MODE_REL);
+    }
+    return false;
+}
+
+// Start a new window; the tokens already waiting count as new
+static void scanner_batch_set(ScannerFile *scanner_file, u32 tokens, u32 bytes, u64 timeout) {
+    ScannerEncoder probe = scanner_file->out;
+    ScannerToken token;
+    u32 type;
+
+    hrtimer_cancel(&scanner_file->batch_timer);
+    scanner_file->batch_tokens = tokens;
+    scanner_file->batch_bytes = bytes;
+    scanner_file->batch_timeout = timeout;
+    scanner_file->batch_pos = 0;
+    scanner_file->batch_lex = scanner_file->out.lex;
+    scanner_batch_reset(scanner_file);
+    if (scanner_batch_update(scanner_file, 0) &&
+        (scanner_file->out.split || scanner_encoder_next(&probe, &scanner_file->separators, &token, &type))) {
+        scanner_notify(scanner_file);
+    }
+}
+
+static long scanner_set_window(ScannerFile *scanner_file, const ScannerWindow __user *arg) {
+    ScannerWindow req;
+
+    if (copy_from_user(&req, arg, sizeof(req))) {
+        return -EFAULT;
+    }
+    mutex_lock(&scanner_file->lock);
+    scanner_file->window = req;
+    scanner_batch_set(scanner_file, req.tokens, req.bytes, req.timeout_ns);
+    mutex_unlock(&scanner_file->lock);
+    return 0;
+}
+
+static long scanner_set_eventfd(ScannerFile *scanner_file, const ScannerEventfd __user *arg) {
+    ScannerEventfd req;
+    struct eventfd_ctx *event = NULL, *old;
+
+    if (copy_from_user(&req, arg, sizeof(req))) {
+        return -EFAULT;
+    }
+    if (req.fd >= 0) {
+        event = eventfd_ctx_fdget(req.fd);
+        if (IS_ERR(event)) {
+            return PTR_ERR(event);
+        }
+    }
+
+    mutex_lock(&scanner_file->lock);
+    hrtimer_cancel(&scanner_file->batch_timer);     // It may signal the old eventfd
+    old = scanner_file->event;
+    scanner_file->event = event;
+    if (event) {
+        scanner_batch_set(scanner_file, max_t(u32, req.tokens, 1), scanner_file->window.bytes, req.timeout_ns);
+    } else {
+        scanner_batch_set(scanner_file, scanner_file->window.tokens, scanner_file->window.bytes,
+                          scanner_file->window.timeout_ns);
+    }
+    mutex_unlock(&scanner_file->lock);
+
+    if (old) {
+        eventfd_ctx_put(old);
+    }
+    return 0;
+}
+
+// bytes of new input on this file, or the end of its stream: produce what
+// the output ring can take and notify readers once the batch window allows.
+// Called with the file lock held.
+static void scanner_input_arrived(ScannerFile *scanner_file, size_t bytes) {
+    bool ready = scanner_batch_update(scanner_file, bytes);
+
+    scanner_out_fill(scanner_file);
+    if (ready) {
+        scanner_notify(scanner_file);
+    }
+}
+
+static long scanner_ring_setup(ScannerFile *scanner_file, unsigned long size, bool output) {
+    ScannerRing *ring;
+    long err = 0;
+
+    if (size < PAGE_SIZE || size > SCANNER_RING_MAX || !is_power_of_2(size)) {
+        return -EINVAL;
+    }
+    ring = scanner_ring_alloc(size, output);
+    if (!ring) {
+        return -ENOMEM;
+    }
+
+    mutex_lock(&scanner_file->lock);
+    if (output ? scanner_file->out_ring != NULL : scanner_file->in_ring != NULL) {
+        err = -EBUSY;
+    } else if (output && scanner_file->mode == SCANNER_MODE_TOKEN) {
+        err = -EINVAL;  // Token mode has no record format
+    } else if (!output && scanner_mode_offsets(scanner_file->mode)) {
+        err = -EINVAL;
+    } else if (output) {
+        scanner_file->out_ring = ring;
+        scanner_out_fill(scanner_file);
+    } else {
+        scanner_file->in_ring = ring;
+        scanner_start(scanner_file, ring->view, 0);
+        scanner_file->out.cursor.open = 1;
+    }
+    mutex_unlock(&scanner_file->lock);
+    if (err) {
+        scanner_ring_put(ring);
+    }
+    return err;
+}
+
+static long scanner_ring_doorbell(ScannerFile *scanner_file) {
+    ScannerRing *ring;
+    u32 tail, bytes;
+    long err = 0;
+
+    mutex_lock(&scanner_file->lock);
+    ring = scanner_file->in_ring;
+    if (!ring) {
+        err = -EINVAL;
+        goto out;
+    }
+    // The tail may only move forward, and by no more than the free space
+    tail = smp_load_acquire(&ring->shared->tail);
+    if (tail - ring->head > ring->size || tail - ring->head < ring->tail - ring->head) {
+        err = -EINVAL;
+        goto out;
+    }
+    scanner_file->stats.writes++;
+    bytes = tail - ring->tail;
+    scanner_file->stats.bytes_written += bytes;
+    ring->tail = tail;
+    scanner_ring_sync(scanner_file);
+    scanner_input_arrived(scanner_file, bytes);
+out:
+    mutex_unlock(&scanner_file->lock);
+    return err;
+}
+
+static int scanner_open(struct inode *inode, struct file *filp) {
+    ScannerFile *scanner_file = kmalloc(sizeof(*scanner_file), GFP_KERNEL);
+    if (!scanner_file) {
+        printk(KERN_ERR "%s: kmalloc() failed for ScannerFile\n", DEVNAME);
+        return -ENOMEM;
+    }
+
+    // Start at the beginning of the minor's current data with the default separators
+    mutex_init(&scanner_file->lock);
+    scanner_file->slot = &scanner_device.slots[iminor(inode)];
+    scanner_file->doc = scanner_slot_get(scanner_file->slot);
+    scanner_file->filter = NULL;
+    scanner_file->lexer = NULL;
+    scanner_file->lexer_arg = NULL;
+    if (scanner_file->doc) {
+        scanner_start(scanner_file, scanner_file->doc->data, scanner_file->doc->len);
+    } else {
+        scanner_start(scanner_file, NULL, 0);
+    }
+    scanner_file->separators = scanner_device.separators;
+    scanner_file->mode = SCANNER_MODE_TOKEN;
+    scanner_file->chunk = NULL;
+    scanner_file->in_ring = NULL;
+    scanner_file->out_ring = NULL;
+    init_waitqueue_head(&scanner_file->wait);
+    memset(&scanner_file->stats, 0, sizeof(scanner_file->stats));
+    scanner_file->event = NULL;
+    scanner_file->batch_tokens = 0;
+    scanner_file->batch_bytes = 0;
+    scanner_file->batch_timeout = 0;
+    memset(&scanner_file->window, 0, sizeof(scanner_file->window));
+    scanner_batch_reset(scanner_file);
+    hrtimer_setup(&scanner_file->batch_timer, scanner_batch_expired, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+
+    filp->private_data = scanner_file;
+    return 0;
+}
+
+static int scanner_release(struct inode *inode, struct file *filp) {
+    ScannerFile *scanner_file = filp->private_data;
+    // Drop our document and free the memory allocated for the ScannerFile instance
+    hrtimer_cancel(&scanner_file->batch_timer);
+    if (scanner_file->event) {
+        eventfd_ctx_put(scanner_file->event);
+    }
+    if (scanner_file->filter) {
+        bpf_prog_destroy(scanner_file->filter);
+    }
+    kvfree(scanner_file->lexer_arg);
+    scanner_doc_put(scanner_file->doc);
+    mutex_destroy(&scanner_file->lock);
+    kfree(scanner_file->chunk);
+    scanner_ring_put(scanner_file->in_ring);
+    scanner_ring_put(scanner_file->out_ring);
+    kfree(scanner_file);
+    return 0;
+}
+
+// Index mode over a document indexed at write time: copy spans straight from
+// the index. Returns -ENOENT when the index does not apply and reads must
+// scan, as when a filter may drop tokens the index holds or a lexer finds
+// different ones.
+static ssize_t scanner_read_index(ScannerFile *scanner_file, struct iov_iter *to) {
+    ScannerDoc *doc = scanner_file->doc;
+    ScannerEncoder *out = &scanner_file->out;
+    size_t next = out->split ? out->rest.start : out->cursor.pos;
+    size_t lo = 0, hi, n;
+
+    if (!doc || !doc->index || out->cursor.data != doc->data || out->cursor.open || out->filter || out->lexer ||
+        memcmp(doc->index_seps.map, scanner_file->separators.map, sizeof(doc->index_seps.map)) != 0) {
+        return -ENOENT;
+    }
+
+    // First token at or after the encoder's position
+    hi = doc->ntokens;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (doc->index[mid].offset < next) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    n = min_t(size_t, iov_iter_count(to) / sizeof(ScannerSpan), doc->ntokens - lo);
+    scanner_file->stats.tokens += n;
+    if (n == 0) {
+        out->cursor.pos = out->cursor.len;
+        out->split = 0;
+        return 0;
+    }
+    if (copy_to_iter(doc->index + lo, n * sizeof(ScannerSpan), to) != n * sizeof(ScannerSpan)) {
+        return -EFAULT;
+    }
+    out->cursor.pos = doc->index[lo + n - 1].offset + doc->index[lo + n - 1].len;
+    out->split = 0;
+    return n * sizeof(ScannerSpan);
+}
+
+// Page for staging output that is not copied straight from the document
+static char *scanner_chunk(ScannerFile *scanner_file) {
+    if (!scanner_file->chunk) {
+        scanner_file->chunk = kmalloc(PAGE_SIZE, GFP_KERNEL);
+    }
+    return scanner_file->chunk;
+}
+
+// Bulk, framed and typed reads: plan a batch of pieces, then write all of them
+// inside one user access window rather than paying copy_to_user's checks and
+// STAC/CLAC for every few-byte token. Nothing but unsafe_ accessors runs
+// while the window is open. Each piece completes at most one token, so
+// stopping after max_tokens pieces stops after at most that many tokens.
+// Kernel-backed buffers, i.e. io_uring registered ones, are filled a page at
+// a time through the chunk page instead.
+static ssize_t scanner_read_pieces(ScannerFile *scanner_file, struct iov_iter *to, size_t max_tokens) {
+    ScannerPiece pieces[SCANNER_PLAN_BATCH];
+    const char *data = scanner_file->out.cursor.data;
+    bool typed = scanner_file->mode == SCANNER_MODE_TYPED;
+    bool framed = typed || scanner_file->mode == SCANNER_MODE_FRAMED;
+    bool direct = iter_is_ubuf(to);
+    size_t count = iov_iter_count(to);
+    size_t done = 0, npieces, want;
+
+    if (!direct && !scanner_chunk(scanner_file)) {
+        return -ENOMEM;
+    }
+
+    do {
+        size_t tokens = 0, i, n;
+        size_t cap = direct ? count - done : min_t(size_t, count - done, PAGE_SIZE);
+        char __user *dst;
+
+        want = min_t(size_t, ARRAY_SIZE(pieces), max_tokens);
+        n = scanner_plan(&scanner_file->out, &scanner_file->separators, scanner_file->mode,
+                         cap, pieces, want, &npieces, &tokens);
+        scanner_file->stats.tokens += tokens;
+        max_tokens -= npieces;
+        if (n == 0) {
+            break;
+        }
+        if (!direct) {
+            scanner_place(pieces, npieces, data, scanner_file->mode, scanner_file->chunk);
+            if (copy_to_iter(scanner_file->chunk, n, to) != n) {
+                return -EFAULT;
+            }
+            done += n;
+            continue;   // Until the buffer is full or the tokens run out
+        }
+        dst = iter_iov_addr(to);
+        if (!user_write_access_begin(dst, n)) {
+            return -EFAULT;
+        }
+        for (i = 0; i < npieces; i++) {
+            if (typed) {
+                unsafe_copy_to_user(dst, &pieces[i].type, sizeof(pieces[i].type), fault);
+                dst += sizeof(pieces[i].type);
+            }
+            if (framed) {
+                unsafe_copy_to_user(dst, &pieces[i].word, sizeof(pieces[i].word), fault);
+                dst += sizeof(pieces[i].word);
+            }
+            unsafe_copy_to_user(dst, data + pieces[i].start, pieces[i].len, fault);
+            dst += pieces[i].len;
+            if (pieces[i].nul) {
+                unsafe_put_user('\0', dst, fault);
+                dst++;
+            }
+        }
+        user_write_access_end();
+        iov_iter_advance(to, n);
+        done += n;
+    } while ((npieces == want || !direct) && max_tokens > 0 && done < count);
+    return done;
+
+fault:
+    user_write_access_end();
+    return -EFAULT;
+}
+
+// Index and digest reads that have to scan: encode a page of whole records
+// at a time, then copy it out
+static ssize_t scanner_read_encoded(ScannerFile *scanner_file, struct iov_iter *to) {
+    size_t record = scanner_min_read(scanner_file->mode);
+    size_t count = iov_iter_count(to);
+    size_t done = 0;
+
+    if (!scanner_chunk(scanner_file)) {
+        return -ENOMEM;
+    }
+
+    while (done < count) {
+        size_t cap = rounddown(min_t(size_t, count - done, PAGE_SIZE), record);
+        size_t tokens = 0;
+        size_t n = scanner_encode(&scanner_file->out, &scanner_file->separators, scanner_file->mode,
+                                  scanner_file->chunk, cap, &tokens);
+
+        scanner_file->stats.tokens += tokens;
+        if (n == 0) {
+            break;
+        }
+        if (copy_to_iter(scanner_file->chunk, n, to) != n) {
+            return -EFAULT;
+        }
+        done += n;
+        if (n < cap) {
+            break;  // Out of tokens
+        }
+    }
+    return done;
+}
+
+// Fill buf with as many tokens as fit in the file's multi-token mode, but no
+// more than max_tokens
+static ssize_t scanner_read_multi(ScannerFile *scanner_file, struct iov_iter *to, size_t max_tokens) {
+    size_t count = iov_iter_count(to);
+    ssize_t done;
+
+    if (count < scanner_min_read(scanner_file->mode)) {
+        return -EINVAL;  // Too small for a single record
+    }
+    if (scanner_file->mode == SCANNER_MODE_INDEX || scanner_file->mode == SCANNER_MODE_DIGEST) {
+        size_t record = scanner_min_read(scanner_file->mode);
+
+        if (max_tokens < count / record) {
+            iov_iter_truncate(to, max_tokens * record);  // Records are never split
+        }
+        done = scanner_file->mode == SCANNER_MODE_INDEX ? scanner_read_index(scanner_file, to) : -ENOENT;
+        if (done == -ENOENT) {
+            done = scanner_read_encoded(scanner_file, to);
+        }
+    } else {
+        done = scanner_read_pieces(scanner_file, to, max_tokens);
+    }
+    if (done == 0 && scanner_file->out.cursor.open) {
+        return -EAGAIN;  // Streaming: no complete token until more is written
+    }
+    return done;
+}
+
+// Token mode: one token per read, truncated to the buffer
+static ssize_t scanner_read_token(ScannerFile *scanner_file, struct iov_iter *to) {
+    ScannerToken token;
+    size_t token_len;
+    u32 type;
+
+    // Return 0 once only separators remain in the data
+    if (!scanner_encoder_next(&scanner_file->out, &scanner_file->separators, &token, &type)) {
+        return scanner_file->out.cursor.open ? -EAGAIN : 0;
+    }
+
+    // Calculate the length of the token to be read
+    token_len = min(token.len, iov_iter_count(to));
+
+    // Copy the token to user buffer
+    if (copy_to_iter(scanner_file->out.cursor.data + token.start, token_len, to) != token_len) {
+        return -EFAULT;  // Failed to copy data to user space
+    }
+    scanner_file->stats.tokens++;
+
+    // Return the number of bytes read
+    return token_len;
+}
+
+// A read of at most max_tokens tokens; token mode always reads one
+static ssize_t scanner_read_tokens(ScannerFile *scanner_file, struct iov_iter *to, size_t max_tokens, bool nowait) {
+    ssize_t ret = scanner_lock(scanner_file, nowait);
+
+    if (ret) {
+        return ret;
+    }
+
+    if (scanner_file->out_ring) {
+        ret = -EBUSY;  // Tokens go to the output ring
+    } else if (scanner_file->mode != SCANNER_MODE_TOKEN) {
+        ret = scanner_read_multi(scanner_file, to, max_tokens);
+    } else {
+        ret = scanner_read_token(scanner_file, to);
+    }
+    if (scanner_file->in_ring && ret > 0) {
+        scanner_ring_sync(scanner_file);  // Hand back the space those tokens took
+    }
+    if (ret >= 0) {
+        scanner_file->stats.reads++;
+    }
+
+    mutex_unlock(&scanner_file->lock);
+    return ret;
+}
+
+static ssize_t scanner_read(struct file *filp, char *buf, size_t count, loff_t *f_pos) {
+    struct iov_iter to;
+    int err = import_ubuf(ITER_DEST, buf, count, &to);
+
+    return err ? err : scanner_read_tokens(filp->private_data, &to, SIZE_MAX, false);
+}
+
+// Streaming: the file's next document is the part of the current one the
+// encoder still needs followed by buf, so a token cut by a write boundary is
+// joined up. Stream documents are private to the file.
+static ssize_t scanner_append(ScannerFile *scanner_file, struct iov_iter *from, size_t count) {
+    ScannerDoc *old = scanner_file->doc;
+    size_t keep = scanner_encoder_keep(&scanner_file->out);
+    size_t tail = scanner_file->out.cursor.len - keep;
+    ScannerDoc *doc = scanner_doc_alloc(tail + count);
+
+    if (!doc) {
+        return -ENOMEM;
+    }
+    if (tail) {
+        memcpy(doc->data, old->data + keep, tail);
+    }
+    if (scanner_copy_in(doc->data + tail, from, count)) {
+        scanner_doc_put(doc);
+        return -EFAULT;
+    }
+    scanner_rebase(scanner_file, doc->data, doc->len);
+    scanner_file->doc = doc;
+    scanner_doc_put(old);
+    return count;
+}
+
+// Room for at least need spans in doc->index; on failure the index is dropped
+static bool scanner_index_reserve(ScannerDoc *doc, size_t *cap, size_t need) {
+    ScannerSpan *grown;
+
+    if (need <= *cap) {
+        return true;
+    }
+    *cap = max(need, *cap * 2);
+    grown = kvmalloc_array(*cap, sizeof(*grown), GFP_KERNEL);
+    if (grown && doc->ntokens) {
+        memcpy(grown, doc->index, doc->ntokens * sizeof(*grown));
+    }
+    kvfree(doc->index);
+    doc->index = grown;
+    if (!grown) {
+        doc->ntokens = 0;
+    }
+    return grown != NULL;
+}
+
+// Copy buf into doc a chunk at a time, indexing each chunk while it is still
+// in cache, so the data is pulled through the cache once and index reads
+// start with every span ready. A token running into the end of a chunk is
+// picked up again once the next one is in. The chunks are wanted in cache, so
+// this never takes the nocache_min path.
+static int scanner_copy_indexed(ScannerDoc *doc, struct iov_iter *from, const ScannerSeps *seps) {
+    ScannerEncoder enc;
+    size_t copied = 0, cap = 0, tokens = 0;
+    bool indexing = doc->len <= U32_MAX;    // Span offsets are 32-bit
+
+    doc->index_seps = *seps;
+    scanner_encoder_init(&enc, doc->data, 0);
+    do {
+        size_t n = min_t(size_t, doc->len - copied, SCANNER_FUSE_CHUNK);
+
+        if (copy_from_iter(doc->data + copied, n, from) != n) {
+            return -EFAULT;
+        }
+        copied += n;
+        enc.cursor.len = copied;
+        enc.cursor.open = copied < doc->len;
+
+        while (indexing) {
+            size_t room;
+
+            if (!scanner_index_reserve(doc, &cap, doc->ntokens + SCANNER_FUSE_CHUNK / 64)) {
+                indexing = false;   // Reads will scan instead
+                break;
+            }
+            room = (cap - doc->ntokens) * sizeof(ScannerSpan);
+            n = scanner_encode(&enc, seps, SCANNER_MODE_INDEX, (char *)(doc->index + doc->ntokens), room, &tokens);
+            doc->ntokens += n / sizeof(ScannerSpan);
+            if (n < room) {
+                break;  // The rest of the chunk is indexed
+            }
+        }
+    } while (copied < doc->len);
+    return 0;
+}
+
+// Write a document, or append to the stream. With nowait only the wait for
+// the file's lock is avoided; the copy itself may still fault pages in.
+static ssize_t scanner_write_from(ScannerFile *scanner_file, struct iov_iter *from, bool nowait) {
+    size_t count = iov_iter_count(from);
+    ScannerDoc *doc;
+    ScannerSeps separators;
+    bool index;
+    int open;
+    int err = scanner_lock(scanner_file, nowait);
+
+    if (err) {
+        return err;
+    }
+    if (scanner_file->in_ring) {
+        mutex_unlock(&scanner_file->lock);
+        return -EBUSY;  // Input comes through the ring
+    }
+    if (scanner_file->out.cursor.open) {
+        ssize_t ret = scanner_append(scanner_file, from, count);
+        if (ret >= 0) {
+            scanner_file->stats.writes++;
+            scanner_file->stats.bytes_written += ret;
+            scanner_input_arrived(scanner_file, ret);
+        }
+        mutex_unlock(&scanner_file->lock);
+        return ret;
+    }
+    index = scanner_file->mode == SCANNER_MODE_INDEX;
+    separators = scanner_file->separators;
+    mutex_unlock(&scanner_file->lock);
+
+    doc = scanner_doc_alloc(count);
+    if (!doc) {
+        return -ENOMEM;
+    }
+
+    // Copy the data from user space; scanner_copy_in returns the number of bytes that could not be copied
+    if (index ? scanner_copy_indexed(doc, from, &separators) : (scanner_copy_in(doc->data, from, count) ? -EFAULT : 0)) {
+        printk(KERN_ERR "%s: Failed to copy data from user space\n", DEVNAME);
+        scanner_doc_put(doc);
+        return -EFAULT;
+    }
+
+    // Publish it for new opens of this minor; files already open keep
+    // reading the document they have until they write one of their own
+    scanner_slot_publish(scanner_file->slot, doc);
+
+    mutex_lock(&scanner_file->lock);
+    if (scanner_file->in_ring) {
+        // An input ring set up since the check above owns the encoder now
+        mutex_unlock(&scanner_file->lock);
+        scanner_doc_put(doc);
+        return -EBUSY;
+    }
+    scanner_doc_put(scanner_file->doc);
+    scanner_file->doc = doc;
+    open = scanner_file->out.cursor.open;   // A stream started since the check above
+    scanner_start(scanner_file, doc->data, count);
+    scanner_file->out.cursor.open = open;
+    scanner_file->stats.writes++;
+    scanner_file->stats.bytes_written += count;
+    scanner_input_arrived(scanner_file, count);
+    mutex_unlock(&scanner_file->lock);
+
+    // Return the number of bytes written
+    return count;
+}
+
+static ssize_t scanner_write(struct file *filp, const char *buf, size_t count, loff_t *f_pos) {
+    struct iov_iter from;
+    int err = import_ubuf(ITER_SOURCE, (char __user *)buf, count, &from);
+
+    return err ? err : scanner_write_from(filp->private_data, &from, false);
+}
+
+// arg points to a NUL-terminated string of separator characters
+static long scanner_set_separators(ScannerFile *scanner_file, const char __user *arg, bool nowait) {
+    char new_separators[SCANNER_MAX_SEPARATORS + 1];
+    long len, err;
+
+    len = strncpy_from_user(new_separators, arg, sizeof(new_separators));
+    if (len < 0) {
+        return -EFAULT;
+    }
+    if (len == sizeof(new_separators)) {
+        return -EINVAL;  // Longer than any set of distinct byte values
+    }
+
+    err = scanner_lock(scanner_file, nowait);
+    if (err) {
+        return err;
+    }
+    scanner_seps_init(&scanner_file->separators, new_separators, len);
+    mutex_unlock(&scanner_file->lock);
+    pr_debug("%s: separators updated\n", DEVNAME);
+    return 0;
+}
+
+// Filter programs see a ScannerFilterCtx as their packet. Only whole, aligned
+// words of it may be loaded, and those loads are rewritten to read the
+// context directly, as seccomp does with its struct seccomp_data.
+static int scanner_filter_check(struct sock_filter *filter, unsigned int flen) {
+    unsigned int i;
+
+    for (i = 0; i < flen; i++) {
+        struct sock_filter *insn = &filter[i];
+
+        switch (insn->code) {
+            case BPF_LD | BPF_W | BPF_ABS:
+                if (insn->k >= sizeof(ScannerFilterCtx) || insn->k % sizeof(__u32)) {
+                    return -EINVAL;
+                }
+                insn->code = BPF_LDX | BPF_W | BPF_ABS;
+                break;
+            case BPF_LD | BPF_W | BPF_LEN:
+                insn->code = BPF_LD | BPF_IMM;
+                insn->k = sizeof(ScannerFilterCtx);
+                break;
+            case BPF_RET | BPF_K:
+            case BPF_RET | BPF_A:
+            case BPF_ALU | BPF_ADD | BPF_K:
+            case BPF_ALU | BPF_ADD | BPF_X:
+            case BPF_ALU | BPF_SUB | BPF_K:
+            case BPF_ALU | BPF_SUB | BPF_X:
+            case BPF_ALU | BPF_MUL | BPF_K:
+            case BPF_ALU | BPF_MUL | BPF_X:
+            case BPF_ALU | BPF_DIV | BPF_K:
+            case BPF_ALU | BPF_DIV | BPF_X:
+            case BPF_ALU | BPF_AND | BPF_K:
+            case BPF_ALU | BPF_AND | BPF_X:
+            case BPF_ALU | BPF_OR | BPF_K:
+            case BPF_ALU | BPF_OR | BPF_X:
+            case BPF_ALU | BPF_XOR | BPF_K:
+            case BPF_ALU | BPF_XOR | BPF_X:
+            case BPF_ALU | BPF_LSH | BPF_K:
+            case BPF_ALU | BPF_LSH | BPF_X:
+            case BPF_ALU | BPF_RSH | BPF_K:
+            case BPF_ALU | BPF_RSH | BPF_X:
+            case BPF_ALU | BPF_NEG:
+            case BPF_LD | BPF_IMM:
+            case BPF_LDX | BPF_IMM:
+            case BPF_MISC | BPF_TAX:
+            case BPF_MISC | BPF_TXA:
+            case BPF_LD | BPF_MEM:
+            case BPF_LDX | BPF_MEM:
+            case BPF_ST:
+            case BPF_STX:
+            case BPF_JMP | BPF_JA:
+            case BPF_JMP | BPF_JEQ | BPF_K:
+            case BPF_JMP | BPF_JEQ | BPF_X:
+            case BPF_JMP | BPF_JGE | BPF_K:
+            case BPF_JMP | BPF_JGE | BPF_X:
+            case BPF_JMP | BPF_JGT | BPF_K:
+            case BPF_JMP | BPF_JGT | BPF_X:
+            case BPF_JMP | BPF_JSET | BPF_K:
+            case BPF_JMP | BPF_JSET | BPF_X:
+                break;
+            default:
+                return -EINVAL;
+        }
+    }
+    return 0;
+}
+
+// Attach a classic BPF program run on every token this file reads from now
+// on, or with an empty program detach it. A token split across reads keeps
+// the type it was given.
+static long scanner_set_filter(ScannerFile *scanner_file, const struct sock_fprog __user *arg) {
+    struct sock_fprog fprog;
+    struct bpf_prog *prog = NULL, *old;
+    int err;
+
+    if (copy_from_user(&fprog, arg, sizeof(fprog))) {
+        return -EFAULT;
+    }
+    if (fprog.len) {
+        err = bpf_prog_create_from_user(&prog, &fprog, scanner_filter_check, false);
+        if (err) {
+            return err;
+        }
+    }
+
+    mutex_lock(&scanner_file->lock);
+    old = scanner_file->filter;
+    scanner_file->filter = prog;
+    scanner_file->out.filter = prog ? scanner_filter_run : NULL;
+    scanner_file->out.filter_arg = prog;
+    mutex_unlock(&scanner_file->lock);
+
+    if (old) {
+        bpf_prog_destroy(old);
+    }
+    return 0;
+}
+
+// Find tokens from the encoder's position on with lexer, or with NULL the
+// separators. The file takes arg, lexer's rules or settings, and frees it.
+static void scanner_use_lexer(ScannerFile *scanner_file, ScannerLexer lexer, void *arg) {
+    void *old;
+
+    mutex_lock(&scanner_file->lock);
+    old = scanner_file->lexer_arg;
+    scanner_file->lexer = lexer;
+    scanner_file->lexer_arg = arg;
+    scanner_file->out.lexer = lexer;
+    scanner_file->out.lexer_arg = arg;
+    memset(&scanner_file->out.lex, 0, sizeof(scanner_file->out.lex));
+    // Tokens counted past the encoder were the old lexer's; count them again
+    scanner_file->batch_pos = 0;
+    scanner_file->batch_lex = scanner_file->out.lex;
+    mutex_unlock(&scanner_file->lock);
+
+    kvfree(old);
+}
+
+// Match tokens with a validated copy of the caller's compiled rules, or with
+// size 0 go back to the separators
+static long scanner_set_rules(ScannerFile *scanner_file, const ScannerRules __user *arg) {
+    ScannerRules req;
+    ScannerDfa *rules = NULL;
+
+    if (copy_from_user(&req, arg, sizeof(req))) {
+        return -EFAULT;
+    }
+    if (req.flags || req.size > scanner_dfa_size(SCANNER_DFA_MAX_STATES, 256)) {
+        return -EINVAL;
+    }
+    if (req.size) {
+        rules = kvmalloc(req.size, GFP_KERNEL);
+        if (!rules) {
+            return -ENOMEM;
+        }
+        if (copy_from_user(rules, u64_to_user_ptr(req.dfa), req.size)) {
+            kvfree(rules);
+            return -EFAULT;
+        }
+        if (!scanner_dfa_check(rules, req.size)) {
+            kvfree(rules);
+            return -EINVAL;
+        }
+    }
+
+    scanner_use_lexer(scanner_file, rules ? scanner_dfa_next : NULL, rules);
+    return 0;
+}
+
+static long scanner_set_json(ScannerFile *scanner_file, unsigned long on) {
+    scanner_use_lexer(scanner_file, on ? scanner_json_next : NULL, NULL);
+    return 0;
+}
+
+// Split key=value pairs with the caller's delimiters, interning a copy of
+// their key names, or with no assignment delimiters go back to the separators
+static long scanner_set_pairs(ScannerFile *scanner_file, const ScannerPairs __user *arg) {
+    ScannerPairs req;
+    ScannerKv *kv;
+    char *names = NULL;
+    u32 nkeys = 0;
+    size_t i;
+
+    if (copy_from_user(&req, arg, sizeof(req))) {
+        return -EFAULT;
+    }
+    if (!req.assign[0]) {
+        scanner_use_lexer(scanner_file, NULL, NULL);
+        return 0;
+    }
+    if (!memchr(req.pairs, 0, sizeof(req.pairs)) || !memchr(req.assign, 0, sizeof(req.assign)) ||
+        req.quote > 0xff || req.keys_size > SCANNER_KV_MAX_NAMES) {
+        return -EINVAL;
+    }
+    if (req.keys_size) {
+        names = memdup_user(u64_to_user_ptr(req.keys), req.keys_size);
+        if (IS_ERR(names)) {
+            return PTR_ERR(names);
+        }
+        for (i = 0; i < req.keys_size; i++) {
+            nkeys += !names[i];
+        }
+    }
+
+    kv = kvmalloc(scanner_kv_size(nkeys, req.keys_size), GFP_KERNEL);
+    if (!kv) {
+        kfree(names);
+        return -ENOMEM;
+    }
+    if (!scanner_kv_init(kv, req.pairs, req.assign, req.quote, names, nkeys, req.keys_size)) {
+        kfree(names);
+        kvfree(kv);
+        return -EINVAL;
+    }
+    kfree(names);
+
+    scanner_use_lexer(scanner_file, scanner_kv_next, kv);
+    return 0;
+}
+
+// Cut content-defined chunks of the caller's sizes, or with avg 0 go back to
+// the separators
+static long scanner_set_cdc(ScannerFile *scanner_file, const ScannerChunking __user *arg) {
+    ScannerChunking req;
+    ScannerCdc *cdc;
+
+    if (copy_from_user(&req, arg, sizeof(req))) {
+        return -EFAULT;
+    }
+    if (req.flags) {
+        return -EINVAL;
+    }
+    if (!req.avg) {
+        scanner_use_lexer(scanner_file, NULL, NULL);
+        return 0;
+    }
+
+    cdc = kvmalloc(sizeof(*cdc), GFP_KERNEL);
+    if (!cdc) {
+        return -ENOMEM;
+    }
+    if (!scanner_cdc_init(cdc, req.min, req.avg, req.max)) {
+        kvfree(cdc);
+        return -EINVAL;
+    }
+
+    scanner_use_lexer(scanner_file, scanner_cdc_next, cdc);
+    return 0;
+}
+
+// Split records into fields of the caller's widths, or with no columns go
+// back to the separators
+static long scanner_set_fixed(ScannerFile *scanner_file, const ScannerColumns __user *arg) {
+    ScannerColumns req;
+    u32 widths[SCANNER_FIXED_MAX_COLUMNS];
+    ScannerFixed *fixed;
+    const char *end;
+
+    if (copy_from_user(&req, arg, sizeof(req))) {
+        return -EFAULT;
+    }
+    if (!req.ncolumns) {
+        scanner_use_lexer(scanner_file, NULL, NULL);
+        return 0;
+    }
+    end = memchr(req.pad, 0, sizeof(req.pad));
+    if (!end || req.ncolumns > SCANNER_FIXED_MAX_COLUMNS) {
+        return -EINVAL;
+    }
+    if (copy_from_user(widths, u64_to_user_ptr(req.widths), req.ncolumns * sizeof(widths[0]))) {
+        return -EFAULT;
+    }
+
+    fixed = kvmalloc(sizeof(*fixed), GFP_KERNEL);
+    if (!fixed) {
+        return -ENOMEM;
+    }
+    if (!scanner_fixed_init(fixed, widths, req.ncolumns, req.pad, end - req.pad, req.flags)) {
+        kvfree(fixed);
+        return -EINVAL;
+    }
+
+    scanner_use_lexer(scanner_file, scanner_fixed_next, fixed);
+    return 0;
+}
+
+static long scanner_set_mode(ScannerFile *scanner_file, unsigned long mode, bool nowait) {
+    long err;
+
+    if (mode >= SCANNER_MODES) {
+        return -EINVAL;
+    }
+    // Keep the cursor; the unsent part of a split token is dropped
+    err = scanner_lock(scanner_file, nowait);
+    if (err) {
+        return err;
+    }
+    if ((scanner_file->out_ring && mode == SCANNER_MODE_TOKEN) ||
+        (scanner_file->in_ring && scanner_mode_offsets(mode))) {
+        mutex_unlock(&scanner_file->lock);
+        return -EINVAL;  // No records for the output ring, or none an input ring keeps valid
+    }
+    scanner_file->mode = mode;
+    scanner_file->out.split = 0;
+    mutex_unlock(&scanner_file->lock);
+    return 0;
+}
+
+static long scanner_get_stats(ScannerFile *scanner_file, ScannerStats __user *arg, bool nowait) {
+    ScannerStats stats;
+    long err = scanner_lock(scanner_file, nowait);
+
+    if (err) {
+        return err;
+    }
+    stats = scanner_file->stats;
+    mutex_unlock(&scanner_file->lock);
+    return copy_to_user(arg, &stats, sizeof(stats)) ? -EFAULT : 0;
+}
+
+// Run one operation of a batch or an io_uring command through the same path
+// as its own syscall, so either behaves exactly like that sequence of calls.
+// Reads and writes go through iter, which the caller has set up over the
+// op's buffer.
+static s64 scanner_run_op(ScannerFile *scanner_file, const ScannerOp *op, struct iov_iter *iter, bool nowait) {
+    void __user *addr = u64_to_user_ptr(op->addr);
+
+    switch (op->op) {
+        case SCANNER_OP_SET_SEPARATORS:
+            return scanner_set_separators(scanner_file, addr, nowait);
+        case SCANNER_OP_WRITE:
+            return scanner_write_from(scanner_file, iter, nowait);
+        case SCANNER_OP_READ:
+            return scanner_read_tokens(scanner_file, iter, op->max_tokens ? op->max_tokens : SIZE_MAX, nowait);
+        case SCANNER_OP_GET_STATS:
+            return scanner_get_stats(scanner_file, addr, nowait);
+        case SCANNER_OP_SET_MODE:
+            return scanner_set_mode(scanner_file, op->len, nowait);
+        default:
+            return -EINVAL;
+    }
+}
+
+static bool scanner_op_has_buffer(const ScannerOp *op) {
+    return op->op == SCANNER_OP_WRITE || op->op == SCANNER_OP_READ;
+}
+
+static long scanner_batch(ScannerFile *scanner_file, const ScannerBatch __user *arg) {
+    ScannerBatch batch;
+    ScannerOp __user *ops;
+    ScannerOp op;
+    u32 i;
+
+    if (copy_from_user(&batch, arg, sizeof(batch))) {
+        return -EFAULT;
+    }
+    if (batch.flags || batch.count > SCANNER_BATCH_MAX) {
+        return -EINVAL;
+    }
+
+    ops = u64_to_user_ptr(batch.ops);
+    for (i = 0; i < batch.count; i++) {
+        struct iov_iter iter;
+
+        if (copy_from_user(&op, &ops[i], sizeof(op))) {
+            return i ? i : -EFAULT;
+        }
+        op.result = 0;
+        if (scanner_op_has_buffer(&op)) {
+            op.result = import_ubuf(op.op == SCANNER_OP_WRITE ? ITER_SOURCE : ITER_DEST, u64_to_user_ptr(op.addr),
+                                    min_t(u64, op.len, MAX_RW_COUNT), &iter);
+        }
+        if (op.result == 0) {
+            op.result = scanner_run_op(scanner_file, &op, &iter, false);
+        }
+        if (put_user(op.result, &ops[i].result)) {
+            return i ? i : -EFAULT;
+        }
+        if (op.result < 0) {
+            return i + 1;
+        }
+        if (fatal_signal_pending(current)) {
+            return i + 1;
+        }
+    }
+    return i;
+}
+
+// io_uring passthrough: cmd_op is a SCANNER_OP_*, the SQE carries a
+// ScannerUringCmd, and the completion gets the op's result. io_uring first
+// issues a command inline with IO_URING_F_NONBLOCK; one that would wait for
+// the file's lock then fails with -EAGAIN and is reissued from a worker, so
+// a busy session never stalls the submitting loop.
+static int scanner_uring_cmd(struct io_uring_cmd *ioucmd, unsigned int issue_flags) {
+    ScannerFile *scanner_file = ioucmd->file->private_data;
+    const ScannerUringCmd *cmd = io_uring_sqe_cmd(ioucmd->sqe);
+    bool fixed = READ_ONCE(ioucmd->sqe->uring_cmd_flags) & IORING_URING_CMD_FIXED;
+    struct iov_iter iter;
+    ScannerOp op = {
+        .op = ioucmd->cmd_op,
+        .max_tokens = READ_ONCE(cmd->max_tokens),
+        .addr = READ_ONCE(cmd->addr),
+        .len = min_t(u32, READ_ONCE(cmd->len), MAX_RW_COUNT),
+    };
+
+    if (scanner_op_has_buffer(&op)) {
+        int rw = op.op == SCANNER_OP_WRITE ? ITER_SOURCE : ITER_DEST;
+        int err = fixed ? io_uring_cmd_import_fixed(op.addr, op.len, rw, &iter, ioucmd, issue_flags)
+                        : import_ubuf(rw, u64_to_user_ptr(op.addr), op.len, &iter);
+        if (err) {
+            return err;
+        }
+    } else if (fixed) {
+        return -EINVAL;
+    }
+    return scanner_run_op(scanner_file, &op, &iter, issue_flags & IO_URING_F_NONBLOCK);
+}
+
+static long scanner_ioctl(struct file *filp, unsigned int cmd, unsigned long arg) {
+    ScannerFile *scanner_file = filp->private_data;
+
+    // Verify that cmd is for our device and the command number is within our range
+    if (_IOC_TYPE(cmd) != SCANNER_MAGIC) return -ENOTTY;
+    if (_IOC_NR(cmd) > SCANNER_IOC_MAXNR) return -ENOTTY;
+
+    switch (cmd) {
+        case SCANNER_SET_SEPARATORS:
+            return scanner_set_separators(scanner_file, (const char __user *)arg, false);
+
+        case SCANNER_GET_STATS:
+            return scanner_get_stats(scanner_file, (ScannerStats __user *)arg, false);
+
+        case SCANNER_BATCH:
+            return scanner_batch(scanner_file, (const ScannerBatch __user *)arg);
+
+        case SCANNER_GET_FEATURES:
+            return put_user((__u32)SCANNER_FEATURES, (__u32 __user *)arg);
+
+        case SCANNER_SET_MODE:
+            return scanner_set_mode(scanner_file, arg, false);
+
+        case SCANNER_SET_STREAM:
+            // Ending the stream releases a final token that ran into the end of the data
+            mutex_lock(&scanner_file->lock);
+            scanner_file->out.cursor.open = arg != 0;
+            scanner_input_arrived(scanner_file, 0);
+            mutex_unlock(&scanner_file->lock);
+            return 0;
+
+        case SCANNER_SET_INPUT_RING:
+            return scanner_ring_setup(scanner_file, arg, false);
+
+        case SCANNER_SET_OUTPUT_RING:
+            return scanner_ring_setup(scanner_file, arg, true);
+
+        case SCANNER_RING_DOORBELL:
+            return scanner_ring_doorbell(scanner_file);
+
+        case SCANNER_SET_EVENTFD:
+            return scanner_set_eventfd(scanner_file, (const ScannerEventfd __user *)arg);
+
+        case SCANNER_SET_WINDOW:
+            return scanner_set_window(scanner_file, (const ScannerWindow __user *)arg);
+
+        case SCANNER_SET_FILTER:
+            return scanner_set_filter(scanner_file, (const struct sock_fprog __user *)arg);
+
+        case SCANNER_SET_RULES:
+            return scanner_set_rules(scanner_file, (const ScannerRules __user *)arg);
+
+        case SCANNER_SET_JSON:
+            return scanner_set_json(scanner_file, arg);
+
+        case SCANNER_SET_PAIRS:
+            return scanner_set_pairs(scanner_file, (const ScannerPairs __user *)arg);
+
+        case SCANNER_SET_CDC:
+            return scanner_set_cdc(scanner_file, (const ScannerChunking __user *)arg);
+
+        case SCANNER_SET_FIXED:
+            return scanner_set_fixed(scanner_file, (const ScannerColumns __user *)arg);
+
+        default:
+            return -ENOTTY;  // Command not supported
+    }
+
+}
+
+// A mapping holds its own reference, so the pages outlive a later write or close
+static void scanner_vma_open(struct vm_area_struct *vma) {
+    ScannerDoc *doc = vma->vm_private_data;
+    kref_get(&doc->ref);
+}
+
+static void scanner_vma_close(struct vm_area_struct *vma) {
+    scanner_doc_put(vma->vm_private_data);
+}
+
+static const struct vm_operations_struct scanner_vm_ops = {
+        .open = scanner_vma_open,
+        .close = scanner_vma_close,
+};
+
+static void scanner_ring_vma_open(struct vm_area_struct *vma) {
+    ScannerRing *ring = vma->vm_private_data;
+    kref_get(&ring->ref);
+}
+
+static void scanner_ring_vma_close(struct vm_area_struct *vma) {
+    scanner_ring_put(vma->vm_private_data);
+}
+
+static const struct vm_operations_struct scanner_ring_vm_ops = {
+        .open = scanner_ring_vma_open,
+        .close = scanner_ring_vma_close,
+};
+
+// Map an input or output ring, header page and data, read-write
+static int scanner_mmap_ring(ScannerFile *scanner_file, struct vm_area_struct *vma, bool output) {
+    ScannerRing *ring;
+    int err;
+
+    mutex_lock(&scanner_file->lock);
+    ring = output ? scanner_file->out_ring : scanner_file->in_ring;
+    if (!ring) {
+        mutex_unlock(&scanner_file->lock);
+        return -ENODEV;
+    }
+    err = remap_vmalloc_range(vma, ring->shared, 0);
+    if (!err) {
+        kref_get(&ring->ref);
+        vma->vm_private_data = ring;
+        vma->vm_ops = &scanner_ring_vm_ops;
+    }
+    mutex_unlock(&scanner_file->lock);
+    return err;
+}
+
+// Map the document this file is reading, read-only, or one of its rings
+static int scanner_mmap(struct file *filp, struct vm_area_struct *vma) {
+    ScannerFile *scanner_file = filp->private_data;
+    ScannerDoc *doc;
+    int err;
+
+    if (vma->vm_pgoff == SCANNER_OFF_INPUT_RING >> PAGE_SHIFT) {
+        return scanner_mmap_ring(scanner_file, vma, false);
+    }
+    if (vma->vm_pgoff == SCANNER_OFF_OUTPUT_RING >> PAGE_SHIFT) {
+        return scanner_mmap_ring(scanner_file, vma, true);
+    }
+    if (vma->vm_flags & VM_WRITE) {
+        return -EACCES;
+    }
+    vm_flags_clear(vma, VM_MAYWRITE);
+
+    mutex_lock(&scanner_file->lock);
+    doc = scanner_file->doc;
+    if (!doc || !doc->mappable) {
+        mutex_unlock(&scanner_file->lock);
+        return -ENODEV;  // Nothing written yet, or below SCANNER_MMAP_MIN
+    }
+    err = remap_vmalloc_range(vma, doc->data, vma->vm_pgoff);
+    if (!err) {
+        kref_get(&doc->ref);
+        vma->vm_private_data = doc;
+        vma->vm_ops = &scanner_vm_ops;
+    }
+    mutex_unlock(&scanner_file->lock);
+    return err;
+}
+
+// With an output ring, polling also produces into the space the consumer has
+// freed since; readable means records are waiting in the ring. Without one,
+// readable means a read would not fail with EAGAIN.
+static __poll_t scanner_poll(struct file *filp, poll_table *wait) {
+    ScannerFile *scanner_file = filp->private_data;
+    __poll_t mask = 0;
+
+    poll_wait(filp, &scanner_file->wait, wait);
+
+    mutex_lock(&scanner_file->lock);
+    if (scanner_file->out_ring) {
+        ScannerRing *ring = scanner_file->out_ring;
+        scanner_out_fill(scanner_file);
+        if (ring->tail != READ_ONCE(ring->shared->head)) {
+            mask = EPOLLIN | EPOLLRDNORM;
+        }
+    } else {
+        ScannerEncoder probe = scanner_file->out;
+        ScannerToken token;
+        u32 type;
+        if (!probe.cursor.open || probe.split || scanner_encoder_next(&probe, &scanner_file->separators, &token, &type)) {
+            mask = EPOLLIN | EPOLLRDNORM;
+        }
+    }
+    mutex_unlock(&scanner_file->lock);
+    return mask;
+}
+
+static struct file_operations scanner_fops = {
+        .owner = THIS_MODULE,
+        .open = scanner_open,
+        .release = scanner_release,
+        .read = scanner_read,
+        .write = scanner_write,
+        .unlocked_ioctl = scanner_ioctl,
+        .mmap = scanner_mmap,
+        .poll = scanner_poll,
+        .uring_cmd = scanner_uring_cmd,
+};
+
+static int __init scanner_init(void) {
+    unsigned int i;
+    int err;
+
+    if (minors < 1) {
+        return -EINVAL;
+    }
+    scanner_device.slots = kcalloc(minors, sizeof(*scanner_device.slots), GFP_KERNEL);
+    if (!scanner_device.slots) {
+        printk(KERN_ERR "%s: Unable to allocate memory for %u minors\n", DEVNAME, minors);
+        return -ENOMEM;
+    }
+    for (i = 0; i < minors; i++) {
+        mutex_init(&scanner_device.slots[i].lock);
+    }
+
+    // Set the default separators: space, tab, newline, carriage return, form feed, vertical tab
+    scanner_seps_init(&scanner_device.separators, SCANNER_DEFAULT_SEPARATORS,
+                      sizeof(SCANNER_DEFAULT_SEPARATORS) - 1);
+
+    // Continue with the rest of the initialization...
+    err = alloc_chrdev_region(&scanner_device.devno, 0, minors, DEVNAME);
+    if (err < 0) {
+        printk(KERN_ERR "%s: alloc_chrdev_region() failed\n", DEVNAME);
+        kfree(scanner_device.slots);
+        return err;
+    }
+
+    cdev_init(&scanner_device.cdev, &scanner_fops);
+    scanner_device.cdev.owner = THIS_MODULE;
+    err = cdev_add(&scanner_device.cdev, scanner_device.devno, minors);
+    if (err) {
+        printk(KERN_ERR "%s: cdev_add() failed\n", DEVNAME);
+        unregister_chrdev_region(scanner_device.devno, minors);
+        kfree(scanner_device.slots);
+        return err;
+    }
+
+    printk(KERN_INFO "%s: device initialized\n", DEVNAME);
+    return 0;
+}
+
+static void __exit scanner_exit(void) {
+    unsigned int i;
+
+    cdev_del(&scanner_device.cdev);
+    unregister_chrdev_region(scanner_device.devno, minors);
+    for (i = 0; i < minors; i++) {
+        scanner_doc_put(scanner_device.slots[i].doc); // Also free the data of each minor if any
+        mutex_destroy(&scanner_device.slots[i].lock);
+    }
+    kfree(scanner_device.slots);
+    printk(KERN_INFO "%s: device removed\n", DEVNAME);
+}
+
+module_init(scanner_init);
+module_exit(scanner_exit);
@@ -0,0 +1,751 @@
+//
+// Lexer rule compiler: patterns are parsed into one Thompson NFA, made
+// deterministic by subset construction over byte classes, minimized by
+// partition refinement and written out as a ScannerDfa.
+//
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ScannerRules.h"
+
+// Subset construction gives up past this many states, before minimizing
+#define RULES_MAX_SUBSETS 65536
+// Deepest nesting of groups a pattern may have
+#define RULES_MAX_DEPTH 256
+
+typedef struct {
+    uint64_t bits[4];
+} ByteSet;
+
+// NFA node: an optional transition on a set of bytes and up to two epsilon edges
+typedef struct {
+    int set;            // Index of the bytes leading to out, or -1
+    int out;
+    int eps[2];         // Epsilon edges, -1 if unused
+    int rule;           // Rule accepted on reaching this node, or -1
+} Node;
+
+typedef struct {
+    Node *nodes;
+    size_t nnodes, node_cap;
+    ByteSet *sets;
+    size_t nsets, set_cap;
+    const char *pattern;
+    const char *p;      // Parse position in pattern
+    int depth;
+    char *err;
+    size_t errlen;
+    int failed;
+} Nfa;
+
+// Part of the NFA with one way in and one way out; end has no edges yet
+typedef struct {
+    int start, end;
+} Frag;
+
+// Interns fixed-width keys, numbering them in the order first seen
+typedef struct {
+    size_t width;
+    unsigned char *keys;
+    size_t count, cap;
+    int *slots;         // Open addressing, -1 when empty
+    size_t nslots;
+} Intern;
+
+static void fail(Nfa *nfa, const char *fmt, ...) {
+    va_list ap;
+
+    if (nfa->failed) {
+        return;
+    }
+    nfa->failed = 1;
+    if (nfa->errlen) {
+        va_start(ap, fmt);
+        vsnprintf(nfa->err, nfa->errlen, fmt, ap);
+        va_end(ap);
+    }
+}
+
+static void set_add(ByteSet *set, unsigned char c) {
+    set->bits[c >> 6] |= (uint64_t)1 << (c & 63);
+}
+
+static int set_has(const ByteSet *set, unsigned char c) {
+    return (set->bits[c >> 6] >> (c & 63)) & 1;
+}
+
+static void set_range(ByteSet *set, unsigned char lo, unsigned char hi) {
+    for (unsigned int c = lo; c <= hi; c++) {
+        set_add(set, c);
+    }
+}
+
+static void set_invert(ByteSet *set) {
+    for (int i = 0; i < 4; i++) {
+        set->bits[i] = ~set->bits[i];
+    }
+}
+
+// Nodes and edges are no longer built once parsing has failed, so running out
+// of memory for them stops the parse like a syntax error does
+static int new_node(Nfa *nfa) {
+    Node *node;
+
+    if (nfa->failed) {
+        return 0;
+    }
+    if (nfa->nnodes == nfa->node_cap) {
+        size_t cap = nfa->node_cap ? 2 * nfa->node_cap : 64;
+        Node *nodes = realloc(nfa->nodes, cap * sizeof(Node));
+        if (!nodes) {
+            fail(nfa, "out of memory");
+            return 0;
+        }
+        nfa->nodes = nodes;
+        nfa->node_cap = cap;
+    }
+    node = &nfa->nodes[nfa->nnodes];
+    node->set = -1;
+    node->out = -1;
+    node->eps[0] = node->eps[1] = -1;
+    node->rule = -1;
+    return (int)nfa->nnodes++;
+}
+
+static void add_eps(Nfa *nfa, int from, int to) {
+    Node *node;
+
+    if (nfa->failed) {
+        return;
+    }
+    node = &nfa->nodes[from];
+    node->eps[node->eps[0] < 0 ? 0 : 1] = to;
+}
+
+static Frag frag_set(Nfa *nfa, const ByteSet *set) {
+    Frag f = { new_node(nfa), new_node(nfa) };
+
+    if (nfa->failed) {
+        return f;
+    }
+    if (nfa->nsets == nfa->set_cap) {
+        size_t cap = nfa->set_cap ? 2 * nfa->set_cap : 16;
+        ByteSet *sets = realloc(nfa->sets, cap * sizeof(ByteSet));
+        if (!sets) {
+            fail(nfa, "out of memory");
+            return f;
+        }
+        nfa->sets = sets;
+        nfa->set_cap = cap;
+    }
+    nfa->sets[nfa->nsets] = *set;
+    nfa->nodes[f.start].set = (int)nfa->nsets++;
+    nfa->nodes[f.start].out = f.end;
+    return f;
+}
+
+static Frag frag_empty(Nfa *nfa) {
+    int node = new_node(nfa);
+    return (Frag){ node, node };
+}
+
+static int hex_digit(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+// The escape after a backslash: adds its bytes to set, and returns the byte
+// it stands for, or -1 for a class escape such as \d
+static int parse_escape(Nfa *nfa, ByteSet *set) {
+    char c = *nfa->p++;
+    int byte;
+
+    switch (c) {
+        case 'd': set_range(set, '0', '9'); return -1;
+        case 'w': set_range(set, 'a', 'z'); set_range(set, 'A', 'Z'); set_range(set, '0', '9');
+                  set_add(set, '_'); return -1;
+        case 's': set_add(set, ' '); set_range(set, '\t', '\r'); return -1;
+        case 'n': byte = '\n'; break;
+        case 't': byte = '\t'; break;
+        case 'r': byte = '\r'; break;
+        case 'f': byte = '\f'; break;
+        case 'v': byte = '\v'; break;
+        case '0': byte = '\0'; break;
+        case 'x': {
+            int hi = hex_digit(nfa->p[0]), lo = hi < 0 ? -1 : hex_digit(nfa->p[1]);
+            if (lo < 0) {
+                fail(nfa, "bad \\x escape at offset %zu", (size_t)(nfa->p - nfa->pattern));
+                return -1;
+            }
+            nfa->p += 2;
+            byte = hi << 4 | lo;
+            break;
+        }
+        case '\0':
+            nfa->p--;
+            fail(nfa, "pattern ends in a backslash");
+            return -1;
+        default: byte = (unsigned char)c; break;
+    }
+    set_add(set, byte);
+    return byte;
+}
+
+// After the '[': bytes up to the closing ']', with ranges and a leading '^'
+static void parse_class(Nfa *nfa, ByteSet *set) {
+    int negate = *nfa->p == '^';
+    int first = 1;
+
+    nfa->p += negate;
+    while (!nfa->failed && (*nfa->p != ']' || first)) {
+        int lo, hi;
+
+        if (*nfa->p == '\0') {
+            fail(nfa, "unterminated [");
+            return;
+        }
+        first = 0;
+        if (*nfa->p == '\\') {
+            nfa->p++;
+            lo = parse_escape(nfa, set);
+        } else {
+            lo = (unsigned char)*nfa->p++;
+            set_add(set, lo);
+        }
+        if (lo < 0 || nfa->p[0] != '-' || nfa->p[1] == ']' || nfa->p[1] == '\0') {
+            continue;
+        }
+        nfa->p++;
+        if (*nfa->p == '\\') {
+            ByteSet ignored = { { 0 } };
+            nfa->p++;
+            hi = parse_escape(nfa, &ignored);
+        } else {
+            hi = (unsigned char)*nfa->p++;
+        }
+        if (hi < lo) {
+            fail(nfa, "bad range at offset %zu", (size_t)(nfa->p - nfa->pattern));
+            return;
+        }
+        set_range(set, lo, hi);
+    }
+    nfa->p++;
+    if (negate) {
+        set_invert(set);
+    }
+}
+
+static Frag parse_alt(Nfa *nfa);
+
+static Frag parse_atom(Nfa *nfa) {
+    ByteSet set = { { 0 } };
+    char c = *nfa->p++;
+
+    switch (c) {
+        case '(': {
+            Frag f;
+            if (++nfa->depth > RULES_MAX_DEPTH) {
+                fail(nfa, "groups nested too deeply");
+                return frag_empty(nfa);
+            }
+            f = parse_alt(nfa);
+            nfa->depth--;
+            if (*nfa->p != ')') {
+                fail(nfa, "unbalanced (");
+            } else {
+                nfa->p++;
+            }
+            return f;
+        }
+        case '[':
+            parse_class(nfa, &set);
+            break;
+        case '.':
+            set_invert(&set);
+            break;
+        case '\\':
+            parse_escape(nfa, &set);
+            break;
+        case '*': case '+': case '?':
+            fail(nfa, "nothing to repeat at offset %zu", (size_t)(nfa->p - 1 - nfa->pattern));
+            return frag_empty(nfa);
+        default:
+            set_add(&set, c);
+            break;
+    }
+    return frag_set(nfa, &set);
+}
+
+static Frag parse_repeat(Nfa *nfa) {
+    Frag f = parse_atom(nfa);
+
+    while (!nfa->failed && (*nfa->p == '*' || *nfa->p == '+' || *nfa->p == '?')) {
+        char op = *nfa->p++;
+        Frag r = { new_node(nfa), new_node(nfa) };
+
+        add_eps(nfa, r.start, f.start);
+        if (op != '+') {
+            add_eps(nfa, r.start, r.end);   // Zero times
+        }
+        if (op != '?') {
+            add_eps(nfa, f.end, f.start);   // Again
+        }
+        add_eps(nfa, f.end, r.end);
+        f = r;
+    }
+    return f;
+}
+
+static Frag parse_concat(Nfa *nfa) {
+    Frag f = frag_empty(nfa);
+
+    while (!nfa->failed && *nfa->p != '\0' && *nfa->p != '|' && *nfa->p != ')') {
+        Frag next = parse_repeat(nfa);
+        add_eps(nfa, f.end, next.start);
+        f.end = next.end;
+    }
+    return f;
+}
+
+static Frag parse_alt(Nfa *nfa) {
+    Frag f = parse_concat(nfa);
+
+    while (!nfa->failed && *nfa->p == '|') {
+        Frag alt = { new_node(nfa), new_node(nfa) }, right;
+
+        nfa->p++;
+        right = parse_concat(nfa);
+        add_eps(nfa, alt.start, f.start);
+        add_eps(nfa, alt.start, right.start);
+        add_eps(nfa, f.end, alt.end);
+        add_eps(nfa, right.end, alt.end);
+        f = alt;
+    }
+    return f;
+}
+
+// Add node and everything reachable from it by epsilon edges to the bitset
+static void closure(const Nfa *nfa, uint64_t *bits, int node, int *stack) {
+    size_t top = 0;
+
+    if ((bits[node >> 6] >> (node & 63)) & 1) {
+        return;
+    }
+    bits[node >> 6] |= (uint64_t)1 << (node & 63);
+    stack[top++] = node;
+    while (top > 0) {
+        const Node *n = &nfa->nodes[stack[--top]];
+        for (int i = 0; i < 2; i++) {
+            int e = n->eps[i];
+            if (e >= 0 && !((bits[e >> 6] >> (e & 63)) & 1)) {
+                bits[e >> 6] |= (uint64_t)1 << (e & 63);
+                stack[top++] = e;
+            }
+        }
+    }
+}
+
+static uint64_t hash_bytes(const unsigned char *key, size_t n) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+
+    for (size_t i = 0; i < n; i++) {
+        h = (h ^ key[i]) * 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static void intern_init(Intern *in, size_t width) {
+    memset(in, 0, sizeof(*in));
+    in->width = width;
+}
+
+static void intern_free(Intern *in) {
+    free(in->keys);
+    free(in->slots);
+}
+
+static int intern_rehash(Intern *in) {
+    size_t nslots = in->nslots ? 2 * in->nslots : 1024;
+    int *slots = malloc(nslots * sizeof(int));
+
+    if (!slots) {
+        return -1;
+    }
+    free(in->slots);
+    in->slots = slots;
+    in->nslots = nslots;
+    memset(in->slots, 0xff, in->nslots * sizeof(int));
+    for (size_t id = 0; id < in->count; id++) {
+        size_t i = hash_bytes(in->keys + id * in->width, in->width) & (in->nslots - 1);
+        while (in->slots[i] >= 0) {
+            i = (i + 1) & (in->nslots - 1);
+        }
+        in->slots[i] = (int)id;
+    }
+    return 0;
+}
+
+// Id of key, added if it is new; *added says which. -1 when out of memory.
+static int intern(Intern *in, const void *key, int *added) {
+    size_t i;
+
+    if (2 * (in->count + 1) > in->nslots && intern_rehash(in) < 0) {
+        return -1;
+    }
+    i = hash_bytes(key, in->width) & (in->nslots - 1);
+    for (; in->slots[i] >= 0; i = (i + 1) & (in->nslots - 1)) {
+        if (memcmp(in->keys + (size_t)in->slots[i] * in->width, key, in->width) == 0) {
+            *added = 0;
+            return in->slots[i];
+        }
+    }
+    if (in->count == in->cap) {
+        size_t cap = in->cap ? 2 * in->cap : 256;
+        unsigned char *keys = realloc(in->keys, cap * in->width);
+        if (!keys) {
+            return -1;
+        }
+        in->keys = keys;
+        in->cap = cap;
+    }
+    memcpy(in->keys + in->count * in->width, key, in->width);
+    in->slots[i] = (int)in->count;
+    *added = 1;
+    return (int)in->count++;
+}
+
+// Bytes no pattern tells apart share a class: class_of[b] for each byte, and
+// a representative byte per class; returns the number of classes, or -1 when
+// out of memory
+static int byte_classes(const Nfa *nfa, uint8_t *class_of, unsigned char *rep) {
+    Intern sigs;
+    size_t words = (nfa->nsets + 63) / 64 + 1;
+    uint64_t *sig = calloc(words, sizeof(uint64_t));
+    int n = -1;
+
+    intern_init(&sigs, words * sizeof(uint64_t));
+    for (int b = 0; sig && b < 256; b++) {
+        int added, id;
+        memset(sig, 0, words * sizeof(uint64_t));
+        for (size_t s = 0; s < nfa->nsets; s++) {
+            if (set_has(&nfa->sets[s], b)) {
+                sig[s >> 6] |= (uint64_t)1 << (s & 63);
+            }
+        }
+        id = intern(&sigs, sig, &added);
+        if (id < 0) {
+            goto out;
+        }
+        class_of[b] = (uint8_t)id;
+        if (added) {
+            rep[id] = b;
+        }
+    }
+    n = sig ? (int)sigs.count : -1;
+
+out:
+    intern_free(&sigs);
+    free(sig);
+    return n;
+}
+
+// Moore's algorithm: split groups of states until each group's states agree
+// on their accepted type and on the group each class leads to. Returns the
+// number of groups and sets group[s] for each state, or returns -1 when out
+// of memory.
+static int minimize(const int *trans, const uint32_t *accept, int nstates, int nclasses, int *group) {
+    Intern parts;
+    int *sig = malloc((nclasses + 1) * sizeof(int));
+    int *next = malloc(nstates * sizeof(int));
+    int ngroups = -1, prev = -2, added;
+
+    intern_init(&parts, sizeof(uint32_t));
+    if (!sig || !next) {
+        goto out;
+    }
+    // Initially by accepted type alone
+    for (int s = 0; s < nstates; s++) {
+        group[s] = intern(&parts, &accept[s], &added);
+        if (group[s] < 0) {
+            goto out;
+        }
+    }
+
+    while ((int)parts.count != prev) {
+        prev = (int)parts.count;
+        intern_free(&parts);
+        intern_init(&parts, (nclasses + 1) * sizeof(int));
+        for (int s = 0; s < nstates; s++) {
+            sig[0] = group[s];
+            for (int c = 0; c < nclasses; c++) {
+                sig[c + 1] = group[trans[s * nclasses + c]];
+            }
+            next[s] = intern(&parts, sig, &added);
+            if (next[s] < 0) {
+                goto out;
+            }
+        }
+        memcpy(group, next, nstates * sizeof(int));
+    }
+    ngroups = (int)parts.count;
+
+out:
+    intern_free(&parts);
+    free(next);
+    free(sig);
+    return ngroups;
+}
+
+ScannerDfa *scanner_rules_compile(const ScannerRule *rules, size_t nrules, size_t *size,
+                                  char *err, size_t errlen) {
+    Nfa nfa = { .err = err, .errlen = errlen };
+    Intern subsets;
+    ScannerDfa *dfa = NULL;
+    uint8_t class_of[256];
+    unsigned char rep[256];
+    int *starts = malloc((nrules + 1) * sizeof(int));
+    int *stack = NULL, *trans = NULL, *group = NULL, *map = NULL, *column = NULL, *col_index = NULL;
+    uint32_t *accept = NULL;
+    uint64_t *bits = NULL;
+    size_t words;
+    int nclasses, nstates, ngroups, nout, ncols, dead;
+
+    if (!starts) {
+        fail(&nfa, "out of memory");
+        goto out;
+    }
+    // Without a rule, the start state would be the dead state
+    if (nrules == 0) {
+        fail(&nfa, "no rules");
+        goto out;
+    }
+    // One fragment per rule, accepting at its end
+    for (size_t r = 0; r < nrules && !nfa.failed; r++) {
+        Frag f;
+
+        if (rules[r].type == SCANNER_DFA_REJECT) {
+            fail(&nfa, "rule %zu: type %u is reserved", r, rules[r].type);
+            break;
+        }
+        nfa.pattern = nfa.p = rules[r].pattern;
+        nfa.depth = 0;
+        f = parse_alt(&nfa);
+        if (!nfa.failed && *nfa.p != '\0') {
+            fail(&nfa, "unbalanced )");
+        }
+        if (nfa.failed) {
+            // Name the rule in front of the message
+            if (errlen) {
+                char msg[256];
+                snprintf(msg, sizeof(msg), "%s", err);
+                snprintf(err, errlen, "rule %zu: %s", r, msg);
+            }
+            break;
+        }
+        nfa.nodes[f.end].rule = (int)r;
+        starts[r] = f.start;
+    }
+    if (nfa.failed) {
+        goto out;
+    }
+
+    words = (nfa.nnodes + 63) / 64 + 1;
+    bits = malloc(words * sizeof(uint64_t));
+    stack = malloc((nfa.nnodes + 1) * sizeof(int));
+    if (!bits || !stack) {
+        fail(&nfa, "out of memory");
+        goto out;
+    }
+
+    // A rule matching the empty string would never let matching move on
+    for (size_t r = 0; r < nrules; r++) {
+        memset(bits, 0, words * sizeof(uint64_t));
+        closure(&nfa, bits, starts[r], stack);
+        for (size_t n = 0; n < nfa.nnodes; n++) {
+            if (((bits[n >> 6] >> (n & 63)) & 1) && nfa.nodes[n].rule == (int)r) {
+                fail(&nfa, "rule %zu: \"%s\" matches the empty string", r, rules[r].pattern);
+                goto out;
+            }
+        }
+    }
+
+    // Subset construction, with the empty set as the dead state 0
+    nclasses = byte_classes(&nfa, class_of, rep);
+    if (nclasses < 0) {
+        fail(&nfa, "out of memory");
+        goto out;
+    }
+    intern_init(&subsets, words * sizeof(uint64_t));
+    memset(bits, 0, words * sizeof(uint64_t));
+    dead = intern(&subsets, bits, &(int){ 0 });
+    for (size_t r = 0; r < nrules; r++) {
+        closure(&nfa, bits, starts[r], stack);
+    }
+    if (dead < 0 || intern(&subsets, bits, &(int){ 0 }) < 0) {
+        fail(&nfa, "out of memory");
+        intern_free(&subsets);
+        goto out;
+    }
+    for (size_t s = 0; s < subsets.count; s++) {
+        int *more_trans;
+        uint32_t *more_accept;
+
+        if (s >= RULES_MAX_SUBSETS) {
+            fail(&nfa, "rules need more than %d states", RULES_MAX_SUBSETS);
+            intern_free(&subsets);
+            goto out;
+        }
+        more_trans = realloc(trans, (s + 1) * nclasses * sizeof(int));
+        if (more_trans) {
+            trans = more_trans;
+        }
+        more_accept = realloc(accept, (s + 1) * sizeof(uint32_t));
+        if (more_accept) {
+            accept = more_accept;
+        }
+        if (!more_trans || !more_accept) {
+            fail(&nfa, "out of memory");
+            intern_free(&subsets);
+            goto out;
+        }
+        accept[s] = SCANNER_DFA_REJECT;
+        for (size_t n = 0; n < nfa.nnodes; n++) {
+            const uint64_t *set = (const uint64_t *)(subsets.keys + s * subsets.width);
+            int rule = nfa.nodes[n].rule;
+            // Nodes are numbered in rule order, so the first found is the earliest rule
+            if (((set[n >> 6] >> (n & 63)) & 1) && rule >= 0) {
+                accept[s] = rules[rule].type;
+                break;
+            }
+        }
+        for (int c = 0; c < nclasses; c++) {
+            // Fetched for each class: interning may move the keys
+            const uint64_t *set = (const uint64_t *)(subsets.keys + s * subsets.width);
+
+            memset(bits, 0, words * sizeof(uint64_t));
+            for (size_t n = 0; n < nfa.nnodes; n++) {
+                const Node *node = &nfa.nodes[n];
+                if (((set[n >> 6] >> (n & 63)) & 1) && node->set >= 0 && set_has(&nfa.sets[node->set], rep[c])) {
+                    closure(&nfa, bits, node->out, stack);
+                }
+            }
+            trans[s * nclasses + c] = intern(&subsets, bits, &(int){ 0 });
+            if (trans[s * nclasses + c] < 0) {
+                fail(&nfa, "out of memory");
+                intern_free(&subsets);
+                goto out;
+            }
+        }
+    }
+    nstates = (int)subsets.count;
+    intern_free(&subsets);
+
+    // Minimize, then number the groups with dead first and start second
+    group = malloc(nstates * sizeof(int));
+    ngroups = group ? minimize(trans, accept, nstates, nclasses, group) : -1;
+    map = ngroups >= 0 ? malloc(ngroups * sizeof(int)) : NULL;
+    if (!map) {
+        fail(&nfa, "out of memory");
+        goto out;
+    }
+    memset(map, 0xff, ngroups * sizeof(int));
+    map[group[SCANNER_DFA_DEAD]] = SCANNER_DFA_DEAD;
+    nout = 1;
+    if (group[SCANNER_DFA_START] != group[SCANNER_DFA_DEAD]) {
+        map[group[SCANNER_DFA_START]] = nout;
+    }
+    nout++;     // A start that can match nothing is still its own state
+    for (int s = 0; s < nstates; s++) {
+        if (map[group[s]] < 0) {
+            map[group[s]] = nout++;
+        }
+    }
+    if (nout > SCANNER_DFA_MAX_STATES) {
+        fail(&nfa, "rules need %d states, more than %d", nout, SCANNER_DFA_MAX_STATES);
+        goto out;
+    }
+
+    // Classes whose columns are identical once minimized share one
+    column = malloc(nclasses * sizeof(int));
+    col_index = malloc(nclasses * sizeof(int));
+    if (!column || !col_index) {
+        fail(&nfa, "out of memory");
+        goto out;
+    }
+    ncols = 0;
+    for (int c = 0; c < nclasses; c++) {
+        column[c] = -1;
+        for (int d = 0; d < c && column[c] < 0; d++) {
+            int same = column[d] >= 0 && column[d] == d;
+            for (int s = 0; same && s < nstates; s++) {
+                same = map[group[trans[s * nclasses + c]]] == map[group[trans[s * nclasses + d]]];
+            }
+            if (same) {
+                column[c] = d;
+            }
+        }
+        if (column[c] < 0) {
+            column[c] = c;
+            ncols++;
+        }
+    }
+
+    *size = scanner_dfa_size(nout, ncols);
+    dfa = calloc(1, *size);
+    if (!dfa) {
+        fail(&nfa, "out of memory");
+        goto out;
+    }
+    dfa->nstates = nout;
+    dfa->nclasses = ncols;
+    {
+        uint32_t *out_accept = (uint32_t *)(dfa + 1);
+        uint16_t *out_next = (uint16_t *)(out_accept + nout);
+        int k = 0;
+
+        for (int c = 0; c < nclasses; c++) {
+            col_index[c] = column[c] == c ? k++ : col_index[column[c]];
+        }
+        for (int b = 0; b < 256; b++) {
+            dfa->classes[b] = (uint8_t)col_index[class_of[b]];
+        }
+        // The dead state, and a start that can match nothing, stay all zero
+        for (int s = 0; s < nout; s++) {
+            out_accept[s] = SCANNER_DFA_REJECT;
+        }
+        for (int s = 0; s < nstates; s++) {
+            int to = map[group[s]];
+            if (to == SCANNER_DFA_DEAD) {
+                continue;
+            }
+            out_accept[to] = accept[s];
+            for (int c = 0; c < nclasses; c++) {
+                out_next[to * ncols + col_index[c]] = (uint16_t)map[group[trans[s * nclasses + c]]];
+            }
+        }
+    }
+
+out:
+    free(col_index);
+    free(column);
+    free(map);
+    free(group);
+    free(accept);
+    free(trans);
+    free(stack);
+    free(bits);
+    free(starts);
+    free(nfa.sets);
+    free(nfa.nodes);
+    return dfa;
+}
@@ -0,0 +1,32 @@
+//
+// Lexer rule compiler for SCANNER_SET_RULES, part of libscanner.
+//
+// Each rule is a regular expression and the token type its matches get.
+// Patterns support literals, ".", classes such as [a-z_] and [^,], the
+// escapes \d \w \s \n \t \r \f \v \0 and \xHH (any other escaped byte stands
+// for itself), grouping, "|", and the "*", "+" and "?" quantifiers. Rules of
+// type 0 are skipped, e.g. whitespace between tokens. When two rules match
+// the same longest text, the earlier one wins.
+//
+
+#ifndef HW5_SCANNERRULES_H
+#define HW5_SCANNERRULES_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ScannerCore.h"
+
+typedef struct {
+    const char *pattern;
+    uint32_t type;      // Below SCANNER_DFA_REJECT
+} ScannerRule;
+
+// Compile rules into a minimized ScannerDfa ready for SCANNER_SET_RULES.
+// Returns it, malloc()ed, with its size in *size; or NULL with a message in
+// err for no rules at all, a malformed pattern, a rule matching the empty
+// string, or too many states.
+ScannerDfa *scanner_rules_compile(const ScannerRule *rules, size_t nrules, size_t *size,
+                                  char *err, size_t errlen);
+
+#endif //HW5_SCANNERRULES_H
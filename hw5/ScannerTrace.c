@@ -0,0 +1,201 @@
+//
+// LD_PRELOAD recorder for scanner device traffic:
+//
+//   SCANNER_TRACE=app.trace LD_PRELOAD=./libscannertrace.so ./app
+//
+// Every open, close, read, write and ioctl on a path starting with
+// SCANNER_TRACE_DEVICE (default /dev/scanner_device, so every minor) is
+// appended to the trace with its timing and result. Other files pass through.
+//
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "NewScanner.h"
+#include "ScannerTrace.h"
+
+#define MAX_FDS 4096
+
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static int trace_fd = -1;
+static uint64_t trace_start;
+static unsigned char traced[MAX_FDS];   // Descriptors that refer to the device
+
+static int (*real_open)(const char *, int, ...);
+static int (*real_openat)(int, const char *, int, ...);
+static int (*real_close)(int);
+static ssize_t (*real_read)(int, void *, size_t);
+static ssize_t (*real_write)(int, const void *, size_t);
+static int (*real_ioctl)(int, unsigned long, ...);
+
+__attribute__((constructor)) static void trace_init(void) {
+    const char *path = getenv(SCANNER_TRACE_ENV);
+
+    real_open = dlsym(RTLD_NEXT, "open");
+    real_openat = dlsym(RTLD_NEXT, "openat");
+    real_close = dlsym(RTLD_NEXT, "close");
+    real_read = dlsym(RTLD_NEXT, "read");
+    real_write = dlsym(RTLD_NEXT, "write");
+    real_ioctl = dlsym(RTLD_NEXT, "ioctl");
+
+    trace_fd = real_open(path ? path : "scanner.trace", O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (trace_fd >= 0) {
+        real_write(trace_fd, SCANNER_TRACE_MAGIC, SCANNER_TRACE_MAGIC_LEN);
+    }
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int is_device(const char *path) {
+    const char *prefix = getenv(SCANNER_TRACE_DEVICE_ENV);
+
+    if (!prefix) {
+        prefix = "/dev/scanner_device";
+    }
+    return path && strncmp(path, prefix, strlen(prefix)) == 0;
+}
+
+static int is_traced(int fd) {
+    return fd >= 0 && fd < MAX_FDS && traced[fd];
+}
+
+static void record(uint32_t op, int fd, uint64_t start, uint64_t arg, uint64_t value, int64_t ret,
+                   const void *payload, uint64_t len) {
+    uint64_t end = now_ns();
+    ScannerTraceRecord rec = {
+        .dur_ns = end - start,
+        .op = op,
+        .fd = fd,
+        .tid = (uint32_t)syscall(SYS_gettid),
+        .arg = arg,
+        .value = value,
+        .ret = ret,
+        .len = payload ? len : 0,
+    };
+    int saved = errno;
+
+    pthread_mutex_lock(&trace_lock);
+    if (trace_fd >= 0) {
+        if (!trace_start) {
+            trace_start = start;
+        }
+        rec.ns = start - trace_start;
+        real_write(trace_fd, &rec, sizeof(rec));
+        if (rec.len) {
+            real_write(trace_fd, payload, rec.len);
+        }
+    }
+    pthread_mutex_unlock(&trace_lock);
+    errno = saved;
+}
+
+static int trace_open(int dirfd, const char *path, int flags, mode_t mode) {
+    uint64_t start = now_ns();
+    int fd = dirfd == AT_FDCWD ? real_open(path, flags, mode) : real_openat(dirfd, path, flags, mode);
+
+    if (is_device(path)) {
+        if (fd >= 0 && fd < MAX_FDS) {
+            traced[fd] = 1;
+        }
+        record(TRACE_OPEN, fd, start, flags, 0, fd < 0 ? -errno : fd, path, strlen(path));
+    }
+    return fd;
+}
+
+int open(const char *path, int flags, ...) {
+    va_list ap;
+    mode_t mode;
+
+    va_start(ap, flags);
+    mode = va_arg(ap, mode_t);
+    va_end(ap);
+    return trace_open(AT_FDCWD, path, flags, mode);
+}
+
+int open64(const char *path, int flags, ...) {
+    va_list ap;
+    mode_t mode;
+
+    va_start(ap, flags);
+    mode = va_arg(ap, mode_t);
+    va_end(ap);
+    return trace_open(AT_FDCWD, path, flags, mode);
+}
+
+int openat(int dirfd, const char *path, int flags, ...) {
+    va_list ap;
+    mode_t mode;
+
+    va_start(ap, flags);
+    mode = va_arg(ap, mode_t);
+    va_end(ap);
+    return trace_open(dirfd, path, flags, mode);
+}
+
+int close(int fd) {
+    uint64_t start = now_ns();
+    int ret;
+
+    if (!is_traced(fd)) {
+        return real_close(fd);
+    }
+    traced[fd] = 0;
+    ret = real_close(fd);
+    record(TRACE_CLOSE, fd, start, 0, 0, ret < 0 ? -errno : ret, NULL, 0);
+    return ret;
+}
+
+ssize_t read(int fd, void *buf, size_t count) {
+    uint64_t start = now_ns();
+    ssize_t ret = real_read(fd, buf, count);
+
+    if (is_traced(fd)) {
+        record(TRACE_READ, fd, start, count, 0, ret < 0 ? -errno : ret, NULL, 0);
+    }
+    return ret;
+}
+
+ssize_t write(int fd, const void *buf, size_t count) {
+    uint64_t start = now_ns();
+    ssize_t ret = real_write(fd, buf, count);
+
+    if (is_traced(fd)) {
+        record(TRACE_WRITE, fd, start, count, 0, ret < 0 ? -errno : ret, buf, count);
+    }
+    return ret;
+}
+
+int ioctl(int fd, unsigned long cmd, ...) {
+    uint64_t start = now_ns();
+    va_list ap;
+    unsigned long arg;
+    int ret;
+
+    va_start(ap, cmd);
+    arg = va_arg(ap, unsigned long);
+    va_end(ap);
+    ret = real_ioctl(fd, cmd, arg);
+
+    if (is_traced(fd)) {
+        if (cmd == SCANNER_SET_SEPARATORS) {
+            const char *seps = (const char *)arg;
+            record(TRACE_IOCTL, fd, start, cmd, 0, ret < 0 ? -errno : ret, seps, seps ? strlen(seps) + 1 : 0);
+        } else {
+            record(TRACE_IOCTL, fd, start, cmd, arg, ret < 0 ? -errno : ret, NULL, 0);
+        }
+    }
+    return ret;
+}
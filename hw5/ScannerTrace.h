@@ -0,0 +1,45 @@
+//
+// Trace of calls against the scanner device, recorded by libscannertrace.so
+// and replayed by ScannerWorkload.
+//
+// A trace file is SCANNER_TRACE_MAGIC followed by records in the order the
+// calls started. Each record is followed by len payload bytes: the path for
+// an open, the data for a write and the string for SCANNER_SET_SEPARATORS.
+// Reads record only their size and result, and mmap()ed access is not traced.
+//
+
+#ifndef HW5_SCANNERTRACE_H
+#define HW5_SCANNERTRACE_H
+
+#include <stdint.h>
+
+#define SCANNER_TRACE_MAGIC "SCTRACE1"
+#define SCANNER_TRACE_MAGIC_LEN 8
+
+// Environment of the recorder: output file, and path prefix of traced devices
+#define SCANNER_TRACE_ENV "SCANNER_TRACE"
+#define SCANNER_TRACE_DEVICE_ENV "SCANNER_TRACE_DEVICE"
+
+enum {
+    TRACE_OPEN,
+    TRACE_CLOSE,
+    TRACE_READ,
+    TRACE_WRITE,
+    TRACE_IOCTL,
+    TRACE_OPS
+};
+
+typedef struct {
+    uint64_t ns;        // Start of the call, from the first recorded call
+    uint64_t dur_ns;    // How long the call took when recorded
+    uint32_t op;        // TRACE_*
+    int32_t fd;         // Descriptor in the recorded process
+    uint32_t tid;       // Recording thread
+    uint32_t pad;
+    uint64_t arg;       // Open flags, read size or ioctl command
+    uint64_t value;     // ioctl argument when passed by value, as for SCANNER_SET_MODE
+    int64_t ret;        // Result, or -errno
+    uint64_t len;       // Payload bytes that follow
+} ScannerTraceRecord;
+
+#endif //HW5_SCANNERTRACE_H
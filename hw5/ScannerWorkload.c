@@ -0,0 +1,536 @@
+//
+// Realistic workloads for the scanner device.
+//
+//   ScannerWorkload gen PROFILE [options]   synthesize a corpus on stdout
+//   ScannerWorkload replay [options] TRACE  replay a libscannertrace.so trace
+//
+// Profiles: zipf (words with Zipfian frequencies), log (service log lines
+// with a heavy tail of long error payloads) and csv (mixed-type rows).
+// Generated corpora can be benchmarked with TestScanner -f FILE.
+//
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "NewScanner.h"
+#include "ScannerTrace.h"
+
+#define DEVICE_FILE "/dev/scanner_device"
+
+static uint64_t rng_state = 1;
+
+// xorshift64*, the same generator TestScanner uses
+static uint64_t rng_next(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+// Uniform in [0, 1)
+static double rng_unit(void) {
+    return (rng_next() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// Geometric with the given mean, at least 1
+static size_t rng_geom(double mean) {
+    size_t n = 1;
+    while (n < 64 * mean && rng_unit() >= 1.0 / mean) {
+        n++;
+    }
+    return n;
+}
+
+// Pareto-distributed value at least min; alpha near 1 gives a heavy tail
+static double rng_pareto(double min, double alpha) {
+    return min / pow(1.0 - rng_unit(), 1.0 / alpha);
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static size_t parse_size(const char *s) {
+    char *end;
+    size_t n = strtoull(s, &end, 0);
+
+    switch (*end) {
+        case 'G': case 'g': n <<= 10; // Fall through
+        case 'M': case 'm': n <<= 10; // Fall through
+        case 'K': case 'k': n <<= 10;
+    }
+    return n;
+}
+
+// ---------------------------------------------------------------- generators
+
+typedef struct {
+    size_t size;
+    size_t vocab;       // Distinct words for zipf and csv categories
+    double alpha;       // Zipf exponent
+    int columns;        // csv
+} GenOptions;
+
+// Output buffer that stops accepting bytes at the requested size
+typedef struct {
+    char *data;
+    size_t len;
+    size_t size;
+} Out;
+
+static int out_full(const Out *out) {
+    return out->len >= out->size;
+}
+
+static void out_bytes(Out *out, const char *s, size_t n) {
+    if (n > out->size - out->len) {
+        n = out->size - out->len;
+    }
+    memcpy(out->data + out->len, s, n);
+    out->len += n;
+}
+
+static void out_str(Out *out, const char *s) {
+    out_bytes(out, s, strlen(s));
+}
+
+static void out_printf(Out *out, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+static void out_printf(Out *out, const char *fmt, ...) {
+    char buf[256];
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    out_bytes(out, buf, n < (int)sizeof(buf) ? (size_t)n : sizeof(buf) - 1);
+}
+
+// A vocabulary of random lowercase words and the cumulative Zipf weights
+// for drawing from it; rank 1 is the most frequent word
+typedef struct {
+    char **words;
+    double *cdf;
+    size_t n;
+} Vocab;
+
+static void vocab_init(Vocab *v, size_t n, double alpha, double mean_len) {
+    double total = 0;
+
+    v->n = n;
+    v->words = malloc(n * sizeof(*v->words));
+    v->cdf = malloc(n * sizeof(*v->cdf));
+    if (!v->words || !v->cdf) {
+        perror("Failed to allocate vocabulary");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < n; i++) {
+        size_t len = rng_geom(mean_len);
+        v->words[i] = malloc(len + 1);
+        for (size_t j = 0; j < len; j++) {
+            v->words[i][j] = 'a' + rng_next() % 26;
+        }
+        v->words[i][len] = '\0';
+        total += 1.0 / pow(i + 1, alpha);
+        v->cdf[i] = total;
+    }
+    for (size_t i = 0; i < n; i++) {
+        v->cdf[i] /= total;
+    }
+}
+
+static const char *vocab_draw(const Vocab *v) {
+    double u = rng_unit();
+    size_t lo = 0, hi = v->n - 1;
+
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (v->cdf[mid] < u) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return v->words[lo];
+}
+
+static void vocab_free(Vocab *v) {
+    for (size_t i = 0; i < v->n; i++) {
+        free(v->words[i]);
+    }
+    free(v->words);
+    free(v->cdf);
+}
+
+// Sentences of Zipf-distributed words, a line every dozen words or so
+static void gen_zipf(Out *out, const GenOptions *opts) {
+    Vocab vocab;
+
+    vocab_init(&vocab, opts->vocab, opts->alpha, 6);
+    while (!out_full(out)) {
+        size_t words = rng_geom(12);
+        for (size_t i = 0; i < words; i++) {
+            out_str(out, vocab_draw(&vocab));
+            out_str(out, i + 1 < words ? " " : "\n");
+        }
+    }
+    vocab_free(&vocab);
+}
+
+// Service log lines. Errors carry a long base64-like payload, drawn from a
+// Pareto distribution, which is what makes the tail latency interesting.
+static void gen_log(Out *out, const GenOptions *opts) {
+    static const char *paths[] = { "/api/v1/items", "/api/v1/users", "/healthz", "/api/v2/search", "/login" };
+    static const char b64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    uint64_t ms = 1760670000000ULL;  // 2025-10-17
+
+    (void)opts;
+    while (!out_full(out)) {
+        double u = rng_unit();
+        const char *level = u < 0.80 ? "INFO" : u < 0.90 ? "DEBUG" : u < 0.97 ? "WARN" : "ERROR";
+        time_t secs = ms / 1000;
+        struct tm tm;
+        char stamp[32];
+
+        ms += rng_geom(3);
+        gmtime_r(&secs, &tm);
+        strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%S", &tm);
+        out_printf(out, "%s.%03dZ %-5s [worker-%d] method=%s path=%s/%u status=%d latency_ms=%.1f request_id=%016llx",
+                   stamp, (int)(ms % 1000), level, (int)(rng_next() % 32), rng_next() % 4 ? "GET" : "POST",
+                   paths[rng_next() % 5], (unsigned)(rng_next() % 100000),
+                   level[0] == 'E' ? 500 : level[0] == 'W' ? 429 : 200, rng_pareto(0.5, 1.5),
+                   (unsigned long long)rng_next());
+        if (level[0] == 'E') {
+            size_t len = (size_t)rng_pareto(64, 1.1);
+            out_str(out, " payload=");
+            for (size_t i = 0; i < len && !out_full(out); i++) {
+                out_bytes(out, &b64[rng_next() % 64], 1);
+            }
+        }
+        out_str(out, "\n");
+    }
+}
+
+// Rows of id, timestamp, amount, Zipf-distributed category, free text
+// (spaces are data here) and a sparse column that is often empty
+static void gen_csv(Out *out, const GenOptions *opts) {
+    Vocab vocab;
+    uint64_t id = 1;
+
+    vocab_init(&vocab, opts->vocab, opts->alpha, 7);
+    while (!out_full(out)) {
+        for (int c = 0; c < opts->columns; c++) {
+            switch (c % 6) {
+                case 0: out_printf(out, "%llu", (unsigned long long)id++); break;
+                case 1: out_printf(out, "%llu", 1760670000ULL + id * 7 + rng_next() % 7); break;
+                case 2: out_printf(out, "%.2f", rng_pareto(1, 1.2)); break;
+                case 3: out_str(out, vocab_draw(&vocab)); break;
+                case 4:
+                    for (size_t w = rng_geom(3); w > 0; w--) {
+                        out_str(out, vocab_draw(&vocab));
+                        out_str(out, w > 1 ? " " : "");
+                    }
+                    break;
+                case 5: if (rng_next() % 4 == 0) out_str(out, vocab_draw(&vocab)); break;
+            }
+            out_str(out, c + 1 < opts->columns ? "," : "\n");
+        }
+    }
+    vocab_free(&vocab);
+}
+
+static const struct {
+    const char *name;
+    void (*generate)(Out *out, const GenOptions *opts);
+    const char *separators;     // TestScanner -S argument to tokenize the result with
+} profiles[] = {
+    { "zipf", gen_zipf, "$' \\n'" },
+    { "log", gen_log, "$' \\n'" },
+    { "csv", gen_csv, "$',\\n'" },
+};
+
+static int cmd_gen(int argc, char *argv[]) {
+    GenOptions opts = { .size = 1 << 20, .vocab = 10000, .alpha = 1.0, .columns = 6 };
+    const char *output = NULL;
+    Out out;
+    int opt;
+    size_t p;
+
+    while ((opt = getopt(argc, argv, "s:x:V:a:c:o:")) != -1) {
+        switch (opt) {
+            case 's': opts.size = parse_size(optarg); break;
+            case 'x': rng_state = strtoull(optarg, NULL, 0); break;
+            case 'V': opts.vocab = strtoull(optarg, NULL, 0); break;
+            case 'a': opts.alpha = atof(optarg); break;
+            case 'c': opts.columns = atoi(optarg); break;
+            case 'o': output = optarg; break;
+            default: return -1;
+        }
+    }
+    if (optind != argc - 1 || !rng_state || !opts.vocab || opts.columns < 1) {
+        return -1;
+    }
+    for (p = 0; p < sizeof(profiles) / sizeof(profiles[0]); p++) {
+        if (strcmp(argv[optind], profiles[p].name) == 0) {
+            break;
+        }
+    }
+    if (p == sizeof(profiles) / sizeof(profiles[0])) {
+        return -1;
+    }
+
+    out.data = malloc(opts.size);
+    out.len = 0;
+    out.size = opts.size;
+    if (!out.data) {
+        perror("Failed to allocate corpus");
+        exit(EXIT_FAILURE);
+    }
+    profiles[p].generate(&out, &opts);
+
+    FILE *f = output ? fopen(output, "w") : stdout;
+    if (!f || fwrite(out.data, 1, out.len, f) != out.len || fflush(f) != 0) {
+        perror(output ? output : "stdout");
+        exit(EXIT_FAILURE);
+    }
+    fprintf(stderr, "%s: %zu bytes, tokenize with -S %s\n", profiles[p].name, out.len, profiles[p].separators);
+    free(out.data);
+    return 0;
+}
+
+// ---------------------------------------------------------------- replay
+
+#define MAX_FDS 4096
+
+// Latency samples of one kind of call, for percentiles
+typedef struct {
+    uint64_t *ns;
+    size_t n, cap;
+} Samples;
+
+static void samples_add(Samples *s, uint64_t ns) {
+    if (s->n == s->cap) {
+        s->cap = s->cap ? 2 * s->cap : 1024;
+        s->ns = realloc(s->ns, s->cap * sizeof(*s->ns));
+        if (!s->ns) {
+            perror("Failed to allocate samples");
+            exit(EXIT_FAILURE);
+        }
+    }
+    s->ns[s->n++] = ns;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static uint64_t samples_quantile(Samples *s, double q) {
+    return s->n ? s->ns[(size_t)(q * (s->n - 1))] : 0;
+}
+
+static void json_latency(const char *name, Samples *s, int last) {
+    qsort(s->ns, s->n, sizeof(*s->ns), cmp_u64);
+    printf("    \"%s\": {\"count\": %zu, \"p50_ns\": %llu, \"p99_ns\": %llu, \"max_ns\": %llu}%s\n", name, s->n,
+           (unsigned long long)samples_quantile(s, 0.50), (unsigned long long)samples_quantile(s, 0.99),
+           (unsigned long long)(s->n ? s->ns[s->n - 1] : 0), last ? "" : ",");
+}
+
+static int cmd_replay(int argc, char *argv[]) {
+    static const char *op_names[TRACE_OPS] = { "open", "close", "read", "write", "ioctl" };
+    const char *device = NULL;
+    int fast = 0;
+    int opt;
+    FILE *f;
+    char magic[SCANNER_TRACE_MAGIC_LEN];
+    ScannerTraceRecord rec;
+    static int fds[MAX_FDS];
+    char *payload = NULL;
+    size_t payload_cap = 0;
+    char *buf = NULL;
+    size_t buf_cap = 0;
+    Samples replayed[TRACE_OPS] = { { 0 } }, recorded[TRACE_OPS] = { { 0 } };
+    uint64_t ops = 0, diverged = 0, skipped = 0, last_ns = 0, start;
+
+    while ((opt = getopt(argc, argv, "d:F")) != -1) {
+        switch (opt) {
+            case 'd': device = optarg; break;
+            case 'F': fast = 1; break;
+            default: return -1;
+        }
+    }
+    if (optind != argc - 1) {
+        return -1;
+    }
+    f = fopen(argv[optind], "r");
+    if (!f || fread(magic, 1, sizeof(magic), f) != sizeof(magic) ||
+        memcmp(magic, SCANNER_TRACE_MAGIC, sizeof(magic)) != 0) {
+        fprintf(stderr, "%s: not a scanner trace\n", argv[optind]);
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < MAX_FDS; i++) {
+        fds[i] = -1;
+    }
+
+    start = now_ns();
+    while (fread(&rec, sizeof(rec), 1, f) == 1) {
+        int64_t ret;
+        uint64_t t;
+        int fd;
+
+        if (rec.len + 1 > payload_cap) {
+            payload_cap = rec.len + 1;
+            payload = realloc(payload, payload_cap);
+        }
+        if (!payload || fread(payload, 1, rec.len, f) != rec.len) {
+            fprintf(stderr, "%s: truncated trace\n", argv[optind]);
+            break;
+        }
+        payload[rec.len] = '\0';
+        if (rec.op >= TRACE_OPS || rec.fd < -1 || rec.fd >= MAX_FDS) {
+            skipped++;
+            continue;
+        }
+
+        // Original timing keeps the recorded gaps between call starts
+        if (!fast) {
+            uint64_t due = start + rec.ns;
+            for (t = now_ns(); t < due; t = now_ns()) {
+                uint64_t wait = due - t;
+                struct timespec ts = { wait / 1000000000ULL, wait % 1000000000ULL };
+                nanosleep(&ts, NULL);
+            }
+        }
+        fd = rec.op == TRACE_OPEN || rec.fd < 0 ? -1 : fds[rec.fd];
+        if (rec.op != TRACE_OPEN && fd < 0) {
+            skipped++;  // The recorded open failed, so did this call
+            continue;
+        }
+
+        t = now_ns();
+        switch (rec.op) {
+            case TRACE_OPEN: {
+                char path[4096];
+                if (device && strncmp(payload, DEVICE_FILE, strlen(DEVICE_FILE)) == 0) {
+                    snprintf(path, sizeof(path), "%s%s", device, payload + strlen(DEVICE_FILE));
+                } else {
+                    snprintf(path, sizeof(path), "%s", payload);
+                }
+                ret = open(path, (int)rec.arg);
+                if (ret >= 0 && rec.ret >= 0 && rec.ret < MAX_FDS) {
+                    fds[rec.ret] = ret;
+                }
+                break;
+            }
+            case TRACE_CLOSE:
+                ret = close(fd);
+                fds[rec.fd] = -1;
+                break;
+            case TRACE_READ:
+                if (rec.arg > buf_cap) {
+                    buf_cap = rec.arg;
+                    buf = realloc(buf, buf_cap);
+                }
+                ret = read(fd, buf, rec.arg);
+                break;
+            case TRACE_WRITE:
+                ret = write(fd, payload, rec.len);
+                break;
+            default:
+                if (rec.arg == SCANNER_SET_SEPARATORS) {
+                    ret = ioctl(fd, rec.arg, payload);
+                } else if (_IOC_DIR(rec.arg) == _IOC_NONE) {
+                    ret = ioctl(fd, rec.arg, (unsigned long)rec.value);
+                } else {
+                    char scratch[4096] = { 0 };  // Output of e.g. SCANNER_GET_FEATURES
+                    ret = ioctl(fd, rec.arg, scratch);
+                }
+        }
+        if (ret < 0) {
+            ret = -errno;
+        }
+        samples_add(&replayed[rec.op], now_ns() - t);
+        samples_add(&recorded[rec.op], rec.dur_ns);
+        last_ns = rec.ns;
+        ops++;
+
+        // Descriptor numbers may differ between runs; anything else is a change in behaviour
+        if (rec.op == TRACE_OPEN ? (ret < 0) != (rec.ret < 0) : ret != rec.ret) {
+            diverged++;
+        }
+    }
+    fclose(f);
+    for (int i = 0; i < MAX_FDS; i++) {
+        if (fds[i] >= 0) {
+            close(fds[i]);
+        }
+    }
+
+    printf("{\"trace\": \"%s\", \"timing\": \"%s\", \"ops\": %llu, \"diverged\": %llu, \"skipped\": %llu,\n",
+           argv[optind], fast ? "fast" : "original", (unsigned long long)ops, (unsigned long long)diverged,
+           (unsigned long long)skipped);
+    printf("  \"recorded_ns\": %llu, \"elapsed_ns\": %llu,\n", (unsigned long long)last_ns,
+           (unsigned long long)(now_ns() - start));
+    printf("  \"replayed\": {\n");
+    for (int op = 0; op < TRACE_OPS; op++) {
+        json_latency(op_names[op], &replayed[op], op == TRACE_OPS - 1);
+    }
+    printf("  },\n  \"recorded\": {\n");
+    for (int op = 0; op < TRACE_OPS; op++) {
+        json_latency(op_names[op], &recorded[op], op == TRACE_OPS - 1);
+    }
+    printf("  }}\n");
+
+    for (int op = 0; op < TRACE_OPS; op++) {
+        free(replayed[op].ns);
+        free(recorded[op].ns);
+    }
+    free(payload);
+    free(buf);
+    return 0;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s gen PROFILE [options]   write a corpus to stdout\n"
+            "  PROFILE        zipf, log or csv\n"
+            "  -s SIZE        corpus size, e.g. 64K, 1M, 1G (default 1M)\n"
+            "  -x SEED        random seed (default 1)\n"
+            "  -V WORDS       vocabulary size for zipf and csv (default 10000)\n"
+            "  -a ALPHA       Zipf exponent (default 1.0)\n"
+            "  -c COLUMNS     csv columns (default 6)\n"
+            "  -o FILE        write to FILE instead of stdout\n"
+            "       %s replay [options] TRACE\n"
+            "  -F             as fast as possible instead of with the recorded timing\n"
+            "  -d DEVICE      replace " DEVICE_FILE " in recorded paths, keeping minor suffixes\n"
+            "record a trace with\n"
+            "  " SCANNER_TRACE_ENV "=app.trace LD_PRELOAD=./libscannertrace.so ./app\n",
+            prog, prog);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        usage(argv[0]);
+    }
+    optind = 2;
+    if (strcmp(argv[1], "gen") == 0 && cmd_gen(argc, argv) == 0) {
+        return EXIT_SUCCESS;
+    }
+    if (strcmp(argv[1], "replay") == 0 && cmd_replay(argc, argv) == 0) {
+        return EXIT_SUCCESS;
+    }
+    usage(argv[0]);
+    return EXIT_FAILURE;
+}
@@ -1,19 +1,282 @@
 //
 // Created by abbiesarmento on 4/18/24.
 //
+// Throughput benchmark for the scanner device. Generates a synthetic corpus
+// for each requested size, writes it to the device, reads every token back in
+// each read mode and buffer size, and reports the results as JSON.
+//
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <fcntl.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "NewScanner.h"
+#include "ScannerCore.h"
+
 // Replace with your actual device file path
 #define DEVICE_FILE "/dev/scanner_device"
 
-// Replace with your actual magic number and request code
-#define SCANNER_MAGIC 'q'
-#define SCANNER_SET_SEPARATORS _IOW(SCANNER_MAGIC, 1, char *)
+#define MAX_LIST 16
+
+// A length distribution for tokens or separator runs: "fixed:N", "uniform:A-B" or "geom:MEAN"
+typedef struct {
+    enum { DIST_FIXED, DIST_UNIFORM, DIST_GEOM } kind;
+    size_t a, b;
+    const char *spec;
+} Dist;
+
+// Read modes the benchmark knows how to drive
+typedef struct {
+    const char *name;
+    int mode;       // SCANNER_MODE_*
+} ReadMode;
+
+static const ReadMode read_modes[] = {
+    { "token", SCANNER_MODE_TOKEN },    // One token per read(), truncated to the buffer size
+    { "bulk", SCANNER_MODE_BULK },      // NUL-terminated tokens filling the buffer
+    { "framed", SCANNER_MODE_FRAMED },  // Length-prefixed tokens filling the buffer
+    { "index", SCANNER_MODE_INDEX },    // Offset/length records into the document
+    { "typed", SCANNER_MODE_TYPED },    // Framed, each frame after the token's type
+    { "digest", SCANNER_MODE_DIGEST },  // Index records with each token's SHA-256
+};
+
+// Log-linear latency histogram: 16 linear buckets per power of two of nanoseconds
+#define HIST_SUB 16
+#define HIST_BUCKETS (64 * HIST_SUB)
+
+typedef struct {
+    uint64_t counts[HIST_BUCKETS];
+    uint64_t total;
+} Histogram;
+
+typedef struct {
+    const char *device;
+    const char *baseline;   // Null device, such as /dev/Hello, to report overhead above
+    const char *separators;
+    const char *corpus_file;    // Benchmark this file instead of generated corpora
+    Dist tokens;
+    Dist gaps;
+    size_t sizes[MAX_LIST];
+    int nsizes;
+    size_t buffers[MAX_LIST];
+    int nbuffers;
+    int repeat;
+    int verify;
+    uint64_t seed;
+    int readers;        // Contention mode: reader workers, or -1 to sweep
+    int writers;        // Contention mode: writer workers
+    int minors;         // Contention mode: minors the workers spread over
+    int processes;      // Contention mode: fork workers instead of threads
+    double duration;    // Contention mode: seconds per configuration
+} Options;
+
+typedef struct {
+    uint64_t bytes;
+    uint64_t tokens;
+    uint64_t syscalls;
+    uint64_t write_ns;
+    uint64_t total_ns;
+    int verified;
+    Histogram reads;
+} Result;
+
+// Per-worker counters for the contention mode, kept in shared memory so
+// forked workers can report back as well as threads
+typedef struct {
+    uint64_t ops;
+    uint64_t bytes;
+    uint64_t tokens;
+    Histogram latency;
+} WorkerStats;
+
+typedef struct {
+    const Options *opts;
+    const char *corpus;
+    size_t size;
+    int index;
+    int writer;
+    volatile int *stop;
+    WorkerStats *stats;
+} Worker;
+
+static uint64_t rng_state;
+
+// Utility function for a fast, reproducible xorshift64* random number
+static uint64_t rng_next(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static size_t dist_sample(const Dist *dist) {
+    size_t n;
+
+    switch (dist->kind) {
+        case DIST_UNIFORM:
+            return dist->a + rng_next() % (dist->b - dist->a + 1);
+        case DIST_GEOM:
+            // Geometric with the given mean, never shorter than one byte
+            n = 1;
+            while (n < 64 * dist->a && rng_next() % dist->a != 0) {
+                n++;
+            }
+            return n;
+        default:
+            return dist->a;
+    }
+}
+
+static int dist_parse(Dist *dist, const char *spec) {
+    dist->spec = spec;
+    if (sscanf(spec, "fixed:%zu", &dist->a) == 1) {
+        dist->kind = DIST_FIXED;
+        return dist->a > 0 ? 0 : -1;
+    }
+    if (sscanf(spec, "uniform:%zu-%zu", &dist->a, &dist->b) == 2) {
+        dist->kind = DIST_UNIFORM;
+        return dist->a > 0 && dist->a <= dist->b ? 0 : -1;
+    }
+    if (sscanf(spec, "geom:%zu", &dist->a) == 1) {
+        dist->kind = DIST_GEOM;
+        return dist->a > 0 ? 0 : -1;
+    }
+    return -1;
+}
+
+// Utility function to parse a size with an optional K, M or G suffix
+static size_t parse_size(const char *s) {
+    char *end;
+    size_t n = strtoull(s, &end, 10);
+
+    switch (*end) {
+        case 'k': case 'K': return n << 10;
+        case 'm': case 'M': return n << 20;
+        case 'g': case 'G': return n << 30;
+        default: return n;
+    }
+}
+
+static int parse_list(size_t *list, const char *arg) {
+    char *copy = strdup(arg);
+    char *save = NULL;
+    int n = 0;
+
+    for (char *s = strtok_r(copy, ",", &save); s && n < MAX_LIST; s = strtok_r(NULL, ",", &save)) {
+        list[n] = parse_size(s);
+        if (list[n] > 0) {
+            n++;
+        }
+    }
+    free(copy);
+    return n;
+}
+
+// Fill buf with tokens and separator runs drawn from the configured distributions
+static void corpus_generate(char *buf, size_t size, const Options *opts) {
+    static const char alphabet[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789._-";
+    size_t nseps = strlen(opts->separators);
+    char chars[sizeof(alphabet)];
+    size_t nchars = 0;
+    size_t pos = 0;
+
+    // Token characters are whatever in the alphabet is not a separator
+    for (const char *c = alphabet; *c; c++) {
+        if (!strchr(opts->separators, *c)) {
+            chars[nchars++] = *c;
+        }
+    }
+
+    while (pos < size) {
+        size_t n = dist_sample(&opts->tokens);
+        for (; n > 0 && pos < size; n--) {
+            buf[pos++] = chars[rng_next() % nchars];
+        }
+        n = dist_sample(&opts->gaps);
+        for (; n > 0 && pos < size; n--) {
+            buf[pos++] = opts->separators[rng_next() % nseps];
+        }
+    }
+}
+
+// The corpus to benchmark: the -f file, whose size replaces *size, or a
+// freshly generated one of *size bytes
+static char *corpus_create(const Options *opts, size_t *size) {
+    char *corpus;
+
+    if (opts->corpus_file) {
+        FILE *f = fopen(opts->corpus_file, "r");
+        long len;
+
+        if (!f || fseek(f, 0, SEEK_END) != 0 || (len = ftell(f)) < 0 || fseek(f, 0, SEEK_SET) != 0) {
+            perror(opts->corpus_file);
+            exit(EXIT_FAILURE);
+        }
+        *size = len;
+        corpus = malloc(*size ? *size : 1);
+        if (!corpus || fread(corpus, 1, *size, f) != *size) {
+            perror(opts->corpus_file);
+            exit(EXIT_FAILURE);
+        }
+        fclose(f);
+        return corpus;
+    }
+
+    corpus = malloc(*size);
+    if (!corpus) {
+        perror("Failed to allocate corpus");
+        exit(EXIT_FAILURE);
+    }
+    rng_state = opts->seed ? opts->seed : 1;
+    corpus_generate(corpus, *size, opts);
+    return corpus;
+}
+
+static void hist_add(Histogram *hist, uint64_t ns) {
+    int bucket;
+
+    if (ns < HIST_SUB) {
+        bucket = ns;
+    } else {
+        int log = 63 - __builtin_clzll(ns);
+        bucket = (log - 3) * HIST_SUB + (int)((ns >> (log - 4)) & (HIST_SUB - 1));
+    }
+    hist->counts[bucket < HIST_BUCKETS ? bucket : HIST_BUCKETS - 1]++;
+    hist->total++;
+}
+
+// Lower bound in nanoseconds of the bucket holding the given quantile
+static uint64_t hist_quantile(const Histogram *hist, double q) {
+    uint64_t rank = (uint64_t)(q * hist->total);
+    uint64_t seen = 0;
+
+    for (int bucket = 0; bucket < HIST_BUCKETS; bucket++) {
+        seen += hist->counts[bucket];
+        if (seen > rank) {
+            int log = bucket / HIST_SUB + 3;
+            if (bucket < HIST_SUB) {
+                return bucket;
+            }
+            return ((uint64_t)1 << log) + ((uint64_t)(bucket % HIST_SUB) << (log - 4));
+        }
+    }
+    return 0;
+}
 
 // Utility function to set separators using ioctl
 int set_separators(int fd, const char *separators) {
@@ -25,45 +288,682 @@ ssize_t read_token(int fd, char *buffer, size_t size) {
     return read(fd, buffer, size);
 }
 
-int main() {
+// Reassembles multi-token reads into tokens, checking each against the
+// reference scan when verifying
+typedef struct {
+    ScannerCursor cursor;   // Reference scan of the corpus
+    ScannerToken token;     // Reference token being decoded
+    size_t got;             // Bytes of it decoded so far, when split across reads
+    int ok;
+} Decoder;
+
+// Account for len more bytes of the current token, completing it if last is set
+static int decode_bytes(Decoder *d, const ScannerSeps *seps, int verify, const char *bytes, size_t len,
+                        int last) {
+    if (!verify) {
+        return last;
+    }
+    if (d->got == 0 && !scanner_next(seps, &d->cursor, &d->token)) {
+        d->ok = 0;  // More tokens than the reference
+        return last;
+    }
+    if (d->got + len > d->token.len || memcmp(bytes, d->cursor.data + d->token.start + d->got, len) != 0) {
+        d->ok = 0;
+    }
+    d->got += len;
+    if (last) {
+        if (d->got != d->token.len) {
+            d->ok = 0;
+        }
+        d->got = 0;
+    }
+    return last;
+}
+
+// Decode one read's worth of records; returns the tokens it completed
+static uint64_t decode_read(Decoder *d, const ScannerSeps *seps, int mode, int verify, const char *buf, size_t n) {
+    uint64_t tokens = 0;
+    size_t i = 0;
+
+    while (i < n) {
+        if (mode == SCANNER_MODE_INDEX || mode == SCANNER_MODE_DIGEST) {
+            ScannerSpan span;
+            memcpy(&span, buf + i, sizeof(span));
+            i += scanner_min_read(mode);
+            if (verify && (!scanner_next(seps, &d->cursor, &d->token) ||
+                           span.offset != d->token.start || span.len != d->token.len)) {
+                d->ok = 0;
+            }
+            tokens++;
+        } else if (mode == SCANNER_MODE_FRAMED || mode == SCANNER_MODE_TYPED) {
+            uint32_t word, len;
+            if (mode == SCANNER_MODE_TYPED) {
+                i += sizeof(uint32_t);  // No filter is attached, so every type is 0
+            }
+            memcpy(&word, buf + i, sizeof(word));
+            len = word & ~SCANNER_FRAME_MORE;
+            tokens += decode_bytes(d, seps, verify, buf + i + sizeof(word), len, !(word & SCANNER_FRAME_MORE));
+            i += sizeof(word) + len;
+        } else {
+            const char *nul = memchr(buf + i, '\0', n - i);
+            size_t len = (nul ? (size_t)(nul - buf) : n) - i;
+            tokens += decode_bytes(d, seps, verify, buf + i, len, nul != NULL);
+            i += len + (nul != NULL);
+        }
+    }
+    return tokens;
+}
+
+// Write the corpus, then read tokens until the device reports the end.
+// Timing covers the separator ioctl, the write and every read.
+// With verify set, every token is compared with the core's reference scan.
+static int run_once(const Options *opts, const ReadMode *mode, const char *corpus, size_t size,
+                    size_t bufsize, Result *result) {
+    ScannerSeps seps;
+    ScannerCursor cursor;
+    ScannerToken token;
+    Decoder decoder;
+    char *buf = malloc(bufsize);
+    uint64_t start, t;
+    ssize_t n;
     int fd;
-    char read_buf[1024];
-    ssize_t bytes_read;
 
-    // Open the device
-    fd = open(DEVICE_FILE, O_RDWR);
-    if (fd < 0) {
-        perror("Failed to open device");
-        return EXIT_FAILURE;
+    fd = open(opts->device, O_RDWR);
+    if (fd < 0 || !buf) {
+        free(buf);
+        return -1;
     }
 
-    // Set separators
-    if (set_separators(fd, " \t\n") != 0) {
-        perror("Failed to set separators");
-        close(fd);
-        return EXIT_FAILURE;
+    scanner_seps_init(&seps, opts->separators, strlen(opts->separators));
+    scanner_cursor_init(&cursor, corpus, size);
+    decoder.cursor = cursor;
+    decoder.got = 0;
+    decoder.ok = 1;
+
+    start = now_ns();
+    if (mode->mode != SCANNER_MODE_TOKEN) {
+        if (ioctl(fd, SCANNER_SET_MODE, mode->mode) != 0) {
+            n = -1;
+            goto out;
+        }
+        result->syscalls++;
+    }
+    if (set_separators(fd, opts->separators) != 0 || write(fd, corpus, size) != (ssize_t)size) {
+        n = -1;
+        goto out;
+    }
+    result->write_ns += now_ns() - start;
+    result->syscalls += 2;
+
+    for (;;) {
+        t = now_ns();
+        n = read_token(fd, buf, bufsize);
+        hist_add(&result->reads, now_ns() - t);
+        result->syscalls++;
+        if (n <= 0) {
+            break;
+        }
+        if (mode->mode != SCANNER_MODE_TOKEN) {
+            result->tokens += decode_read(&decoder, &seps, mode->mode, opts->verify, buf, n);
+            continue;
+        }
+        result->tokens++;
+        if (opts->verify) {
+            size_t expect = 0;
+            if (scanner_next(&seps, &cursor, &token)) {
+                expect = token.len < bufsize ? token.len : bufsize;
+            }
+            if ((size_t)n != expect || memcmp(buf, corpus + token.start, n) != 0) {
+                result->verified = 0;
+            }
+        }
+    }
+    result->total_ns += now_ns() - start;
+    result->bytes += size;
+    if (mode->mode != SCANNER_MODE_TOKEN) {
+        cursor = decoder.cursor;
+        if (!decoder.ok || decoder.got) {
+            result->verified = 0;
+        }
     }
+    if (opts->verify && scanner_next(&seps, &cursor, &token)) {
+        result->verified = 0;  // The device stopped early
+    }
+
+out:
+    // Keep errno from the failing call for the report
+    t = errno;
+    close(fd);
+    free(buf);
+    errno = t;
+    return n < 0 ? -1 : 0;
+}
+
+// In-process tokenizers the device is compared against. Each gets a private
+// NUL-terminated copy of the corpus and returns the number of tokens found.
+typedef struct {
+    const char *name;
+    uint64_t (*tokenize)(char *text, size_t size, const Options *opts, const ScannerSeps *seps);
+} InProcess;
+
+static uint64_t tokenize_strtok_r(char *text, size_t size, const Options *opts, const ScannerSeps *seps) {
+    char *save = NULL;
+    uint64_t tokens = 0;
+
+    for (char *s = strtok_r(text, opts->separators, &save); s; s = strtok_r(NULL, opts->separators, &save)) {
+        tokens++;
+    }
+    return tokens;
+}
+
+static uint64_t tokenize_strpbrk(char *text, size_t size, const Options *opts, const ScannerSeps *seps) {
+    uint64_t tokens = 0;
+    char *s = text + strspn(text, opts->separators);
 
-    // Write data to the device
-    if (write(fd, "This is a test.", 15) < 0) {
-        perror("Failed to write data");
+    while (*s) {
+        char *end = strpbrk(s, opts->separators);
+        tokens++;
+        if (!end) {
+            break;
+        }
+        s = end + strspn(end, opts->separators);
+    }
+    return tokens;
+}
+
+static uint64_t tokenize_table(char *text, size_t size, const Options *opts, const ScannerSeps *seps) {
+    ScannerCursor cursor;
+    ScannerToken token;
+    uint64_t tokens = 0;
+
+    scanner_cursor_init(&cursor, text, size);
+    while (scanner_next_scalar(seps, &cursor, &token)) {
+        tokens++;
+    }
+    return tokens;
+}
+
+static uint64_t tokenize_simd(char *text, size_t size, const Options *opts, const ScannerSeps *seps) {
+    ScannerCursor cursor;
+    ScannerToken token;
+    uint64_t tokens = 0;
+
+    scanner_cursor_init(&cursor, text, size);
+    while (scanner_next(seps, &cursor, &token)) {
+        tokens++;
+    }
+    return tokens;
+}
+
+static const InProcess in_process[] = {
+    { "strtok_r", tokenize_strtok_r },
+    { "strpbrk",  tokenize_strpbrk },
+    { "table",    tokenize_table },     // libscanner's byte-at-a-time reference loop
+    { "simd",     tokenize_simd },      // libscanner's vectorized scan, as the module runs it
+};
+
+// Time one in-process tokenizer over the corpus; the copy is not timed
+static void run_in_process(const Options *opts, const InProcess *method, const char *corpus, size_t size,
+                           char *text, Result *result) {
+    ScannerSeps seps;
+    uint64_t start;
+
+    scanner_seps_init(&seps, opts->separators, strlen(opts->separators));
+    for (int r = 0; r < opts->repeat; r++) {
+        memcpy(text, corpus, size);
+        text[size] = '\0';
+        start = now_ns();
+        result->tokens += method->tokenize(text, size, opts, &seps);
+        result->total_ns += now_ns() - start;
+        result->bytes += size;
+    }
+}
+
+// Read the whole payload of the null device, rewinding before each repetition,
+// so the floor cost of a char-device read() is measured with the same buffer
+static int run_null_device(const Options *opts, size_t bufsize, Result *result) {
+    char *buf = malloc(bufsize);
+    uint64_t start, t;
+    ssize_t n = -1;
+    int fd;
+
+    fd = open(opts->baseline, O_RDONLY);
+    if (fd < 0 || !buf) {
+        free(buf);
+        return -1;
+    }
+    for (int r = 0; r < opts->repeat; r++) {
+        if (lseek(fd, 0, SEEK_SET) != 0) {
+            n = -1;
+            break;
+        }
+        start = now_ns();
+        for (;;) {
+            t = now_ns();
+            n = read(fd, buf, bufsize);
+            hist_add(&result->reads, now_ns() - t);
+            result->syscalls++;
+            if (n <= 0) {
+                break;
+            }
+            result->bytes += n;
+        }
+        result->total_ns += now_ns() - start;
+        if (n < 0) {
+            break;
+        }
+    }
+    t = errno;
+    close(fd);
+    free(buf);
+    errno = t;
+    return n < 0 ? -1 : 0;
+}
+
+static void json_string(FILE *out, const char *s) {
+    fputc('"', out);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') {
+            fprintf(out, "\\%c", *s);
+        } else if ((unsigned char)*s < 0x20) {
+            fprintf(out, "\\u%04x", *s);
+        } else {
+            fputc(*s, out);
+        }
+    }
+    fputc('"', out);
+}
+
+// baseline_ns is the fastest in-process time for the same work, and null_p50_ns
+// the median read on the null device with the same buffer, or 0 for none
+static void json_result(FILE *out, const char *mode, size_t size, size_t bufsize, const Result *result,
+                        uint64_t baseline_ns, uint64_t null_p50_ns, const char *error, int first) {
+    double seconds = result->total_ns / 1e9;
+
+    fprintf(out, "%s\n    {\"mode\": \"%s\", \"size\": %zu, \"buffer\": %zu", first ? "" : ",",
+            mode, size, bufsize);
+    if (error) {
+        fprintf(out, ", \"error\": ");
+        json_string(out, error);
+        fprintf(out, "}");
+        return;
+    }
+    fprintf(out, ", \"tokens\": %llu, \"syscalls\": %llu, \"seconds\": %.6f",
+            (unsigned long long)result->tokens, (unsigned long long)result->syscalls, seconds);
+    fprintf(out, ", \"mb_per_s\": %.2f, \"tokens_per_s\": %.0f, \"syscalls_per_token\": %.3f",
+            seconds > 0 ? result->bytes / 1e6 / seconds : 0.0,
+            seconds > 0 ? result->tokens / seconds : 0.0,
+            result->tokens ? (double)result->syscalls / result->tokens : 0.0);
+    if (result->syscalls) {
+        fprintf(out, ", \"write_ns\": %llu, \"read_p50_ns\": %llu, \"read_p99_ns\": %llu",
+                (unsigned long long)result->write_ns,
+                (unsigned long long)hist_quantile(&result->reads, 0.50),
+                (unsigned long long)hist_quantile(&result->reads, 0.99));
+    }
+    if (baseline_ns) {
+        fprintf(out, ", \"overhead_vs_in_process\": %.2f", (double)result->total_ns / baseline_ns);
+    }
+    if (null_p50_ns) {
+        fprintf(out, ", \"read_p50_above_null_ns\": %lld",
+                (long long)hist_quantile(&result->reads, 0.50) - (long long)null_p50_ns);
+    }
+    if (result->verified >= 0) {
+        fprintf(out, ", \"verified\": %s", result->verified ? "true" : "false");
+    }
+    fprintf(out, "}");
+}
+
+// Path of a scanner minor: minor 0 is the device itself, minor k appends k
+static void minor_path(char *path, size_t size, const Options *opts, int minor) {
+    if (minor == 0) {
+        snprintf(path, size, "%s", opts->device);
+    } else {
+        snprintf(path, size, "%s%d", opts->device, minor);
+    }
+}
+
+// Writers publish the corpus over and over; readers open the latest document
+// of their minor and read every token in it. Each op is timed as a whole.
+static void *contend_worker(void *arg) {
+    Worker *worker = arg;
+    const Options *opts = worker->opts;
+    size_t bufsize = opts->buffers[0];
+    char *buf = malloc(bufsize);
+    char path[256];
+    ssize_t n;
+    int fd;
+
+    minor_path(path, sizeof(path), opts, worker->index % opts->minors);
+    while (buf && !*worker->stop) {
+        uint64_t start = now_ns();
+
+        fd = open(path, O_RDWR);
+        if (fd < 0) {
+            break;
+        }
+        if (worker->writer) {
+            if (write(fd, worker->corpus, worker->size) == (ssize_t)worker->size) {
+                worker->stats->bytes += worker->size;
+            }
+        } else {
+            set_separators(fd, opts->separators);
+            while ((n = read_token(fd, buf, bufsize)) > 0) {
+                worker->stats->bytes += n;
+                worker->stats->tokens++;
+            }
+        }
         close(fd);
-        return EXIT_FAILURE;
+        worker->stats->ops++;
+        hist_add(&worker->stats->latency, now_ns() - start);
+    }
+    free(buf);
+    return NULL;
+}
+
+// Run one readers/writers configuration for the configured duration
+static void contend_once(const Options *opts, const char *corpus, size_t size,
+                         int readers, int writers, int first) {
+    int workers = readers + writers;
+    size_t shared_size = sizeof(int) + workers * sizeof(WorkerStats);
+    char *shared = mmap(NULL, shared_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    Worker *worker = calloc(workers, sizeof(*worker));
+    pthread_t *threads = calloc(workers, sizeof(*threads));
+    pid_t *pids = calloc(workers, sizeof(*pids));
+    Histogram *read_latency = calloc(1, sizeof(*read_latency));
+    Histogram *write_latency = calloc(1, sizeof(*write_latency));
+    uint64_t read_ops = 0, write_ops = 0, read_bytes = 0, write_bytes = 0, tokens = 0;
+    uint64_t start, elapsed;
+    double seconds;
+
+    if (shared == MAP_FAILED || !worker || !threads || !pids || !read_latency || !write_latency) {
+        perror("Failed to allocate workers");
+        exit(EXIT_FAILURE);
     }
 
-    // Read and print tokens
-    while ((bytes_read = read_token(fd, read_buf, sizeof(read_buf) - 1)) > 0) {
-        read_buf[bytes_read] = '\0'; // Null-terminate the string
-        printf("Token: '%s'\n", read_buf);
+    start = now_ns();
+    for (int i = 0; i < workers; i++) {
+        worker[i] = (Worker) {
+            .opts = opts,
+            .corpus = corpus,
+            .size = size,
+            .index = i < writers ? i : i - writers,
+            .writer = i < writers,
+            .stop = (volatile int *)shared,
+            .stats = (WorkerStats *)(shared + sizeof(int)) + i,
+        };
+        if (opts->processes) {
+            pids[i] = fork();
+            if (pids[i] == 0) {
+                contend_worker(&worker[i]);
+                _exit(0);
+            }
+        } else {
+            pthread_create(&threads[i], NULL, contend_worker, &worker[i]);
+        }
     }
 
-    if (bytes_read < 0) {
-        perror("Failed to read data");
+    usleep((useconds_t)(opts->duration * 1e6));
+    *(volatile int *)shared = 1;
+    for (int i = 0; i < workers; i++) {
+        if (opts->processes) {
+            if (pids[i] > 0) {
+                waitpid(pids[i], NULL, 0);
+            }
+        } else {
+            pthread_join(threads[i], NULL);
+        }
+    }
+    elapsed = now_ns() - start;
+    seconds = elapsed / 1e9;
+
+    for (int i = 0; i < workers; i++) {
+        WorkerStats *stats = worker[i].stats;
+        Histogram *latency = worker[i].writer ? write_latency : read_latency;
+
+        for (int bucket = 0; bucket < HIST_BUCKETS; bucket++) {
+            latency->counts[bucket] += stats->latency.counts[bucket];
+        }
+        latency->total += stats->latency.total;
+        if (worker[i].writer) {
+            write_ops += stats->ops;
+            write_bytes += stats->bytes;
+        } else {
+            read_ops += stats->ops;
+            read_bytes += stats->bytes;
+            tokens += stats->tokens;
+        }
+    }
+
+    printf("%s\n    {\"mode\": \"contention\", \"size\": %zu, \"buffer\": %zu, \"readers\": %d, \"writers\": %d",
+           first ? "" : ",", size, opts->buffers[0], readers, writers);
+    printf(", \"minors\": %d, \"workers\": \"%s\", \"seconds\": %.3f",
+           opts->minors, opts->processes ? "processes" : "threads", seconds);
+    printf(", \"read_ops\": %llu, \"read_mb_per_s\": %.2f, \"tokens_per_s\": %.0f",
+           (unsigned long long)read_ops, read_bytes / 1e6 / seconds, tokens / seconds);
+    printf(", \"read_op_p50_ns\": %llu, \"read_op_p99_ns\": %llu",
+           (unsigned long long)hist_quantile(read_latency, 0.50),
+           (unsigned long long)hist_quantile(read_latency, 0.99));
+    printf(", \"write_ops\": %llu, \"write_mb_per_s\": %.2f", (unsigned long long)write_ops,
+           write_bytes / 1e6 / seconds);
+    printf(", \"write_op_p50_ns\": %llu, \"write_op_p99_ns\": %llu}",
+           (unsigned long long)hist_quantile(write_latency, 0.50),
+           (unsigned long long)hist_quantile(write_latency, 0.99));
+    fflush(stdout);
+
+    munmap(shared, shared_size);
+    free(worker);
+    free(threads);
+    free(pids);
+    free(read_latency);
+    free(write_latency);
+}
+
+// Contention mode: seed every minor with the first corpus size, then run
+// either the given readers/writers mix or a sweep of both up to the core count
+static void run_contention(const Options *opts) {
+    size_t size = opts->sizes[0];
+    char *corpus = corpus_create(opts, &size);
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int counts[MAX_LIST];
+    int ncounts = 0;
+    int first = 1;
+
+    for (int minor = 0; minor < opts->minors; minor++) {
+        char path[256];
+        int fd;
+
+        minor_path(path, sizeof(path), opts, minor);
+        fd = open(path, O_RDWR);
+        if (fd < 0 || write(fd, corpus, size) != (ssize_t)size) {
+            fprintf(stderr, "Failed to seed %s: %s\n", path, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
         close(fd);
-        return EXIT_FAILURE;
     }
 
-    // Cleanup
-    close(fd);
+    // Powers of two up to the core count, plus the core count itself
+    for (int n = 1; n < cores && ncounts < MAX_LIST - 1; n *= 2) {
+        counts[ncounts++] = n;
+    }
+    counts[ncounts++] = cores;
+
+    if (opts->readers >= 0) {
+        contend_once(opts, corpus, size, opts->readers, opts->writers, first);
+    } else {
+        for (int w = -1; w < ncounts; w++) {
+            for (int r = 0; r < ncounts; r++) {
+                contend_once(opts, corpus, size, counts[r], w < 0 ? 0 : counts[w], first);
+                first = 0;
+            }
+        }
+    }
+    free(corpus);
+}
+
+// Throughput mode: one corpus per size, tokenized in-process by each baseline
+// and then read back from the device in every mode and buffer size
+static void run_throughput(const Options *opts) {
+    uint64_t null_p50_ns[MAX_LIST] = { 0 };
+    int first = 1;
+
+    for (int b = 0; opts->baseline && b < opts->nbuffers; b++) {
+        Result *result = calloc(1, sizeof(*result));
+        const char *error = NULL;
+
+        if (run_null_device(opts, opts->buffers[b], result) != 0) {
+            error = strerror(errno);
+        } else {
+            null_p50_ns[b] = hist_quantile(&result->reads, 0.50);
+        }
+        result->verified = -1;
+        json_result(stdout, "null_device", 0, opts->buffers[b], result, 0, 0, error, first);
+        first = 0;
+        free(result);
+    }
+
+    // A corpus file is benchmarked once, at its own size
+    for (int i = 0; i < (opts->corpus_file ? 1 : opts->nsizes); i++) {
+        size_t size = opts->sizes[i];
+        char *corpus = corpus_create(opts, &size);
+        char *text = malloc(size + 1);
+        uint64_t baseline_ns = 0;
+        if (!text) {
+            perror("Failed to allocate corpus");
+            exit(EXIT_FAILURE);
+        }
+
+        for (size_t m = 0; m < sizeof(in_process) / sizeof(in_process[0]); m++) {
+            Result *result = calloc(1, sizeof(*result));
+            char name[64];
+
+            run_in_process(opts, &in_process[m], corpus, size, text, result);
+            if (!baseline_ns || result->total_ns < baseline_ns) {
+                baseline_ns = result->total_ns;
+            }
+            snprintf(name, sizeof(name), "in_process:%s", in_process[m].name);
+            result->verified = -1;
+            json_result(stdout, name, size, 0, result, 0, 0, NULL, first);
+            first = 0;
+            free(result);
+        }
+        free(text);
+
+        for (size_t m = 0; m < sizeof(read_modes) / sizeof(read_modes[0]); m++) {
+            for (int b = 0; b < opts->nbuffers; b++) {
+                Result *result;
+                const char *error = NULL;
+
+                if (opts->buffers[b] < scanner_min_read(read_modes[m].mode)) {
+                    continue;   // Too small for one record, e.g. a 16-byte digest read
+                }
+                result = calloc(1, sizeof(*result));
+                result->verified = opts->verify ? 1 : -1;
+                for (int r = 0; r < opts->repeat && !error; r++) {
+                    if (run_once(opts, &read_modes[m], corpus, size, opts->buffers[b], result) != 0) {
+                        error = strerror(errno);
+                    }
+                }
+                json_result(stdout, read_modes[m].name, size, opts->buffers[b], result,
+                            baseline_ns, null_p50_ns[b], error, first);
+                fflush(stdout);
+                first = 0;
+                free(result);
+            }
+        }
+        free(corpus);
+    }
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -d DEVICE      device to benchmark (default " DEVICE_FILE ")\n"
+            "  -B DEVICE      null device to report read latency above, e.g. /dev/Hello\n"
+            "  -s SIZES       corpus sizes, e.g. 1K,64K,1M,1G (default 1K,64K,1M)\n"
+            "  -b BUFFERS     read buffer sizes (default 16,64,4096)\n"
+            "  -t DIST        token lengths: fixed:N, uniform:A-B or geom:MEAN (default geom:6)\n"
+            "  -g DIST        separator run lengths, same forms (default fixed:1)\n"
+            "  -S SEPARATORS  separator characters (default \" \\t\\n\")\n"
+            "  -f FILE        benchmark FILE, e.g. from ScannerWorkload gen, instead of -s/-t/-g\n"
+            "  -r N           repetitions per configuration (default 3)\n"
+            "  -x SEED        corpus random seed (default 1)\n"
+            "  -v             verify every token against libscanner\n"
+            "contention mode, using the first size and buffer:\n"
+            "  -c R:W         run R reader and W writer workers concurrently\n"
+            "  -C             sweep readers and writers up to the core count\n"
+            "  -n MINORS      spread workers over this many minors (default 1)\n"
+            "  -P             use processes instead of threads\n"
+            "  -T SECONDS     duration of each configuration (default 2)\n",
+            prog);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+    Options opts = {
+        .device = DEVICE_FILE,
+        .separators = " \t\n",
+        .repeat = 3,
+        .seed = 1,
+        .minors = 1,
+        .duration = 2,
+    };
+    int contention = 0;
+    int opt;
+
+    dist_parse(&opts.tokens, "geom:6");
+    dist_parse(&opts.gaps, "fixed:1");
+    opts.nsizes = parse_list(opts.sizes, "1K,64K,1M");
+    opts.nbuffers = parse_list(opts.buffers, "16,64,4096");
+
+    while ((opt = getopt(argc, argv, "d:B:s:b:t:g:S:f:r:x:vc:Cn:PT:")) != -1) {
+        switch (opt) {
+            case 'd': opts.device = optarg; break;
+            case 'B': opts.baseline = optarg; break;
+            case 's': opts.nsizes = parse_list(opts.sizes, optarg); break;
+            case 'b': opts.nbuffers = parse_list(opts.buffers, optarg); break;
+            case 't': if (dist_parse(&opts.tokens, optarg)) usage(argv[0]); break;
+            case 'g': if (dist_parse(&opts.gaps, optarg)) usage(argv[0]); break;
+            case 'S': opts.separators = optarg; break;
+            case 'f': opts.corpus_file = optarg; break;
+            case 'r': opts.repeat = atoi(optarg); break;
+            case 'x': opts.seed = strtoull(optarg, NULL, 0); break;
+            case 'v': opts.verify = 1; break;
+            case 'c':
+                if (sscanf(optarg, "%d:%d", &opts.readers, &opts.writers) != 2) usage(argv[0]);
+                contention = 1;
+                break;
+            case 'C': opts.readers = -1; contention = 1; break;
+            case 'n': opts.minors = atoi(optarg); break;
+            case 'P': opts.processes = 1; break;
+            case 'T': opts.duration = atof(optarg); break;
+            default: usage(argv[0]);
+        }
+    }
+    if (!*opts.separators || opts.repeat < 1 || !opts.nsizes || !opts.nbuffers || opts.minors < 1 ||
+        (contention && opts.readers >= 0 && (opts.writers < 0 || opts.readers + opts.writers == 0))) {
+        usage(argv[0]);
+    }
+
+    printf("{\"device\": ");
+    json_string(stdout, opts.device);
+    if (opts.baseline) {
+        printf(", \"null_device\": ");
+        json_string(stdout, opts.baseline);
+    }
+    printf(", \"separators\": ");
+    json_string(stdout, opts.separators);
+    if (opts.corpus_file) {
+        printf(", \"corpus\": ");
+        json_string(stdout, opts.corpus_file);
+    }
+    printf(", \"tokens\": \"%s\", \"gaps\": \"%s\", \"repeat\": %d, \"seed\": %llu, \"simd\": \"%s\",\n  \"results\": [",
+           opts.tokens.spec, opts.gaps.spec, opts.repeat, (unsigned long long)opts.seed, scanner_simd_name());
+
+    if (contention) {
+        run_contention(&opts);
+    } else {
+        run_throughput(&opts);
+    }
+    printf("\n  ]}\n");
     return EXIT_SUCCESS;
 }